@@ -0,0 +1,519 @@
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "core/frame.h"
+#include "core/histogram.h"
+#include "core/send_queue.h"
+#include "core/shm_engine.h"
+#include "core/socket_engine.h"
+
+// Load generator: M simulated clients each send at a fixed rate and every
+// delivery's send-to-receive latency goes into a histogram. Messages carry
+// the time they were *scheduled* to leave rather than when they did, so a
+// stalled sender shows up as latency instead of silently sending less
+// (coordinated omission).
+
+enum class EngineKind { Socket, Shm };
+
+struct BenchOptions {
+    EngineKind engine{EngineKind::Socket};
+    int clients{8};
+    int rate{100};
+    int size{128};
+    int duration{5};
+    int warmup{1};
+    int threads{1};
+    // Socket mode: spread clients over this many rooms and publish to them
+    // instead of broadcasting.
+    int rooms{0};
+    bool external{false};
+    chat::SocketConfig socket;
+    std::string channel{"bench"};
+    chat::WaitMode wait{chat::WaitMode::Hybrid};
+    std::string hugePageDir;
+};
+
+// Leading bytes of every payload; the rest is filler up to --size.
+struct Stamp {
+    uint32_t sender;
+    uint32_t reserved;
+    uint64_t seq;
+    int64_t sentNs;
+};
+
+constexpr size_t kStampSize = sizeof(Stamp);
+constexpr int64_t kDrainNs = 1000000000;
+
+static int64_t NowNs() {
+    timespec ts{};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+// Millisecond epoll timeouts would add up to 1 ms of send lag to every
+// sample; epoll_pwait2() takes a timespec.
+static int WaitEvents(int epollFd, epoll_event* events, int max, int64_t timeoutNs) {
+#ifdef __NR_epoll_pwait2
+    timespec ts{static_cast<time_t>(timeoutNs / 1000000000), static_cast<long>(timeoutNs % 1000000000)};
+    long n = syscall(__NR_epoll_pwait2, epollFd, events, max, &ts, nullptr, 8);
+    if (n >= 0 || errno != ENOSYS) return static_cast<int>(n);
+#endif
+    return epoll_wait(epollFd, events, max, static_cast<int>((timeoutNs + 999999) / 1000000));
+}
+
+static void RaiseFileLimit() {
+    rlimit lim{};
+    if (getrlimit(RLIMIT_NOFILE, &lim) == 0 && lim.rlim_cur < lim.rlim_max) {
+        lim.rlim_cur = lim.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &lim);
+    }
+}
+
+static void PrintUsage() {
+    std::fprintf(stderr,
+        "usage: chat_bench [--engine socket|shm] [--clients M] [--rate MSGS_PER_SEC] [--size BYTES]\n"
+        "                  [--duration SEC] [--warmup SEC] [--threads T]\n"
+        "  socket:         [--port P] [--reactors N] [--transport epoll|uring] [--flush-us US]\n"
+        "                  [--rooms R]  (client i joins room i %% R and publishes there)\n"
+        "                  [--external --host H]  (bench a running server instead of an in-process one)\n"
+        "  shm:            [--channel NAME] [--wait busy|hybrid|block] [--huge-pages DIR]\n"
+        "                  (all clients share one channel)\n");
+}
+
+static bool ParseArgs(int argc, char** argv, BenchOptions& opts) {
+    opts.socket.port = 54100;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--engine" && hasValue) {
+            std::string v = argv[++i];
+            if (v == "socket") opts.engine = EngineKind::Socket;
+            else if (v == "shm") opts.engine = EngineKind::Shm;
+            else return false;
+        } else if (arg == "--rooms" && hasValue) {
+            opts.rooms = std::atoi(argv[++i]);
+        } else if (arg == "--clients" && hasValue) {
+            opts.clients = std::atoi(argv[++i]);
+        } else if (arg == "--rate" && hasValue) {
+            opts.rate = std::atoi(argv[++i]);
+        } else if (arg == "--size" && hasValue) {
+            opts.size = std::atoi(argv[++i]);
+        } else if (arg == "--duration" && hasValue) {
+            opts.duration = std::atoi(argv[++i]);
+        } else if (arg == "--warmup" && hasValue) {
+            opts.warmup = std::atoi(argv[++i]);
+        } else if (arg == "--threads" && hasValue) {
+            opts.threads = std::atoi(argv[++i]);
+        } else if (arg == "--external") {
+            opts.external = true;
+        } else if (arg == "--host" && hasValue) {
+            opts.socket.host = argv[++i];
+        } else if (arg == "--port" && hasValue) {
+            opts.socket.port = std::atoi(argv[++i]);
+        } else if (arg == "--reactors" && hasValue) {
+            opts.socket.reactors = std::atoi(argv[++i]);
+        } else if (arg == "--transport" && hasValue) {
+            std::string v = argv[++i];
+            if (v == "epoll") opts.socket.transport = chat::Transport::Epoll;
+            else if (v == "uring" || v == "io_uring") opts.socket.transport = chat::Transport::IoUring;
+            else return false;
+        } else if (arg == "--flush-us" && hasValue) {
+            opts.socket.flushWindowUs = std::atoi(argv[++i]);
+        } else if (arg == "--channel" && hasValue) {
+            opts.channel = argv[++i];
+        } else if (arg == "--huge-pages" && hasValue) {
+            opts.hugePageDir = argv[++i];
+        } else if (arg == "--wait" && hasValue) {
+            std::string v = argv[++i];
+            if (v == "busy") opts.wait = chat::WaitMode::BusyPoll;
+            else if (v == "hybrid") opts.wait = chat::WaitMode::Hybrid;
+            else if (v == "block") opts.wait = chat::WaitMode::Blocking;
+            else return false;
+        } else {
+            return false;
+        }
+    }
+    return opts.clients >= 2 && opts.rate > 0 && opts.size >= static_cast<int>(kStampSize) &&
+           opts.duration > 0 && opts.warmup >= 0 && opts.threads > 0;
+}
+
+// Shared clock and counters for one run. Only messages scheduled inside the
+// measurement window [measureStart, measureEnd) are counted.
+struct RunState {
+    int64_t measureStart{0};
+    int64_t measureEnd{0};
+    int64_t stopAt{0};
+    std::atomic<uint64_t> sent{0};
+    std::atomic<uint64_t> delivered{0};
+    std::atomic<uint64_t> deliveredBytes{0};
+    std::mutex histLock;
+    chat::Histogram latency;
+
+    bool InWindow(int64_t ns) const { return ns >= measureStart && ns < measureEnd; }
+};
+
+static std::string MakePayload(uint32_t sender, uint64_t seq, int64_t sentNs, size_t size) {
+    std::string payload(size, 'x');
+    Stamp stamp{sender, 0, seq, sentNs};
+    std::memcpy(&payload[0], &stamp, kStampSize);
+    return payload;
+}
+
+// ---- socket mode -----------------------------------------------------------
+
+struct BenchClient {
+    int fd{-1};
+    uint32_t index{0};
+    uint64_t seq{0};
+    std::string room;
+    int64_t nextSendNs{0};
+    bool wantWrite{false};
+    chat::RecvBuffer inbuf;
+    chat::FrameDecoder decoder{inbuf};
+    chat::SendQueue sendq;
+};
+
+static int ConnectClient(const chat::SocketConfig& cfg) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, IPPROTO_TCP);
+    if (fd < 0) return -1;
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(static_cast<uint16_t>(cfg.port));
+    if (inet_pton(AF_INET, cfg.host.c_str(), &addr.sin_addr) != 1 ||
+        connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+}
+
+static void SetWriteInterest(int epollFd, BenchClient& client, bool want) {
+    if (client.wantWrite == want) return;
+    client.wantWrite = want;
+    epoll_event ev{};
+    ev.events = EPOLLIN | (want ? EPOLLOUT : 0u);
+    ev.data.ptr = &client;
+    epoll_ctl(epollFd, EPOLL_CTL_MOD, client.fd, &ev);
+}
+
+static void ReadClient(BenchClient& client, RunState& run, chat::Histogram& hist,
+                       uint64_t& delivered, uint64_t& bytes) {
+    for (;;) {
+        char* dst = client.inbuf.Prepare(64 * 1024);
+        ssize_t n = recv(client.fd, dst, client.inbuf.Writable(), 0);
+        if (n <= 0) return;
+        client.inbuf.Commit(static_cast<size_t>(n));
+        int64_t now = NowNs();
+        chat::FrameView frame;
+        std::string room;
+        while (client.decoder.Next(frame) == chat::DecodeResult::Frame) {
+            const char* body = frame.payload;
+            size_t len = frame.header.length;
+            if (frame.header.type == chat::FrameType::Publish) {
+                if (!chat::ReadPublish(frame, room, body, len)) continue;
+            } else if (frame.header.type != chat::FrameType::Text) {
+                continue;
+            }
+            if (len < kStampSize) continue;
+            Stamp stamp;
+            std::memcpy(&stamp, body, kStampSize);
+            if (!run.InWindow(stamp.sentNs)) continue;
+            hist.Record(static_cast<uint64_t>(now - stamp.sentNs));
+            ++delivered;
+            bytes += len;
+        }
+    }
+}
+
+// One I/O thread drives a slice of the clients: an open-loop send schedule
+// per client plus an epoll set for replies.
+static void RunSocketWorker(std::vector<std::unique_ptr<BenchClient>>& clients, const BenchOptions& opts,
+                            RunState& run) {
+    int epollFd = epoll_create1(EPOLL_CLOEXEC);
+    for (auto& c : clients) {
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.ptr = c.get();
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, c->fd, &ev);
+    }
+    chat::Histogram hist;
+    uint64_t sent = 0;
+    uint64_t delivered = 0;
+    uint64_t bytes = 0;
+    const int64_t interval = 1000000000LL / opts.rate;
+    std::vector<epoll_event> events(256);
+
+    for (;;) {
+        int64_t now = NowNs();
+        if (now >= run.stopAt) break;
+        int64_t nextDue = run.stopAt;
+        for (auto& c : clients) {
+            if (c->nextSendNs < run.measureEnd) {
+                while (c->nextSendNs <= now && c->nextSendNs < run.measureEnd) {
+                    std::string payload =
+                        MakePayload(c->index, ++c->seq, c->nextSendNs, static_cast<size_t>(opts.size));
+                    if (c->room.empty()) {
+                        c->sendq.Push(chat::EncodeFrame(chat::FrameType::Text, 0, c->seq, payload));
+                    } else {
+                        c->sendq.Push(chat::EncodePublish(c->seq, c->room, payload.data(), payload.size()));
+                    }
+                    if (run.InWindow(c->nextSendNs)) ++sent;
+                    c->nextSendNs += interval;
+                }
+                if (c->nextSendNs < nextDue) nextDue = c->nextSendNs;
+            }
+            if (!c->sendq.Empty() && !c->wantWrite) {
+                chat::FlushResult r = c->sendq.Flush(c->fd);
+                SetWriteInterest(epollFd, *c, r == chat::FlushResult::Blocked);
+            }
+        }
+        int64_t waitNs = nextDue - NowNs();
+        int n = WaitEvents(epollFd, events.data(), static_cast<int>(events.size()), waitNs > 0 ? waitNs : 0);
+        for (int i = 0; i < n; ++i) {
+            auto* c = static_cast<BenchClient*>(events[i].data.ptr);
+            if (events[i].events & EPOLLIN) ReadClient(*c, run, hist, delivered, bytes);
+            if (events[i].events & EPOLLOUT) {
+                chat::FlushResult r = c->sendq.Flush(c->fd);
+                SetWriteInterest(epollFd, *c, r == chat::FlushResult::Blocked);
+            }
+        }
+    }
+    close(epollFd);
+
+    run.sent += sent;
+    run.delivered += delivered;
+    run.deliveredBytes += bytes;
+    std::lock_guard<std::mutex> lock(run.histLock);
+    run.latency.Merge(hist);
+}
+
+static bool RunSocket(const BenchOptions& opts, RunState& run, chat::SocketStats& serverStats) {
+    std::unique_ptr<chat::SocketEngine> server;
+    if (!opts.external) {
+        chat::SocketConfig cfg = opts.socket;
+        cfg.role = chat::Role::Server;
+        // Relayed messages would otherwise flood the log; only errors matter.
+        server = std::make_unique<chat::SocketEngine>([](const chat::ChatEvent& ev) {
+            if (ev.type == chat::EventType::Log && ev.text.rfind("[!]", 0) != 0 &&
+                ev.text.find("failed") != std::string::npos) {
+                std::fprintf(stderr, "server: %s\n", ev.text.c_str());
+            }
+        });
+        if (!server->Start(cfg)) {
+            std::fprintf(stderr, "could not start the server on port %d\n", cfg.port);
+            return false;
+        }
+    }
+
+    int threads = std::min(opts.threads, opts.clients);
+    std::vector<std::vector<std::unique_ptr<BenchClient>>> slices(threads);
+    for (int i = 0; i < opts.clients; ++i) {
+        auto c = std::make_unique<BenchClient>();
+        c->index = static_cast<uint32_t>(i);
+        c->fd = ConnectClient(opts.socket);
+        if (c->fd < 0) {
+            std::fprintf(stderr, "client %d could not connect to %s:%d\n", i, opts.socket.host.c_str(),
+                         opts.socket.port);
+            return false;
+        }
+        if (opts.rooms > 0) {
+            c->room = "room" + std::to_string(i % opts.rooms);
+            c->sendq.Push(chat::EncodeFrame(chat::FrameType::Join, 0, 0, c->room));
+            c->sendq.Flush(c->fd);
+        }
+        slices[i % threads].push_back(std::move(c));
+    }
+    // Let the server register every connection (and room) before traffic starts.
+    usleep(200 * 1000);
+
+    int64_t start = NowNs();
+    run.measureStart = start + int64_t(opts.warmup) * 1000000000;
+    run.measureEnd = run.measureStart + int64_t(opts.duration) * 1000000000;
+    run.stopAt = run.measureEnd + kDrainNs;
+    // Spread first sends across one interval so clients do not fire in lockstep.
+    const int64_t interval = 1000000000LL / opts.rate;
+    for (auto& slice : slices) {
+        for (auto& c : slice) c->nextSendNs = start + interval * c->index / opts.clients;
+    }
+
+    chat::SocketStats before = server ? server->Stats() : chat::SocketStats{};
+    std::vector<std::thread> workers;
+    for (auto& slice : slices) {
+        workers.emplace_back([&slice, &opts, &run] { RunSocketWorker(slice, opts, run); });
+    }
+    for (auto& t : workers) t.join();
+    if (server) {
+        chat::SocketStats after = server->Stats();
+        serverStats = after;
+        serverStats.syscalls = after.syscalls - before.syscalls;
+    }
+    for (auto& slice : slices) {
+        for (auto& c : slice) close(c->fd);
+    }
+    if (server) server->Stop();
+    return true;
+}
+
+// ---- shm mode ----------------------------------------------------------------
+
+// Every client attaches to one channel, so each message is delivered to all
+// the others, as with the socket server.
+static bool RunShm(const BenchOptions& opts, RunState& run) {
+    size_t size = std::min(static_cast<size_t>(opts.size), chat::kMaxSlabPayload);
+    std::vector<std::unique_ptr<chat::Histogram>> hists;
+    std::vector<std::unique_ptr<chat::ShmEngine>> peers;
+    std::atomic<uint64_t> delivered{0};
+    std::atomic<uint64_t> bytes{0};
+    std::mutex histLock;
+
+    // Payloads are UTF-8 text on this engine, so the stamp is written in hex.
+    auto onEvent = [&](const chat::ChatEvent& ev) {
+        if (ev.type != chat::EventType::Message) return;
+        int64_t now = NowNs();
+        std::string_view body = ev.Body();
+        long long sentNs = std::strtoll(std::string(body.substr(0, 16)).c_str(), nullptr, 16);
+        if (!run.InWindow(sentNs)) return;
+        {
+            std::lock_guard<std::mutex> lock(histLock);
+            run.latency.Record(static_cast<uint64_t>(now - sentNs));
+        }
+        ++delivered;
+        bytes += body.size();
+    };
+
+    for (int c = 0; c < opts.clients; ++c) {
+        chat::ShmConfig cfg;
+        cfg.channel = opts.channel;
+        cfg.maxMessageBytes = size;
+        cfg.wait = opts.wait;
+        cfg.hugePageDir = opts.hugePageDir;
+        auto engine = std::make_unique<chat::ShmEngine>(onEvent);
+        if (!engine->Start(cfg)) {
+            std::fprintf(stderr, "could not attach to shm channel %s\n", cfg.channel.c_str());
+            return false;
+        }
+        peers.push_back(std::move(engine));
+    }
+
+    int64_t start = NowNs();
+    run.measureStart = start + int64_t(opts.warmup) * 1000000000;
+    run.measureEnd = run.measureStart + int64_t(opts.duration) * 1000000000;
+    run.stopAt = run.measureEnd + kDrainNs;
+    const int64_t interval = 1000000000LL / opts.rate;
+
+    int threads = std::min(opts.threads, static_cast<int>(peers.size()));
+    std::vector<std::thread> senders;
+    for (int t = 0; t < threads; ++t) {
+        senders.emplace_back([&, t] {
+            std::vector<int64_t> next;
+            for (size_t i = t; i < peers.size(); i += threads) {
+                next.push_back(start + interval * int64_t(i) / int64_t(peers.size()));
+            }
+            uint64_t sent = 0;
+            char stamp[32];
+            for (;;) {
+                int64_t now = NowNs();
+                if (now >= run.measureEnd) break;
+                int64_t nextDue = run.measureEnd;
+                size_t k = 0;
+                for (size_t i = t; i < peers.size(); i += threads, ++k) {
+                    while (next[k] <= now && next[k] < run.measureEnd) {
+                        std::snprintf(stamp, sizeof(stamp), "%016llx ", static_cast<long long>(next[k]));
+                        std::string text(size, 'x');
+                        std::memcpy(&text[0], stamp, std::min<size_t>(17, size));
+                        if (peers[i]->Send(text) && run.InWindow(next[k])) ++sent;
+                        next[k] += interval;
+                    }
+                    if (next[k] < nextDue) nextDue = next[k];
+                }
+                int64_t waitNs = nextDue - NowNs();
+                if (waitNs > 0) {
+                    timespec ts{static_cast<time_t>(waitNs / 1000000000), static_cast<long>(waitNs % 1000000000)};
+                    nanosleep(&ts, nullptr);
+                }
+            }
+            run.sent += sent;
+        });
+    }
+    for (auto& t : senders) t.join();
+    while (NowNs() < run.stopAt) usleep(10 * 1000);
+    for (auto& p : peers) p->Stop();
+    run.delivered += delivered;
+    run.deliveredBytes += bytes;
+    return true;
+}
+
+static void PrintReport(const BenchOptions& opts, RunState& run, const chat::SocketStats* serverStats) {
+    double secs = static_cast<double>(opts.duration);
+    const chat::Histogram& h = run.latency;
+    const char* engine = opts.engine == EngineKind::Socket ? "socket" : "shm";
+    std::printf("engine=%s", engine);
+    if (opts.engine == EngineKind::Socket) {
+        std::printf(" transport=%s reactors=%d", opts.socket.transport == chat::Transport::IoUring ? "uring" : "epoll",
+                    opts.socket.reactors);
+    } else {
+        const char* waits[] = {"busy", "hybrid", "block"};
+        std::printf(" wait=%s", waits[static_cast<int>(opts.wait)]);
+    }
+    std::printf(" clients=%d rate=%d/s size=%dB duration=%ds", opts.clients, opts.rate, opts.size, opts.duration);
+    if (opts.engine == EngineKind::Socket && opts.rooms > 0) std::printf(" rooms=%d", opts.rooms);
+    std::printf("\n");
+    std::printf("sent       %" PRIu64 " msgs (%.0f msgs/s)\n", run.sent.load(), run.sent.load() / secs);
+    std::printf("delivered  %" PRIu64 " msgs (%.0f msgs/s, %.2f MB/s)\n", run.delivered.load(),
+                run.delivered.load() / secs, run.deliveredBytes.load() / secs / 1e6);
+    std::printf("latency us p50=%.1f p99=%.1f p99.9=%.1f max=%.1f mean=%.1f\n",
+                h.Percentile(50) / 1e3, h.Percentile(99) / 1e3, h.Percentile(99.9) / 1e3,
+                h.Max() / 1e3, h.Mean() / 1e3);
+    if (serverStats) {
+        // Includes the warmup and drain periods, so this is a rate over the whole run.
+        double runSecs = static_cast<double>(opts.warmup + opts.duration) + kDrainNs / 1e9;
+        std::printf("server     %.0f syscalls/s, %" PRIu64 " dropped\n", serverStats->syscalls / runSecs,
+                    serverStats->droppedFrames);
+    }
+}
+
+int main(int argc, char** argv) {
+    BenchOptions opts;
+    if (!ParseArgs(argc, argv, opts)) {
+        PrintUsage();
+        return 2;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    RaiseFileLimit();
+
+    RunState run;
+    if (opts.engine == EngineKind::Socket) {
+        chat::SocketStats serverStats;
+        if (!RunSocket(opts, run, serverStats)) return 1;
+        PrintReport(opts, run, opts.external ? nullptr : &serverStats);
+    } else {
+        if (!RunShm(opts, run)) return 1;
+        PrintReport(opts, run, nullptr);
+    }
+    return 0;
+}
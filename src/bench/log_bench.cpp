@@ -0,0 +1,167 @@
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "core/histogram.h"
+#include "core/log_model.h"
+
+// Drives the GUI's log pipeline without a GUI: producer threads push chat
+// lines as fast as they can (or at --rate each), and a consumer flushes them
+// into a LogModel once per frame and mirrors every update into a string that
+// stands in for the edit control. Reports how many lines got through, how
+// many wake-ups they cost, how long each frame's flush took and how much text
+// is retained.
+
+struct LogBenchOptions {
+    int producers{4};
+    int rate{0};
+    int size{64};
+    int duration{5};
+    int frameMs{16};
+    size_t maxChars{1024 * 1024};
+    size_t chunkChars{64 * 1024};
+};
+
+struct ProducerStats {
+    uint64_t pushed{0};
+    uint64_t wakeups{0};
+    chat::Histogram push;
+};
+
+static int64_t NowNs() {
+    timespec ts{};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+static void SleepUntil(int64_t ns) {
+    timespec ts{static_cast<time_t>(ns / 1000000000), static_cast<long>(ns % 1000000000)};
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr);
+}
+
+static void PrintUsage() {
+    std::fprintf(stderr,
+        "usage: log_bench [--producers N] [--rate LINES_PER_SEC] [--size CHARS] [--duration SEC]\n"
+        "                 [--frame-ms MS] [--max-chars N] [--chunk-chars N]\n"
+        "  --rate 0 (default) pushes as fast as possible\n");
+}
+
+static bool ParseArgs(int argc, char** argv, LogBenchOptions& opts) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--producers" && hasValue) {
+            opts.producers = std::atoi(argv[++i]);
+        } else if (arg == "--rate" && hasValue) {
+            opts.rate = std::atoi(argv[++i]);
+        } else if (arg == "--size" && hasValue) {
+            opts.size = std::atoi(argv[++i]);
+        } else if (arg == "--duration" && hasValue) {
+            opts.duration = std::atoi(argv[++i]);
+        } else if (arg == "--frame-ms" && hasValue) {
+            opts.frameMs = std::atoi(argv[++i]);
+        } else if (arg == "--max-chars" && hasValue) {
+            opts.maxChars = std::strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--chunk-chars" && hasValue) {
+            opts.chunkChars = std::strtoull(argv[++i], nullptr, 10);
+        } else {
+            return false;
+        }
+    }
+    return opts.producers > 0 && opts.rate >= 0 && opts.size >= 16 && opts.duration > 0 && opts.frameMs > 0;
+}
+
+int main(int argc, char** argv) {
+    LogBenchOptions opts;
+    if (!ParseArgs(argc, argv, opts)) {
+        PrintUsage();
+        return 2;
+    }
+
+    chat::LogPipeline<char> logs;
+    chat::LogModel<char> model(opts.maxChars, opts.chunkChars);
+    std::atomic<bool> running{true};
+    std::vector<ProducerStats> stats(static_cast<size_t>(opts.producers));
+    std::vector<std::thread> producers;
+    int64_t start = NowNs();
+    int64_t stopAt = start + int64_t(opts.duration) * 1000000000;
+
+    for (int p = 0; p < opts.producers; ++p) {
+        producers.emplace_back([&, p] {
+            ProducerStats& st = stats[static_cast<size_t>(p)];
+            std::string prefix = "[RX][Peer " + std::to_string(p + 1) + "] ";
+            int64_t interval = opts.rate ? 1000000000LL / opts.rate : 0;
+            int64_t next = start;
+            while (running.load(std::memory_order_relaxed)) {
+                if (interval) {
+                    SleepUntil(next);
+                    next += interval;
+                }
+                std::string line = prefix + std::to_string(st.pushed);
+                line.resize(static_cast<size_t>(opts.size) - 2, 'x');
+                line += "\r\n";
+                int64_t t0 = NowNs();
+                if (logs.Push(std::move(line))) ++st.wakeups;
+                st.push.Record(static_cast<uint64_t>(NowNs() - t0));
+                ++st.pushed;
+            }
+        });
+    }
+
+    // The UI thread: one drain and one view update per frame.
+    chat::Histogram flush;
+    chat::LogUpdate<char> update;
+    std::string view;
+    uint64_t drained = 0;
+    uint64_t frames = 0;
+    uint64_t trimmed = 0;
+    int64_t frameNs = int64_t(opts.frameMs) * 1000000;
+    for (int64_t next = start + frameNs;; next += frameNs) {
+        SleepUntil(next);
+        bool last = next >= stopAt;
+        if (last) {
+            running = false;
+            for (auto& t : producers) t.join();
+        }
+        int64_t t0 = NowNs();
+        drained += logs.Drain(model);
+        while (last && logs.Queued()) drained += logs.Drain(model);
+        model.TakeUpdate(update);
+        view.erase(0, update.trim);
+        view += update.append;
+        flush.Record(static_cast<uint64_t>(NowNs() - t0));
+        trimmed += update.trim;
+        ++frames;
+        if (last) break;
+    }
+
+    chat::Histogram push;
+    uint64_t pushed = 0;
+    uint64_t wakeups = 0;
+    for (const ProducerStats& st : stats) {
+        push.Merge(st.push);
+        pushed += st.pushed;
+        wakeups += st.wakeups;
+    }
+    double secs = (NowNs() - start) / 1e9;
+    std::printf("producers=%d rate=%s size=%dB frame=%dms model=%zu chars\n", opts.producers,
+                opts.rate ? std::to_string(opts.rate).c_str() : "max", opts.size, opts.frameMs, model.Capacity());
+    std::printf("pushed     %" PRIu64 " lines (%.0f lines/s), %" PRIu64 " wake-ups, %" PRIu64 " dropped at the queue\n",
+                pushed, pushed / secs, wakeups, logs.Dropped());
+    std::printf("drained    %" PRIu64 " lines in %" PRIu64 " frames (%.1f lines/frame)\n", drained, frames,
+                frames ? static_cast<double>(drained) / static_cast<double>(frames) : 0.0);
+    std::printf("push ns    p50=%" PRIu64 " p99=%" PRIu64 " p99.9=%" PRIu64 " max=%" PRIu64 "\n", push.Percentile(50),
+                push.Percentile(99), push.Percentile(99.9), push.Max());
+    std::printf("flush us   p50=%.1f p99=%.1f max=%.1f\n", flush.Percentile(50) / 1e3, flush.Percentile(99) / 1e3,
+                flush.Max() / 1e3);
+    std::printf("retained   %zu chars in view, %zu in model, %" PRIu64 " lines dropped, %" PRIu64 " chars trimmed\n",
+                view.size(), model.Chars(), model.DroppedLines(), trimmed);
+    return view == model.Text() && drained + logs.Dropped() == pushed ? 0 : 1;
+}
@@ -0,0 +1,361 @@
+#include <sched.h>
+#include <signal.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "core/histogram.h"
+#include "core/shm_engine.h"
+
+// Round-trip latency of the shm engine between two processes pinned to
+// chosen cores. The pinger publishes a sequence-stamped message, the ponger
+// publishes it straight back from its receive callback, and the pinger sends
+// the next one from its own callback as soon as the echo lands, so exactly
+// one message is in flight and every round trip is two full Send/receive
+// hops. Each wait mode and message size is a separate run on a fresh channel.
+
+struct PingOptions {
+    uint64_t iterations{1000000};
+    uint64_t warmup{10000};
+    std::vector<size_t> sizes{32, 256, 4096, 65536};
+    std::vector<chat::WaitMode> waits{chat::WaitMode::BusyPoll, chat::WaitMode::Hybrid, chat::WaitMode::Blocking};
+    int cpuA{0};
+    int cpuB{1};
+    // Round trips slower than this are listed individually.
+    double thresholdUs{100.0};
+    size_t maxOutliers{10};
+    std::string channel{"pingpong"};
+    std::string hugePageDir;
+};
+
+// Payloads are UTF-8 text on this engine, so the sequence is written in hex.
+constexpr size_t kSeqDigits = 16;
+constexpr int64_t kStallNs = 5000000000;
+
+static const char* const kWaitNames[] = {"busy", "hybrid", "block"};
+
+static int64_t NowNs() {
+    timespec ts{};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+static void PrintUsage() {
+    std::fprintf(stderr,
+        "usage: shm_pingpong [--iterations N] [--warmup N] [--sizes B,B,...] [--wait busy,hybrid,block|all]\n"
+        "                    [--cpu-a CPU] [--cpu-b CPU] [--threshold-us US] [--outliers N]\n"
+        "                    [--channel NAME] [--huge-pages DIR]\n");
+}
+
+static bool ParseList(const std::string& v, const std::function<bool(const std::string&)>& add) {
+    size_t start = 0;
+    while (start <= v.size()) {
+        size_t comma = v.find(',', start);
+        if (comma == std::string::npos) comma = v.size();
+        if (!add(v.substr(start, comma - start))) return false;
+        start = comma + 1;
+    }
+    return true;
+}
+
+static bool ParseArgs(int argc, char** argv, PingOptions& opts) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--iterations" && hasValue) {
+            opts.iterations = std::strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--warmup" && hasValue) {
+            opts.warmup = std::strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--sizes" && hasValue) {
+            opts.sizes.clear();
+            bool ok = ParseList(argv[++i], [&](const std::string& s) {
+                long long n = std::atoll(s.c_str());
+                if (n < static_cast<long long>(kSeqDigits) || n > static_cast<long long>(chat::kMaxSlabPayload)) {
+                    return false;
+                }
+                opts.sizes.push_back(static_cast<size_t>(n));
+                return true;
+            });
+            if (!ok) return false;
+        } else if (arg == "--wait" && hasValue) {
+            std::string v = argv[++i];
+            if (v == "all") continue;
+            opts.waits.clear();
+            bool ok = ParseList(v, [&](const std::string& s) {
+                if (s == "busy") opts.waits.push_back(chat::WaitMode::BusyPoll);
+                else if (s == "hybrid") opts.waits.push_back(chat::WaitMode::Hybrid);
+                else if (s == "block") opts.waits.push_back(chat::WaitMode::Blocking);
+                else return false;
+                return true;
+            });
+            if (!ok) return false;
+        } else if (arg == "--cpu-a" && hasValue) {
+            opts.cpuA = std::atoi(argv[++i]);
+        } else if (arg == "--cpu-b" && hasValue) {
+            opts.cpuB = std::atoi(argv[++i]);
+        } else if (arg == "--threshold-us" && hasValue) {
+            opts.thresholdUs = std::atof(argv[++i]);
+        } else if (arg == "--outliers" && hasValue) {
+            opts.maxOutliers = static_cast<size_t>(std::atoi(argv[++i]));
+        } else if (arg == "--channel" && hasValue) {
+            opts.channel = argv[++i];
+        } else if (arg == "--huge-pages" && hasValue) {
+            opts.hugePageDir = argv[++i];
+        } else {
+            return false;
+        }
+    }
+    return opts.iterations > 0 && !opts.sizes.empty() && !opts.waits.empty() && opts.cpuA >= 0 && opts.cpuB >= 0 &&
+           opts.thresholdUs > 0;
+}
+
+// Threads started afterwards, the engine's receive thread included, inherit
+// the mask.
+static bool PinTo(int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+
+static chat::ShmConfig MakeConfig(const PingOptions& opts, const std::string& channel, chat::WaitMode wait,
+                                  size_t size) {
+    chat::ShmConfig cfg;
+    cfg.channel = channel;
+    cfg.wait = wait;
+    cfg.hugePageDir = opts.hugePageDir;
+    // Anything over the default inline limit takes the slab path, as it would
+    // in a real session.
+    cfg.slabBytes = size > cfg.maxMessageBytes ? cfg.slabBytes : 0;
+    return cfg;
+}
+
+static uint64_t ParseSeq(std::string_view body) {
+    if (body.size() < kSeqDigits) return UINT64_MAX;
+    return std::strtoull(std::string(body.substr(0, kSeqDigits)).c_str(), nullptr, 16);
+}
+
+static std::string MakePayload(uint64_t seq, size_t size) {
+    std::string text(size, 'x');
+    char stamp[kSeqDigits + 1];
+    std::snprintf(stamp, sizeof(stamp), "%016" PRIx64, seq);
+    std::memcpy(&text[0], stamp, kSeqDigits);
+    return text;
+}
+
+// Child side: echo every message until the pinger leaves the channel.
+static int RunPonger(const PingOptions& opts, const std::string& channel, chat::WaitMode wait, size_t size) {
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+    if (!PinTo(opts.cpuB)) {
+        std::fprintf(stderr, "cannot pin the ponger to cpu %d\n", opts.cpuB);
+        return 1;
+    }
+    std::mutex lock;
+    std::condition_variable cv;
+    bool pingerSeen = false;
+    bool done = false;
+    chat::ShmEngine* self = nullptr;
+    chat::ShmEngine engine([&](const chat::ChatEvent& ev) {
+        if (ev.type == chat::EventType::Message) {
+            self->Send(std::string(ev.Body()));
+        } else if (ev.type == chat::EventType::Connected) {
+            std::lock_guard<std::mutex> guard(lock);
+            pingerSeen = true;
+        } else if (ev.type == chat::EventType::Disconnected) {
+            std::lock_guard<std::mutex> guard(lock);
+            done = pingerSeen;
+            cv.notify_all();
+        }
+    });
+    self = &engine;
+    if (!engine.Start(MakeConfig(opts, channel, wait, size))) return 1;
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        cv.wait(guard, [&] { return done; });
+    }
+    engine.Stop();
+    return 0;
+}
+
+struct Outlier {
+    uint64_t seq;
+    int64_t atNs;
+    int64_t rttNs;
+};
+
+struct PingResult {
+    chat::Histogram rtt;
+    uint64_t outliers{0};
+    std::vector<Outlier> firstOutliers;
+    double meanNs{0};
+    double m2{0};
+    int64_t elapsedNs{0};
+    bool stalled{false};
+};
+
+// Parent side: drives the ping-pong from its receive callback and records
+// every measured round trip.
+static bool RunPinger(const PingOptions& opts, const std::string& channel, chat::WaitMode wait, size_t size,
+                      PingResult& result) {
+    const uint64_t total = opts.warmup + opts.iterations;
+    const int64_t thresholdNs = static_cast<int64_t>(opts.thresholdUs * 1000);
+    std::mutex lock;
+    std::condition_variable cv;
+    bool ready = false;
+    bool finished = false;
+    std::atomic<uint64_t> progress{0};
+    uint64_t next = 0;
+    int64_t sentAt = 0;
+    int64_t measureStart = 0;
+    chat::ShmEngine* self = nullptr;
+
+    // Everything but the events below runs on the receive thread only.
+    chat::ShmEngine engine([&](const chat::ChatEvent& ev) {
+        if (ev.type == chat::EventType::Connected) {
+            std::lock_guard<std::mutex> guard(lock);
+            ready = true;
+            cv.notify_all();
+            return;
+        }
+        if (ev.type != chat::EventType::Message) return;
+        int64_t now = NowNs();
+        if (ParseSeq(ev.Body()) != next) return;
+        if (next >= opts.warmup) {
+            int64_t rtt = now - sentAt;
+            result.rtt.Record(static_cast<uint64_t>(rtt));
+            // Welford's running variance, for the jitter figure.
+            uint64_t n = next - opts.warmup + 1;
+            double delta = static_cast<double>(rtt) - result.meanNs;
+            result.meanNs += delta / static_cast<double>(n);
+            result.m2 += delta * (static_cast<double>(rtt) - result.meanNs);
+            if (rtt > thresholdNs) {
+                if (result.firstOutliers.size() < opts.maxOutliers) {
+                    result.firstOutliers.push_back({next - opts.warmup, sentAt - measureStart, rtt});
+                }
+                ++result.outliers;
+            }
+        }
+        progress.store(++next, std::memory_order_relaxed);
+        if (next == total) {
+            result.elapsedNs = now - measureStart;
+            std::lock_guard<std::mutex> guard(lock);
+            finished = true;
+            cv.notify_all();
+            return;
+        }
+        if (next == opts.warmup) measureStart = NowNs();
+        std::string payload = MakePayload(next, size);
+        sentAt = NowNs();
+        self->Send(payload);
+    });
+    self = &engine;
+    if (!engine.Start(MakeConfig(opts, channel, wait, size))) return false;
+
+    std::unique_lock<std::mutex> guard(lock);
+    if (!cv.wait_for(guard, std::chrono::nanoseconds(kStallNs), [&] { return ready; })) {
+        guard.unlock();
+        std::fprintf(stderr, "ponger never joined %s\n", channel.c_str());
+        engine.Stop();
+        return false;
+    }
+    guard.unlock();
+    if (opts.warmup == 0) measureStart = NowNs();
+    sentAt = NowNs();
+    engine.Send(MakePayload(0, size));
+
+    // A round trip that never comes back would otherwise hang the run.
+    guard.lock();
+    uint64_t seen = 0;
+    while (!finished) {
+        cv.wait_for(guard, std::chrono::nanoseconds(kStallNs));
+        uint64_t now = progress.load(std::memory_order_relaxed);
+        if (!finished && now == seen) {
+            result.stalled = true;
+            break;
+        }
+        seen = now;
+    }
+    guard.unlock();
+    engine.Stop();
+    return true;
+}
+
+static void PrintResult(const PingOptions& opts, chat::WaitMode wait, size_t size, const PingResult& r) {
+    const chat::Histogram& h = r.rtt;
+    std::printf("wait=%s size=%zuB cpus=%d,%d round trips=%" PRIu64 "%s\n", kWaitNames[static_cast<int>(wait)], size,
+                opts.cpuA, opts.cpuB, h.Count(), r.stalled ? " (stalled)" : "");
+    if (!h.Count()) return;
+    double stddev = h.Count() > 1 ? std::sqrt(r.m2 / static_cast<double>(h.Count() - 1)) : 0.0;
+    std::printf("  rtt us   min=%.2f p50=%.2f p90=%.2f p99=%.2f p99.9=%.2f p99.99=%.2f max=%.2f\n",
+                h.Min() / 1e3, h.Percentile(50) / 1e3, h.Percentile(90) / 1e3, h.Percentile(99) / 1e3,
+                h.Percentile(99.9) / 1e3, h.Percentile(99.99) / 1e3, h.Max() / 1e3);
+    std::printf("  jitter   mean=%.2f stddev=%.2f p99.9-p50=%.2f us, %.0f round trips/s\n", r.meanNs / 1e3,
+                stddev / 1e3, (static_cast<double>(h.Percentile(99.9)) - h.Percentile(50)) / 1e3,
+                r.elapsedNs > 0 ? h.Count() / (r.elapsedNs / 1e9) : 0.0);
+    std::printf("  outliers %" PRIu64 " over %.0f us (%.4f%%)\n", r.outliers, opts.thresholdUs,
+                100.0 * static_cast<double>(r.outliers) / static_cast<double>(h.Count()));
+    for (const Outlier& o : r.firstOutliers) {
+        std::printf("    #%" PRIu64 " at +%.3f ms: %.1f us\n", o.seq, o.atNs / 1e6, o.rttNs / 1e3);
+    }
+}
+
+int main(int argc, char** argv) {
+    PingOptions opts;
+    if (!ParseArgs(argc, argv, opts)) {
+        PrintUsage();
+        return 2;
+    }
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (opts.cpuA >= cpus || opts.cpuB >= cpus) {
+        std::fprintf(stderr, "only %ld cpus online\n", cpus);
+        return 2;
+    }
+    if (opts.cpuA == opts.cpuB) {
+        std::fprintf(stderr, "warning: both processes share cpu %d; busy waiting will time-slice\n", opts.cpuA);
+    }
+
+    int failures = 0;
+    int run = 0;
+    for (chat::WaitMode wait : opts.waits) {
+        for (size_t size : opts.sizes) {
+            // A fresh channel per run, so no state carries over between them.
+            std::string channel = opts.channel + "-" + std::to_string(getpid()) + "-" + std::to_string(run++);
+            std::fflush(stdout);
+            pid_t child = fork();
+            if (child < 0) {
+                std::perror("fork");
+                return 1;
+            }
+            if (child == 0) _exit(RunPonger(opts, channel, wait, size));
+
+            PingResult result;
+            bool ok = PinTo(opts.cpuA) && RunPinger(opts, channel, wait, size, result);
+            if (!ok || result.stalled) kill(child, SIGKILL);
+            int status = 0;
+            waitpid(child, &status, 0);
+            if (!ok) {
+                std::fprintf(stderr, "run wait=%s size=%zu failed\n", kWaitNames[static_cast<int>(wait)], size);
+                ++failures;
+                continue;
+            }
+            PrintResult(opts, wait, size, result);
+        }
+    }
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,203 @@
+#include <time.h>
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "core/utf.h"
+
+// Throughput of the transcoders in core/utf.h on a few kinds of chat text,
+// for every instruction set this CPU supports, against the scalar path. Each
+// corpus is converted whole or, with --message, as a run of short messages
+// the way the GUI converts them. Every level's output is checked against the
+// scalar one.
+
+struct UtfBenchOptions {
+    size_t bytes{1024 * 1024};
+    size_t message{0};
+    int iterations{50};
+};
+
+// One message's place in each encoding of the corpus.
+struct Span {
+    size_t at8, len8;
+    size_t at16, len16;
+    size_t at32, len32;
+};
+
+struct Corpus {
+    const char* name;
+    std::string utf8;
+    std::u16string utf16;
+    std::u32string utf32;
+    std::vector<Span> messages;
+};
+
+enum class Op { Utf8ToUtf16, Utf16ToUtf8, Utf8ToUtf32, Utf32ToUtf8, Validate };
+
+static volatile uint64_t sink;
+
+static const char* const kOpNames[] = {"utf8->utf16", "utf16->utf8", "utf8->utf32", "utf32->utf8", "validate"};
+
+static int64_t NowNs() {
+    timespec ts{};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+static void PrintUsage() {
+    std::fprintf(stderr, "usage: utf8_bench [--bytes N] [--message BYTES] [--iterations N]\n");
+}
+
+static bool ParseArgs(int argc, char** argv, UtfBenchOptions& opts) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--bytes" && hasValue) {
+            opts.bytes = std::strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--message" && hasValue) {
+            opts.message = std::strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--iterations" && hasValue) {
+            opts.iterations = std::atoi(argv[++i]);
+        } else {
+            return false;
+        }
+    }
+    return opts.bytes >= 64 && opts.iterations > 0;
+}
+
+// Repeats `sample` to about `bytes` and cuts it into messages of about
+// `message` bytes, both on code point boundaries.
+static Corpus MakeCorpus(const char* name, const std::string& sample, const UtfBenchOptions& opts) {
+    Corpus c;
+    c.name = name;
+    while (c.utf8.size() < opts.bytes) c.utf8 += sample;
+    c.utf16.resize(chat::MaxUtf16ForUtf8(c.utf8.size()));
+    c.utf32.resize(chat::MaxUtf32ForUtf8(c.utf8.size()));
+    size_t step = opts.message ? opts.message : c.utf8.size();
+    size_t at16 = 0;
+    size_t at32 = 0;
+    for (size_t at = 0; at < c.utf8.size();) {
+        size_t end = at + step < c.utf8.size() ? at + step : c.utf8.size();
+        while (end < c.utf8.size() && (static_cast<unsigned char>(c.utf8[end]) & 0xC0) == 0x80) ++end;
+        size_t len16 = chat::Utf8ToUtf16(c.utf8.data() + at, end - at, &c.utf16[at16]).written;
+        size_t len32 = chat::Utf8ToUtf32(c.utf8.data() + at, end - at, &c.utf32[at32]).written;
+        c.messages.push_back({at, end - at, at16, len16, at32, len32});
+        at16 += len16;
+        at32 += len32;
+        at = end;
+    }
+    c.utf16.resize(at16);
+    c.utf32.resize(at32);
+    return c;
+}
+
+template <typename Unit>
+static uint64_t Hash(uint64_t h, const Unit* data, size_t n) {
+    for (size_t i = 0; i < n; ++i) h = (h ^ static_cast<uint64_t>(data[i])) * 1099511628211ull;
+    return h;
+}
+
+// Runs `op` over every message of the corpus once. Returns a checksum of the
+// output so the work cannot be optimised away; with `full` it covers every
+// unit written, for comparing levels.
+static uint64_t RunOnce(Op op, const Corpus& c, std::vector<char>& bytes, std::u16string& units16,
+                        std::u32string& units32, bool full) {
+    uint64_t sum = 0;
+    for (const Span& m : c.messages) {
+        const char* in = c.utf8.data() + m.at8;
+        chat::TranscodeResult r;
+        switch (op) {
+        case Op::Utf8ToUtf16:
+            r = chat::Utf8ToUtf16(in, m.len8, &units16[0]);
+            sum = full ? Hash(sum + r.written, units16.data(), r.written) : sum + r.written + units16[r.written / 2];
+            break;
+        case Op::Utf8ToUtf32:
+            r = chat::Utf8ToUtf32(in, m.len8, &units32[0]);
+            sum = full ? Hash(sum + r.written, units32.data(), r.written) : sum + r.written + units32[r.written / 2];
+            break;
+        case Op::Utf16ToUtf8:
+            r = chat::Utf16ToUtf8(c.utf16.data() + m.at16, m.len16, bytes.data());
+            sum = full ? Hash(sum + r.written, bytes.data(), r.written)
+                       : sum + r.written + static_cast<unsigned char>(bytes[r.written / 2]);
+            break;
+        case Op::Utf32ToUtf8:
+            r = chat::Utf32ToUtf8(c.utf32.data() + m.at32, m.len32, bytes.data());
+            sum = full ? Hash(sum + r.written, bytes.data(), r.written)
+                       : sum + r.written + static_cast<unsigned char>(bytes[r.written / 2]);
+            break;
+        case Op::Validate:
+            sum += chat::ValidUtf8(in, m.len8);
+            break;
+        }
+    }
+    return sum;
+}
+
+int main(int argc, char** argv) {
+    UtfBenchOptions opts;
+    if (!ParseArgs(argc, argv, opts)) {
+        PrintUsage();
+        return 2;
+    }
+
+    std::vector<chat::SimdLevel> levels;
+    for (chat::SimdLevel l :
+         {chat::SimdLevel::Scalar, chat::SimdLevel::Sse2, chat::SimdLevel::Avx2, chat::SimdLevel::Neon}) {
+        if (chat::SetSimdLevel(l) == l) levels.push_back(l);
+    }
+    chat::SetSimdLevel(chat::SimdLevel::Scalar);
+
+    std::vector<Corpus> corpora;
+    corpora.push_back(MakeCorpus("ascii", "[RX][Peer 2] see you at 5, the build is green again!\r\n", opts));
+    corpora.push_back(MakeCorpus("latin", "[RX][Peer 2] Grüße aus Köln, à bientôt et señor café!\r\n", opts));
+    corpora.push_back(MakeCorpus("cyrillic", "[RX][Peer 2] Привет, как дела? Сборка снова зелёная.\r\n", opts));
+    corpora.push_back(MakeCorpus("cjk", "[RX][Peer 2] 今日は会議がありますか？ビルドは成功しました。\r\n", opts));
+    corpora.push_back(MakeCorpus("emoji", "[RX][Peer 2] ship it 🚀🎉 thanks 🙏 see you 👋\r\n", opts));
+
+    std::printf("detected=%s message=%s\n", chat::SimdLevelName(chat::DetectedSimdLevel()),
+                opts.message ? (std::to_string(opts.message) + "B").c_str() : "whole");
+    std::printf("%-10s %-12s", "corpus", "op");
+    for (chat::SimdLevel l : levels) std::printf(" %9s MB/s", chat::SimdLevelName(l));
+    std::printf("\n");
+
+    int mismatches = 0;
+    for (const Corpus& c : corpora) {
+        std::vector<char> bytes(chat::MaxUtf8ForUtf32(c.utf8.size()));
+        std::u16string units16(chat::MaxUtf16ForUtf8(c.utf8.size()), u'\0');
+        std::u32string units32(chat::MaxUtf32ForUtf8(c.utf8.size()), U'\0');
+        for (int o = 0; o <= static_cast<int>(Op::Validate); ++o) {
+            Op op = static_cast<Op>(o);
+            std::printf("%-10s %-12s", c.name, kOpNames[o]);
+            uint64_t reference = 0;
+            double scalarRate = 0;
+            for (chat::SimdLevel l : levels) {
+                chat::SetSimdLevel(l);
+                uint64_t check = RunOnce(op, c, bytes, units16, units32, true);
+                uint64_t sum = 0;
+                int64_t t0 = NowNs();
+                for (int it = 0; it < opts.iterations; ++it) sum += RunOnce(op, c, bytes, units16, units32, false);
+                double secs = (NowNs() - t0) / 1e9;
+                double rate = static_cast<double>(c.utf8.size()) * opts.iterations / secs / 1e6;
+                sink = sink + sum;
+                if (l == chat::SimdLevel::Scalar) {
+                    reference = check;
+                    scalarRate = rate;
+                    std::printf(" %14.0f", rate);
+                } else {
+                    std::printf(" %8.0f x%4.1f", rate, rate / scalarRate);
+                    if (check != reference) {
+                        std::printf("!");
+                        ++mismatches;
+                    }
+                }
+            }
+            std::printf("\n");
+        }
+    }
+    if (mismatches) std::fprintf(stderr, "%d results differ from the scalar path\n", mismatches);
+    return mismatches ? 1 : 0;
+}
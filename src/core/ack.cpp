@@ -0,0 +1,197 @@
+#include "core/ack.h"
+
+#include <algorithm>
+
+namespace chat {
+
+void AckWindow::Shift(uint64_t n) {
+    base += n;
+    size_t words = bits.size();
+    if (n >= kSpan) {
+        bits.fill(0);
+        return;
+    }
+    size_t wordShift = static_cast<size_t>(n / 64);
+    unsigned bitShift = static_cast<unsigned>(n % 64);
+    for (size_t i = 0; i < words; ++i) {
+        size_t from = i + wordShift;
+        uint64_t lo = from < words ? bits[from] : 0;
+        uint64_t hi = from + 1 < words ? bits[from + 1] : 0;
+        bits[i] = bitShift ? (lo >> bitShift) | (hi << (64 - bitShift)) : lo;
+    }
+}
+
+bool AckWindow::Accept(uint64_t seq) {
+    if (!started) {
+        started = true;
+        base = seq - 1;
+    }
+    if (seq <= base) return false;
+    uint64_t off = seq - base - 1;
+    if (off >= kSpan) {
+        Shift(off - kSpan + 1);
+        off = kSpan - 1;
+    }
+    if (Test(off)) return false;
+    bits[off / 64] |= uint64_t(1) << (off % 64);
+    // Fold the run now complete above `base` into it, a word at a time.
+    uint64_t run = 0;
+    for (uint64_t word : bits) {
+        if (word == ~uint64_t(0)) {
+            run += 64;
+            continue;
+        }
+        while (word & 1) {
+            word >>= 1;
+            ++run;
+        }
+        break;
+    }
+    if (run) Shift(run);
+    return true;
+}
+
+void AckWindow::Reset(uint64_t cumulative) {
+    base = cumulative;
+    started = true;
+    bits.fill(0);
+}
+
+void AckWindow::Ranges(std::vector<AckRange>& out, size_t max) const {
+    out.clear();
+    for (uint64_t off = 0; off < kSpan && out.size() < max;) {
+        if (!bits[off / 64]) {
+            off = (off / 64 + 1) * 64;
+            continue;
+        }
+        if (!Test(off)) {
+            ++off;
+            continue;
+        }
+        uint64_t first = off;
+        while (off < kSpan && Test(off)) ++off;
+        out.emplace_back(base + 1 + first, base + off);
+    }
+}
+
+void AppendSeq(std::vector<AckRange>& ranges, uint64_t seq) {
+    if (!ranges.empty() && ranges.back().second + 1 == seq) {
+        ranges.back().second = seq;
+        return;
+    }
+    ranges.emplace_back(seq, seq);
+}
+
+void UnackedFrames::Add(uint64_t seq, SharedFrame frame) {
+    bytes += frame->size();
+    entries.push_back(Entry{seq, std::move(frame)});
+}
+
+void UnackedFrames::Ack(uint64_t cumulative, const std::vector<AckRange>& ranges) {
+    while (!entries.empty() && entries.front().seq <= cumulative) {
+        bytes -= entries.front().frame->size();
+        entries.pop_front();
+    }
+    if (ranges.empty()) return;
+    auto acked = [&](const Entry& e) {
+        for (const AckRange& r : ranges) {
+            if (e.seq >= r.first && e.seq <= r.second) return true;
+        }
+        return false;
+    };
+    for (const Entry& e : entries) {
+        if (acked(e)) bytes -= e.frame->size();
+    }
+    entries.erase(std::remove_if(entries.begin(), entries.end(), acked), entries.end());
+}
+
+void SessionWindows::Open(uint64_t token, const SessionOwner& owner) {
+    std::lock_guard<std::mutex> lock(mutex);
+    owners[token] = Holders{owner, owner};
+}
+
+bool SessionWindows::Claim(uint64_t token, const SessionOwner& owner, AckWindow& window, std::vector<AckRange>& own,
+                           SessionOwner& previous, SessionOwner& displaced) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = owners.find(token);
+    if (it == owners.end()) {
+        owners[token] = Holders{owner, owner};
+        TakeLocked(token, window, own);
+        return true;
+    }
+    Holders& h = it->second;
+    if (h.owner.id != owner.id && h.owner.id != h.holder.id) displaced = h.owner;
+    h.owner = owner;
+    if (h.holder.id == owner.id) return true;
+    if (h.holder.id != 0) {
+        previous = h.holder;
+        return false;
+    }
+    h.holder = owner;
+    TakeLocked(token, window, own);
+    return true;
+}
+
+bool SessionWindows::Close(uint64_t token, uint64_t id, bool holding, const AckWindow& window,
+                           const std::vector<AckRange>& own, SessionOwner& next) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = owners.find(token);
+    if (it == owners.end()) {
+        if (holding) PutLocked(token, window, own);
+        return false;
+    }
+    Holders& h = it->second;
+    if (h.holder.id == id) {
+        if (holding) PutLocked(token, window, own);
+        h.holder = SessionOwner{};
+    }
+    if (h.owner.id == id) {
+        // Gave up waiting: the holder, if any, is on its way out already.
+        if (h.holder.id) h.owner = h.holder;
+        else owners.erase(it);
+        return false;
+    }
+    if (h.holder.id) return false;
+    next = h.owner;
+    return true;
+}
+
+bool SessionWindows::Take(uint64_t token, uint64_t id, AckWindow& window, std::vector<AckRange>& own) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = owners.find(token);
+    if (it == owners.end() || it->second.owner.id != id || it->second.holder.id != 0) return false;
+    it->second.holder = it->second.owner;
+    TakeLocked(token, window, own);
+    return true;
+}
+
+void SessionWindows::PutLocked(uint64_t token, const AckWindow& window, const std::vector<AckRange>& own) {
+    parked[token] = Parked{window, own, ++generation};
+    order.emplace_back(token, generation);
+    while (parked.size() > maxSessions && !order.empty()) {
+        auto it = parked.find(order.front().first);
+        if (it != parked.end() && it->second.generation == order.front().second) parked.erase(it);
+        order.pop_front();
+    }
+    // Entries for sessions taken back since only cost memory; drop them when
+    // they dominate.
+    if (order.size() > 2 * maxSessions) {
+        std::deque<std::pair<uint64_t, uint64_t>> live;
+        for (const auto& o : order) {
+            auto it = parked.find(o.first);
+            if (it != parked.end() && it->second.generation == o.second) live.push_back(o);
+        }
+        order.swap(live);
+    }
+}
+
+bool SessionWindows::TakeLocked(uint64_t token, AckWindow& window, std::vector<AckRange>& own) {
+    auto it = parked.find(token);
+    if (it == parked.end()) return false;
+    window = it->second.window;
+    own = std::move(it->second.own);
+    parked.erase(it);
+    return true;
+}
+
+} // namespace chat
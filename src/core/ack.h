@@ -0,0 +1,135 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "core/frame.h"
+
+namespace chat {
+
+// Receive side of an acknowledged stream: every sequence number up to
+// Cumulative() has arrived, and a bitmap covers the next kSpan. The window
+// starts just below the first sequence number it sees. One that lands past
+// the bitmap slides it forward, giving up on the oldest gaps.
+class AckWindow {
+public:
+    static constexpr uint64_t kSpan = 1024;
+
+    // False if `seq` arrived before (or is too old to tell): a duplicate.
+    bool Accept(uint64_t seq);
+    // Runs of sequence numbers received above Cumulative(), oldest first, at
+    // most `max` of them.
+    void Ranges(std::vector<AckRange>& out, size_t max) const;
+
+    // Starts over with everything up to `cumulative` counted as received.
+    void Reset(uint64_t cumulative);
+
+    uint64_t Cumulative() const { return base; }
+    bool Started() const { return started; }
+
+private:
+    bool Test(uint64_t off) const { return (bits[off / 64] >> (off % 64)) & 1; }
+    void Shift(uint64_t n);
+
+    uint64_t base{0};
+    bool started{false};
+    // Bit i: base + 1 + i has arrived.
+    std::array<uint64_t, kSpan / 64> bits{};
+};
+
+// Adds `seq`, larger than any before it, to ascending `ranges`, extending
+// the last one when adjacent.
+void AppendSeq(std::vector<AckRange>& ranges, uint64_t seq);
+
+// Send side: frames kept until the peer acknowledges them, so only those go
+// out again after a reconnect.
+class UnackedFrames {
+public:
+    struct Entry {
+        uint64_t seq;
+        SharedFrame frame;
+    };
+
+    void Add(uint64_t seq, SharedFrame frame);
+    // Forgets every frame at or below `cumulative` or inside one of `ranges`.
+    void Ack(uint64_t cumulative, const std::vector<AckRange>& ranges);
+
+    const std::deque<Entry>& Entries() const { return entries; }
+    size_t Frames() const { return entries.size(); }
+    size_t Bytes() const { return bytes; }
+
+private:
+    std::deque<Entry> entries;
+    size_t bytes{0};
+};
+
+// The connection holding a session: its reactor shard, and its descriptor
+// and id there. Ids are unique across shards.
+struct SessionOwner {
+    unsigned shard{0};
+    int fd{-1};
+    uint64_t id{0};
+};
+
+// Which connection holds each session, and the receive windows of sessions
+// that are not connected right now, so a resumed session keeps recognising
+// what its client sends again, with the sequence numbers given to the
+// session's latest messages, so a resume can report them again. A session
+// moves between connections only through Claim() and Close(), so a window
+// is never parked over one a newer connection already holds. Shared by
+// every reactor; parks at most `maxSessions`, forgetting the oldest.
+class SessionWindows {
+public:
+    explicit SessionWindows(size_t maxSessions = 65536) : maxSessions(maxSessions) {}
+
+    // Records that `owner` holds the new session `token`.
+    void Open(uint64_t token, const SessionOwner& owner);
+    // Makes `owner` the session's newest claimant. True, with the parked
+    // window and sequence numbers moved out if there are any, unless another
+    // connection still holds them: then `previous` is set to that one, which
+    // has to close before `owner` can Take() them. `displaced` is set to an
+    // earlier claimant still waiting, which should be closed too.
+    bool Claim(uint64_t token, const SessionOwner& owner, AckWindow& window, std::vector<AckRange>& own,
+               SessionOwner& previous, SessionOwner& displaced);
+    // Releases connection `id`'s part in the session, parking its window and
+    // sequence numbers if it held them and `holding`. True, with `next` set,
+    // if that leaves them parked for a claimant waiting to Take() them.
+    bool Close(uint64_t token, uint64_t id, bool holding, const AckWindow& window, const std::vector<AckRange>& own,
+               SessionOwner& next);
+    // For the newest claimant, once nobody holds the session: moves the
+    // parked window and sequence numbers, if any, out. False if `id` is no
+    // longer the newest claimant.
+    bool Take(uint64_t token, uint64_t id, AckWindow& window, std::vector<AckRange>& own);
+
+private:
+    // `holder` has the session's window (id 0: parked or none); `owner`
+    // claimed it last, and waits for it while the two differ.
+    struct Holders {
+        SessionOwner owner;
+        SessionOwner holder;
+    };
+
+    void PutLocked(uint64_t token, const AckWindow& window, const std::vector<AckRange>& own);
+    bool TakeLocked(uint64_t token, AckWindow& window, std::vector<AckRange>& own);
+
+    struct Parked {
+        AckWindow window;
+        std::vector<AckRange> own;
+        uint64_t generation;
+    };
+
+    size_t maxSessions;
+    std::mutex mutex;
+    std::unordered_map<uint64_t, Parked> parked;
+    std::unordered_map<uint64_t, Holders> owners;
+    std::deque<std::pair<uint64_t, uint64_t>> order;
+    uint64_t generation{0};
+};
+
+} // namespace chat
@@ -0,0 +1,98 @@
+#include "core/chat_events.h"
+
+#include <chrono>
+#include <utility>
+
+namespace chat {
+
+void EventQueue::Push(ChatEvent ev) {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (closed) return;
+        items.push_back(std::move(ev));
+    }
+    ready.notify_one();
+}
+
+bool EventQueue::Pop(ChatEvent& out, int timeoutMs) {
+    std::unique_lock<std::mutex> guard(lock);
+    auto pred = [this] { return closed || !items.empty(); };
+    if (timeoutMs < 0) {
+        ready.wait(guard, pred);
+    } else if (!ready.wait_for(guard, std::chrono::milliseconds(timeoutMs), pred)) {
+        return false;
+    }
+    if (items.empty()) return false;
+    out = std::move(items.front());
+    items.pop_front();
+    return true;
+}
+
+size_t EventQueue::Drain(std::vector<ChatEvent>& out) {
+    std::lock_guard<std::mutex> guard(lock);
+    size_t n = items.size();
+    for (auto& ev : items) out.push_back(std::move(ev));
+    items.clear();
+    return n;
+}
+
+void EventQueue::Close() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        closed = true;
+    }
+    ready.notify_all();
+}
+
+EventCallback EventQueue::Sink() {
+    return [this](const ChatEvent& ev) { Push(ev); };
+}
+
+void EmitLog(const EventCallback& cb, const std::string& text) {
+    if (!cb) return;
+    ChatEvent ev;
+    ev.type = EventType::Log;
+    ev.text = text;
+    cb(ev);
+}
+
+void EmitStatus(const EventCallback& cb, const std::string& text) {
+    if (!cb) return;
+    ChatEvent ev;
+    ev.type = EventType::Status;
+    ev.text = text;
+    cb(ev);
+}
+
+void EmitConnected(const EventCallback& cb, uint64_t peerId, bool connected) {
+    if (!cb) return;
+    ChatEvent ev;
+    ev.type = connected ? EventType::Connected : EventType::Disconnected;
+    ev.peerId = peerId;
+    cb(ev);
+}
+
+void EmitMessage(const EventCallback& cb, uint64_t peerId, const std::string& from, std::string text) {
+    if (!cb) return;
+    ChatEvent ev;
+    ev.type = EventType::Message;
+    ev.peerId = peerId;
+    ev.from = from;
+    ev.text = std::move(text);
+    cb(ev);
+}
+
+void EmitPayload(const EventCallback& cb, uint64_t peerId, const std::string& from, const char* data, size_t size,
+                 std::shared_ptr<const void> ref) {
+    if (!cb) return;
+    ChatEvent ev;
+    ev.type = EventType::Message;
+    ev.peerId = peerId;
+    ev.from = from;
+    ev.payload = data;
+    ev.payloadSize = size;
+    ev.payloadRef = std::move(ref);
+    cb(ev);
+}
+
+} // namespace chat
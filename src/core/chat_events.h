@@ -0,0 +1,58 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace chat {
+
+enum class EventType { Log, Status, Connected, Disconnected, Message };
+
+struct ChatEvent {
+    EventType type{EventType::Log};
+    uint64_t peerId{0};
+    std::string from;
+    std::string text;
+    // Large shared-memory messages arrive in place instead of in `text`:
+    // `payload` points into the channel's slab and stays valid while this
+    // event, or a copy of `payloadRef`, is alive.
+    const char* payload{nullptr};
+    size_t payloadSize{0};
+    std::shared_ptr<const void> payloadRef;
+
+    std::string_view Body() const { return payload ? std::string_view(payload, payloadSize) : std::string_view(text); }
+};
+
+using EventCallback = std::function<void(const ChatEvent&)>;
+
+// Engines report through a callback; hosts that would rather poll can point
+// the callback at an EventQueue via Sink().
+class EventQueue {
+public:
+    void Push(ChatEvent ev);
+    bool Pop(ChatEvent& out, int timeoutMs);
+    size_t Drain(std::vector<ChatEvent>& out);
+    void Close();
+    EventCallback Sink();
+
+private:
+    std::mutex lock;
+    std::condition_variable ready;
+    std::deque<ChatEvent> items;
+    bool closed{false};
+};
+
+void EmitLog(const EventCallback& cb, const std::string& text);
+void EmitStatus(const EventCallback& cb, const std::string& text);
+void EmitConnected(const EventCallback& cb, uint64_t peerId, bool connected);
+void EmitMessage(const EventCallback& cb, uint64_t peerId, const std::string& from, std::string text);
+void EmitPayload(const EventCallback& cb, uint64_t peerId, const std::string& from, const char* data, size_t size,
+                 std::shared_ptr<const void> ref);
+
+} // namespace chat
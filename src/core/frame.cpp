@@ -0,0 +1,159 @@
+#include "core/frame.h"
+
+#include <cstring>
+
+namespace chat {
+
+static void PutLe(char* out, uint64_t v, size_t bytes) {
+    for (size_t i = 0; i < bytes; ++i) out[i] = static_cast<char>((v >> (8 * i)) & 0xFF);
+}
+
+static uint64_t GetLe(const char* in, size_t bytes) {
+    uint64_t v = 0;
+    for (size_t i = 0; i < bytes; ++i) v |= static_cast<uint64_t>(static_cast<unsigned char>(in[i])) << (8 * i);
+    return v;
+}
+
+void WriteFrameHeader(char* out, const FrameHeader& header) {
+    out[0] = static_cast<char>(header.version);
+    out[1] = static_cast<char>(header.type);
+    PutLe(out + 2, header.flags, 2);
+    PutLe(out + 4, header.length, 4);
+    PutLe(out + 8, header.seq, 8);
+}
+
+FrameHeader ReadFrameHeader(const char* in) {
+    FrameHeader header;
+    header.version = static_cast<uint8_t>(in[0]);
+    header.type = static_cast<FrameType>(static_cast<uint8_t>(in[1]));
+    header.flags = static_cast<uint16_t>(GetLe(in + 2, 2));
+    header.length = static_cast<uint32_t>(GetLe(in + 4, 4));
+    header.seq = GetLe(in + 8, 8);
+    return header;
+}
+
+void AppendFrame(std::string& out, FrameType type, uint16_t flags, uint64_t seq,
+                 const char* payload, size_t len) {
+    FrameHeader header;
+    header.type = type;
+    header.flags = flags;
+    header.length = static_cast<uint32_t>(len);
+    header.seq = seq;
+    size_t base = out.size();
+    out.resize(base + kFrameHeaderSize + len);
+    WriteFrameHeader(&out[base], header);
+    if (len) std::memcpy(&out[base + kFrameHeaderSize], payload, len);
+}
+
+std::string EncodeFrame(FrameType type, uint16_t flags, uint64_t seq, const std::string& payload) {
+    std::string out;
+    AppendFrame(out, type, flags, seq, payload.data(), payload.size());
+    return out;
+}
+
+std::string EncodeSession(FrameType type, uint16_t flags, uint64_t seq, uint64_t token, uint64_t streamId) {
+    char payload[kSessionPayloadSize];
+    PutLe(payload, token, 8);
+    PutLe(payload + 8, streamId, 8);
+    std::string out;
+    AppendFrame(out, type, flags, seq, payload, sizeof(payload));
+    return out;
+}
+
+bool ReadSession(const FrameView& frame, uint64_t& token, uint64_t& streamId) {
+    if (frame.header.length != kSessionPayloadSize) return false;
+    token = GetLe(frame.payload, 8);
+    streamId = GetLe(frame.payload + 8, 8);
+    return true;
+}
+
+std::string EncodeAck(uint64_t cumulative, const std::vector<AckRange>& ranges, uint16_t flags) {
+    char payload[kMaxAckRanges * 16];
+    size_t count = ranges.size() < kMaxAckRanges ? ranges.size() : kMaxAckRanges;
+    for (size_t i = 0; i < count; ++i) {
+        PutLe(payload + i * 16, ranges[i].first, 8);
+        PutLe(payload + i * 16 + 8, ranges[i].second, 8);
+    }
+    std::string out;
+    AppendFrame(out, FrameType::Ack, flags, cumulative, payload, count * 16);
+    return out;
+}
+
+bool ReadAck(const FrameView& frame, std::vector<AckRange>& ranges) {
+    ranges.clear();
+    size_t len = frame.header.length;
+    if (len % 16 || len / 16 > kMaxAckRanges) return false;
+    for (size_t off = 0; off < len; off += 16) {
+        ranges.emplace_back(GetLe(frame.payload + off, 8), GetLe(frame.payload + off + 8, 8));
+    }
+    return true;
+}
+
+std::string EncodePublish(uint64_t seq, const std::string& room, const char* text, size_t len) {
+    std::string payload;
+    payload.reserve(1 + room.size() + len);
+    payload.push_back(static_cast<char>(room.size()));
+    payload.append(room);
+    payload.append(text, len);
+    return EncodeFrame(FrameType::Publish, 0, seq, payload);
+}
+
+bool ReadPublish(const FrameView& frame, std::string& room, const char*& text, size_t& len) {
+    if (frame.header.length < 1) return false;
+    size_t nameLen = static_cast<uint8_t>(frame.payload[0]);
+    if (nameLen == 0 || 1 + nameLen > frame.header.length) return false;
+    room.assign(frame.payload + 1, nameLen);
+    text = frame.payload + 1 + nameLen;
+    len = frame.header.length - 1 - nameLen;
+    return true;
+}
+
+char* RecvBuffer::Prepare(size_t minFree) {
+    if (readPos == writePos) {
+        readPos = writePos = 0;
+    }
+    if (Writable() < minFree && readPos > 0) {
+        size_t live = Readable();
+        std::memmove(data.data(), data.data() + readPos, live);
+        readPos = 0;
+        writePos = live;
+    }
+    if (Writable() < minFree) {
+        size_t want = data.size() * 2;
+        if (want < writePos + minFree) want = writePos + minFree;
+        data.resize(want);
+    }
+    return data.data() + writePos;
+}
+
+void RecvBuffer::Consume(size_t n) {
+    readPos += n;
+    if (readPos > writePos) readPos = writePos;
+}
+
+DecodeResult FrameDecoder::Next(FrameView& out) {
+    size_t avail = buffer.Readable();
+    if (avail < kFrameHeaderSize) {
+        missing = kFrameHeaderSize - avail;
+        return DecodeResult::NeedMore;
+    }
+    const char* p = buffer.ReadPtr();
+    FrameHeader header = ReadFrameHeader(p);
+    if (header.version != kFrameVersion || header.length > kMaxFramePayload) {
+        return DecodeResult::Error;
+    }
+    size_t total = kFrameHeaderSize + header.length;
+    if (avail < total) {
+        missing = total - avail;
+        return DecodeResult::NeedMore;
+    }
+    out.header = header;
+    out.raw = p;
+    out.rawSize = total;
+    out.payload = p + kFrameHeaderSize;
+    missing = 0;
+    buffer.Consume(total);
+    return DecodeResult::Frame;
+}
+
+} // namespace chat
@@ -0,0 +1,160 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace chat {
+
+// Wire format: every message is one frame made of a fixed 16-byte header
+// followed by `length` payload bytes. Multi-byte fields are little-endian.
+//
+//   0      1      2      4          8                 16
+//   +------+------+------+----------+-----------------+--------
+//   | ver  | type | flags| length   | seq             | payload
+//   +------+------+------+----------+-----------------+--------
+constexpr uint8_t kFrameVersion = 1;
+constexpr size_t kFrameHeaderSize = 16;
+constexpr uint32_t kMaxFramePayload = 16u * 1024 * 1024;
+
+// ChannelOpen and ChannelData only travel between two ShmBridges
+// (shm_bridge.h): `flags` carries the sender's id for a bridged channel and an
+// open frame's payload is that channel's name. HistoryRequest asks a relay
+// with a message store (message_store.h) for stored messages: `flags` is a
+// HistoryMode and `seq` its argument, and there is no payload.
+// A relay greets each connection with Session: its session token and the
+// relay's stream id, with `seq` the newest sequence number. A reconnecting
+// client sends Resume with its old token and stream id and the last sequence
+// number it received; the relay adopts the token, answers with Session
+// (flag kSessionResumed) and then sends only what the client missed.
+// Ack acknowledges numbered frames received from the peer: `seq` is the
+// cumulative point and the payload up to kMaxAckRanges selective ranges above
+// it, each a pair of inclusive 8-byte bounds. A relay Ack flagged kAckOwn
+// instead lists the sequence numbers the relay gave the client's own
+// messages, which it never sends back, so the client can count them as
+// received; `seq` is unused. One flagged kAckLost lists, the same way,
+// messages a resume asked for that the relay can no longer replay.
+// Join and Leave subscribe a client to a room, named by the payload. Publish
+// is a Text message for one room's subscribers only: a one-byte name length,
+// the name, then the text. Room messages are live only; they are neither
+// sequenced nor stored, so a resume never replays them. A relay says so in
+// every Session frame (flag kSessionRoomsLive).
+enum class FrameType : uint8_t {
+    Text = 1,
+    ChannelOpen = 2,
+    ChannelData = 3,
+    HistoryRequest = 4,
+    Session = 5,
+    Resume = 6,
+    Ack = 7,
+    Join = 8,
+    Leave = 9,
+    Publish = 10,
+};
+
+enum class HistoryMode : uint16_t {
+    SinceSeq = 0,
+    Last = 1,
+    SinceTime = 2,
+};
+
+// Text frame flags. A relay stamps every message it relays through its
+// stream log with the log's sequence number (kFrameSequenced): the store's,
+// when there is one, whose stored copy also carries kFrameReplayed, so
+// history can be told apart from live traffic. A message the store failed
+// to take goes out unsequenced, and resume never replays it.
+constexpr uint16_t kFrameSequenced = 1;
+constexpr uint16_t kFrameReplayed = 2;
+
+constexpr uint16_t kSessionResumed = 1;
+constexpr uint16_t kSessionRoomsLive = 2;
+constexpr uint16_t kAckOwn = 1;
+constexpr uint16_t kAckLost = 2;
+constexpr size_t kSessionPayloadSize = 16;
+
+constexpr size_t kMaxAckRanges = 16;
+constexpr size_t kMaxRoomName = 255;
+using AckRange = std::pair<uint64_t, uint64_t>;
+
+struct FrameHeader {
+    uint8_t version{kFrameVersion};
+    FrameType type{FrameType::Text};
+    uint16_t flags{0};
+    uint32_t length{0};
+    uint64_t seq{0};
+};
+
+// A decoded frame. `payload` points into the decoder's receive buffer and is
+// only valid until the next call to RecvBuffer::Prepare().
+struct FrameView {
+    FrameHeader header;
+    const char* payload{nullptr};
+    const char* raw{nullptr};
+    size_t rawSize{0};
+};
+
+void WriteFrameHeader(char* out, const FrameHeader& header);
+FrameHeader ReadFrameHeader(const char* in);
+void AppendFrame(std::string& out, FrameType type, uint16_t flags, uint64_t seq,
+                 const char* payload, size_t len);
+std::string EncodeFrame(FrameType type, uint16_t flags, uint64_t seq, const std::string& payload);
+// Session and Resume frames.
+std::string EncodeSession(FrameType type, uint16_t flags, uint64_t seq, uint64_t token, uint64_t streamId);
+bool ReadSession(const FrameView& frame, uint64_t& token, uint64_t& streamId);
+std::string EncodeAck(uint64_t cumulative, const std::vector<AckRange>& ranges, uint16_t flags = 0);
+bool ReadAck(const FrameView& frame, std::vector<AckRange>& ranges);
+std::string EncodePublish(uint64_t seq, const std::string& room, const char* text, size_t len);
+// Splits a Publish payload; false if it is malformed or the room name empty.
+bool ReadPublish(const FrameView& frame, std::string& room, const char*& text, size_t& len);
+
+// An encoded frame is immutable, so a broadcast encodes it once and every
+// recipient's send queue holds a reference; the bytes are freed when the last
+// queue has written them out.
+using SharedFrame = std::shared_ptr<const std::string>;
+
+inline SharedFrame ShareFrame(std::string encoded) {
+    return std::make_shared<const std::string>(std::move(encoded));
+}
+
+// Reusable receive buffer: sockets read straight into Prepare()'s span and
+// frames are parsed in place from the unread region. Consumed bytes are
+// reclaimed lazily by sliding the remainder down when more room is needed.
+class RecvBuffer {
+public:
+    explicit RecvBuffer(size_t initial = 4096) : data(initial) {}
+
+    char* Prepare(size_t minFree);
+    size_t Writable() const { return data.size() - writePos; }
+    void Commit(size_t n) { writePos += n; }
+    const char* ReadPtr() const { return data.data() + readPos; }
+    size_t Readable() const { return writePos - readPos; }
+    void Consume(size_t n);
+
+private:
+    std::vector<char> data;
+    size_t readPos{0};
+    size_t writePos{0};
+};
+
+enum class DecodeResult { Frame, NeedMore, Error };
+
+// Incremental frame parser over a RecvBuffer. Partial frames stay in the
+// buffer until the rest arrives; Next() never copies payload bytes.
+// Missing() is how many more bytes the frame at the read position needs,
+// so callers can size their next read to land a large frame in one piece.
+class FrameDecoder {
+public:
+    explicit FrameDecoder(RecvBuffer& buffer) : buffer(buffer) {}
+
+    DecodeResult Next(FrameView& out);
+    size_t Missing() const { return missing; }
+
+private:
+    RecvBuffer& buffer;
+    size_t missing{0};
+};
+
+} // namespace chat
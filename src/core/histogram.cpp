@@ -0,0 +1,69 @@
+#include "core/histogram.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace chat {
+
+constexpr uint64_t kSubCount = uint64_t(1) << Histogram::kSubBits;
+constexpr size_t kBucketCount = size_t(Histogram::kMaxBits - Histogram::kSubBits + 2) * kSubCount;
+
+static int HighBit(uint64_t v) {
+    return 63 - __builtin_clzll(v);
+}
+
+Histogram::Histogram() : counts(kBucketCount, 0) {}
+
+size_t Histogram::BucketOf(uint64_t value) {
+    if (value < kSubCount) return static_cast<size_t>(value);
+    int shift = HighBit(value) - kSubBits;
+    size_t bucket = static_cast<size_t>(shift + 1) * kSubCount + static_cast<size_t>((value >> shift) - kSubCount);
+    return std::min(bucket, kBucketCount - 1);
+}
+
+uint64_t Histogram::HighestIn(size_t bucket) {
+    uint64_t group = bucket / kSubCount;
+    uint64_t sub = bucket % kSubCount;
+    if (group == 0) return sub;
+    uint64_t shift = group - 1;
+    return ((sub + kSubCount) << shift) + ((uint64_t(1) << shift) - 1);
+}
+
+void Histogram::Record(uint64_t value) {
+    ++counts[BucketOf(value)];
+    ++total;
+    sum += value;
+    if (value < min) min = value;
+    if (value > max) max = value;
+}
+
+void Histogram::Merge(const Histogram& other) {
+    for (size_t i = 0; i < kBucketCount; ++i) counts[i] += other.counts[i];
+    total += other.total;
+    sum += other.sum;
+    min = std::min(min, other.min);
+    max = std::max(max, other.max);
+}
+
+void Histogram::Reset() {
+    std::fill(counts.begin(), counts.end(), 0);
+    total = 0;
+    sum = 0;
+    min = UINT64_MAX;
+    max = 0;
+}
+
+uint64_t Histogram::Percentile(double percent) const {
+    if (total == 0) return 0;
+    double clamped = std::min(std::max(percent, 0.0), 100.0);
+    uint64_t rank = static_cast<uint64_t>(std::ceil(clamped / 100.0 * static_cast<double>(total)));
+    if (rank == 0) rank = 1;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < kBucketCount; ++i) {
+        seen += counts[i];
+        if (seen >= rank) return std::min(HighestIn(i), max);
+    }
+    return max;
+}
+
+} // namespace chat
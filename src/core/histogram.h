@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace chat {
+
+// Log-linear histogram in the style of HdrHistogram. Values are grouped by
+// power of two and each group is split into 2^kSubBits linear buckets, so any
+// recorded value is reported within 1/2^kSubBits (under 1%) of itself across
+// the whole range. Recording is a couple of shifts and an increment; not
+// thread-safe, so keep one per thread and Merge() them.
+class Histogram {
+public:
+    static constexpr int kSubBits = 7;
+    // Largest trackable value is about 2^kMaxBits (in ns, a few hours).
+    static constexpr int kMaxBits = 44;
+
+    Histogram();
+
+    void Record(uint64_t value);
+    void Merge(const Histogram& other);
+    void Reset();
+
+    uint64_t Count() const { return total; }
+    uint64_t Min() const { return total ? min : 0; }
+    uint64_t Max() const { return max; }
+    double Mean() const { return total ? static_cast<double>(sum) / static_cast<double>(total) : 0.0; }
+    // Smallest recorded value that at least `percent` percent of samples are
+    // less than or equal to, at bucket precision.
+    uint64_t Percentile(double percent) const;
+
+private:
+    static size_t BucketOf(uint64_t value);
+    static uint64_t HighestIn(size_t bucket);
+
+    std::vector<uint64_t> counts;
+    uint64_t total{0};
+    uint64_t sum{0};
+    uint64_t min{UINT64_MAX};
+    uint64_t max{0};
+};
+
+} // namespace chat
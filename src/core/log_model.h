@@ -0,0 +1,203 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace chat {
+
+// What a view of a LogModel has to do to catch up: drop `trim` characters
+// from its front, then append `append`.
+template <typename CharT>
+struct LogUpdate {
+    size_t trim{0};
+    std::basic_string<CharT> append;
+};
+
+// Bounded scrollback. Text lives in a fixed ring of chunks; a line always
+// goes into one chunk, and when the ring is full the oldest chunk is
+// recycled, dropping its lines in one go. Nothing is allocated once every
+// chunk has been used. Positions are absolute character offsets since the
+// model was created, so a view only ever needs the difference between what
+// it shows and what the model holds (TakeUpdate). Not thread-safe; feed it
+// from one thread through a LogPipeline.
+template <typename CharT>
+class LogModel {
+public:
+    using String = std::basic_string<CharT>;
+
+    explicit LogModel(size_t maxChars = 1024 * 1024, size_t chunkChars = 64 * 1024)
+        : chunkChars(std::max<size_t>(chunkChars, 256)),
+          chunks(std::max<size_t>(maxChars / std::max<size_t>(chunkChars, 256), 2)) {}
+
+    // Lines longer than a chunk are cut to fit one.
+    void Append(const CharT* text, size_t len) {
+        if (len > chunkChars) len = chunkChars;
+        if (!count || chunks[Slot(count - 1)].used + len > chunkChars) NextChunk();
+        Chunk& chunk = chunks[Slot(count - 1)];
+        std::copy(text, text + len, chunk.data.get() + chunk.used);
+        chunk.used += len;
+        end += len;
+        ++chunk.lines;
+    }
+
+    void Append(const String& text) { Append(text.data(), text.size()); }
+
+    // Everything the view has not seen since the previous call.
+    void TakeUpdate(LogUpdate<CharT>& out) {
+        uint64_t start = Start();
+        out.trim = static_cast<size_t>(std::min(start, viewEnd) - viewStart);
+        out.append.clear();
+        Copy(std::max(viewEnd, start), out.append);
+        viewStart = start;
+        viewEnd = end;
+    }
+
+    // The whole retained text, for a view created after the model.
+    String Text() const {
+        String out;
+        Copy(Start(), out);
+        return out;
+    }
+
+    uint64_t Start() const { return count ? chunks[head].base : end; }
+    uint64_t End() const { return end; }
+    size_t Chars() const { return static_cast<size_t>(end - Start()); }
+    size_t Capacity() const { return chunks.size() * chunkChars; }
+    uint64_t DroppedLines() const { return dropped; }
+
+private:
+    struct Chunk {
+        std::unique_ptr<CharT[]> data;
+        uint64_t base{0};
+        size_t used{0};
+        size_t lines{0};
+    };
+
+    size_t Slot(size_t i) const { return (head + i) % chunks.size(); }
+
+    void NextChunk() {
+        if (count == chunks.size()) {
+            dropped += chunks[head].lines;
+            head = Slot(1);
+            --count;
+        }
+        Chunk& chunk = chunks[Slot(count)];
+        if (!chunk.data) chunk.data.reset(new CharT[chunkChars]);
+        chunk.base = end;
+        chunk.used = 0;
+        chunk.lines = 0;
+        ++count;
+    }
+
+    void Copy(uint64_t from, String& out) const {
+        for (size_t i = 0; i < count; ++i) {
+            const Chunk& chunk = chunks[Slot(i)];
+            uint64_t chunkEnd = chunk.base + chunk.used;
+            if (chunkEnd <= from) continue;
+            size_t skip = from > chunk.base ? static_cast<size_t>(from - chunk.base) : 0;
+            out.append(chunk.data.get() + skip, chunk.used - skip);
+        }
+    }
+
+    size_t chunkChars;
+    std::vector<Chunk> chunks;
+    size_t head{0};
+    size_t count{0};
+    uint64_t end{0};
+    uint64_t dropped{0};
+    uint64_t viewStart{0};
+    uint64_t viewEnd{0};
+};
+
+// Hands log lines from any thread to the one thread that owns a LogModel.
+// Producers append each line to one shared batch buffer under a short lock
+// and the consumer swaps the whole batch out, so once both buffers have grown
+// to their working size neither side allocates per line. Only the first line
+// after each Drain asks for a wake-up, so a burst of lines costs the consumer
+// one wake-up and one pass. At most `maxQueued` lines (and `maxChars`
+// characters) wait at a time; a flood beyond that is dropped at the producer,
+// which the model would have done to most of it anyway.
+template <typename CharT>
+class LogPipeline {
+public:
+    using String = std::basic_string<CharT>;
+
+    explicit LogPipeline(size_t maxQueued = 64 * 1024, size_t maxChars = 4 * 1024 * 1024)
+        : maxQueued(maxQueued), maxChars(maxChars) {}
+
+    // True if the caller should wake the consumer.
+    bool Push(const CharT* text, size_t len) {
+        return Emplace(len, [&](CharT* out) {
+            std::copy(text, text + len, out);
+            return len;
+        });
+    }
+
+    bool Push(const String& line) { return Push(line.data(), line.size()); }
+
+    // Builds a line of at most `maxLen` characters in place: `fill` writes it
+    // to the pointer it gets and returns its real length. Lets a caller
+    // transcode straight into the batch instead of through a temporary.
+    template <typename Fill>
+    bool Emplace(size_t maxLen, Fill fill) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (pendingLengths.size() >= maxQueued || pending.size() + maxLen > maxChars) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        size_t at = pending.size();
+        pending.resize(at + maxLen);
+        size_t len = fill(&pending[at]);
+        pending.resize(at + len);
+        pendingLengths.push_back(len);
+        queued.store(pendingLengths.size(), std::memory_order_relaxed);
+        bool wake = !wakePending;
+        wakePending = true;
+        return wake;
+    }
+
+    // Consumer side: moves every queued line into `model`. Producers only
+    // wait for the swap, not for the model.
+    size_t Drain(LogModel<CharT>& model) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            pending.swap(batch);
+            pendingLengths.swap(batchLengths);
+            queued.store(0, std::memory_order_relaxed);
+            wakePending = false;
+        }
+        size_t at = 0;
+        for (size_t len : batchLengths) {
+            model.Append(batch.data() + at, len);
+            at += len;
+        }
+        size_t n = batchLengths.size();
+        batch.clear();
+        batchLengths.clear();
+        return n;
+    }
+
+    size_t Queued() const { return queued.load(std::memory_order_relaxed); }
+    uint64_t Dropped() const { return dropped.load(std::memory_order_relaxed); }
+
+private:
+    size_t maxQueued;
+    size_t maxChars;
+    std::mutex mutex;
+    String pending;
+    std::vector<size_t> pendingLengths;
+    bool wakePending{false};
+    // Consumer only: the batch taken by the last Drain, kept for its capacity.
+    String batch;
+    std::vector<size_t> batchLengths;
+    std::atomic<size_t> queued{0};
+    std::atomic<uint64_t> dropped{0};
+};
+
+} // namespace chat
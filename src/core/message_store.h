@@ -0,0 +1,129 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "core/frame.h"
+
+namespace chat {
+
+struct StoreConfig {
+    // Directory holding the segment and index files; empty disables the
+    // store.
+    std::string dir;
+    uint64_t segmentBytes{64 * 1024 * 1024};
+    // One index entry per this many bytes of records, so finding a record
+    // reads at most this much of its segment.
+    uint32_t indexIntervalBytes{4096};
+    // Group commit: appends only reach the page cache, and a background
+    // thread makes everything appended in the last `syncMs` durable with one
+    // fdatasync. 0 leaves writeback to the kernel.
+    uint32_t syncMs{5};
+    // Sealed segments are deleted oldest first past this total; 0 keeps all.
+    uint64_t maxBytes{1024ull * 1024 * 1024};
+    // Cap on one history query; a longer range starts later instead.
+    uint64_t maxReplayBytes{16 * 1024 * 1024};
+};
+
+// One sparse index entry: the record with sequence number `seq`, appended at
+// CLOCK_REALTIME `timeMs`, starts `offset` bytes into its segment.
+struct StoreIndexEntry {
+    uint64_t seq;
+    int64_t timeMs;
+    uint64_t offset;
+};
+
+// A run of whole records in one segment file, ready for sendfile(). The
+// descriptor stays open while `ref` (or a copy) is alive, even if retention
+// deletes the file.
+struct StoreRange {
+    int fd{-1};
+    uint64_t offset{0};
+    uint64_t length{0};
+    std::shared_ptr<const void> ref;
+};
+
+struct StoreStats {
+    uint64_t appended{0};
+    uint64_t syncs{0};
+    uint64_t lastSeq{0};
+    uint64_t syncedSeq{0};
+    uint64_t bytes{0};
+};
+
+struct StoreSegment;
+
+// Server-side chat history: an append-only run of segment files named
+// <first seq>.log, each holding Text frames exactly as they go on the wire
+// with consecutive sequence numbers, next to a memory-mapped <first seq>.index
+// of every few KiB. Because the records are frames, a history query is a list
+// of byte ranges that go from the file to the socket untouched. Appends may
+// come from any thread.
+class MessageStore {
+public:
+    MessageStore();
+    ~MessageStore();
+    MessageStore(const MessageStore&) = delete;
+    MessageStore& operator=(const MessageStore&) = delete;
+
+    // False with `error` set if the directory or a segment is unusable. A
+    // torn record at the end of a segment is cut off.
+    bool Open(const StoreConfig& cfg, std::string& error);
+    // Syncs and closes; ranges already handed out stay readable.
+    void Close();
+
+    // Stores `payload` as the next record and returns the frame live
+    // subscribers should get (kFrameSequenced, same sequence number), or null
+    // if it could not be stored.
+    SharedFrame Append(const char* payload, size_t len);
+
+    // Records from `seq` on, the last `count` records, or from about `timeMs`
+    // on (up to one index interval early), as of the call. Ranges are in
+    // sequence order and capped at StoreConfig::maxReplayBytes. `first`, if
+    // given, is set to the sequence number the ranges start at: later than
+    // `seq` when retention or the cap left out the oldest records.
+    std::vector<StoreRange> Since(uint64_t seq, uint64_t* first = nullptr) const;
+    std::vector<StoreRange> Last(uint64_t count) const;
+    std::vector<StoreRange> SinceTime(int64_t timeMs) const;
+
+    bool IsOpen() const;
+    StoreStats Stats() const;
+    // Random id created with the directory and kept in it, naming the
+    // sequence space of its records.
+    uint64_t StreamId() const { return streamId; }
+
+private:
+    std::shared_ptr<StoreSegment> OpenSegment(uint64_t firstSeq, bool spare, std::string& error);
+    bool Recover(StoreSegment& seg);
+    std::vector<StoreRange> SinceLocked(uint64_t seq, uint64_t* first = nullptr) const;
+    void Prepare(size_t frameBytes);
+    bool Roll(std::vector<std::shared_ptr<StoreSegment>>& dropped);
+    void ApplyRetention(std::vector<std::shared_ptr<StoreSegment>>& dropped);
+    void SyncLoop();
+    void SyncAll();
+
+    StoreConfig config;
+    mutable std::mutex mutex;
+    std::condition_variable syncCv;
+    std::thread syncThread;
+    bool stopping{false};
+    std::vector<std::shared_ptr<StoreSegment>> segments;
+    std::vector<std::shared_ptr<StoreSegment>> unsynced;
+    // The next segment, created ahead by Prepare() under a placeholder name.
+    std::shared_ptr<StoreSegment> spare;
+    bool preparing{false};
+    uint64_t nextSeq{1};
+    uint64_t syncedSeq{0};
+    uint64_t appended{0};
+    uint64_t syncs{0};
+    uint64_t totalBytes{0};
+    uint64_t streamId{0};
+};
+
+} // namespace chat
@@ -0,0 +1,490 @@
+#include "core/message_store.h"
+#include "core/stream_log.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <utility>
+
+namespace chat {
+
+constexpr size_t kStorePage = 4096;
+constexpr char kLogSuffix[] = ".log";
+constexpr char kIndexSuffix[] = ".index";
+// Not all digits, so ListSegments() passes over a spare left by a crash.
+constexpr char kSpareName[] = "spare";
+
+// One segment: its log file, open for the life of the object, and its mapped
+// index. `size` and the index only grow, under MessageStore::mutex.
+struct StoreSegment {
+    uint64_t firstSeq{0};
+    uint64_t lastSeq{0};
+    int fd{-1};
+    uint64_t size{0};
+    StoreIndexEntry* index{nullptr};
+    size_t indexBytes{0};
+    size_t indexCap{0};
+    size_t indexCount{0};
+    uint64_t indexedAt{0};
+    std::string logPath;
+    std::string indexPath;
+
+    ~StoreSegment() {
+        if (index) munmap(index, indexBytes);
+        if (fd >= 0) close(fd);
+    }
+};
+
+static int64_t WallMs() {
+    timespec ts{};
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+static std::string PathFor(const std::string& dir, uint64_t firstSeq, const char* suffix) {
+    char digits[24];
+    std::snprintf(digits, sizeof(digits), "%020" PRIu64, firstSeq);
+    return dir + "/" + digits + suffix;
+}
+
+// First sequence numbers of the segments in `dir`, oldest first.
+static std::vector<uint64_t> ListSegments(const std::string& dir) {
+    std::vector<uint64_t> out;
+    DIR* d = opendir(dir.c_str());
+    if (!d) return out;
+    size_t suffixLen = sizeof(kLogSuffix) - 1;
+    while (dirent* e = readdir(d)) {
+        std::string name = e->d_name;
+        if (name.size() <= suffixLen || name.compare(name.size() - suffixLen, suffixLen, kLogSuffix) != 0) continue;
+        std::string digits = name.substr(0, name.size() - suffixLen);
+        if (digits.find_first_not_of("0123456789") != std::string::npos) continue;
+        out.push_back(std::strtoull(digits.c_str(), nullptr, 10));
+    }
+    closedir(d);
+    std::sort(out.begin(), out.end());
+    return out;
+}
+
+static void AddIndex(StoreSegment& seg, uint64_t seq, int64_t timeMs, uint64_t offset) {
+    if (seg.indexCount == seg.indexCap) return;
+    seg.index[seg.indexCount++] = StoreIndexEntry{seq, timeMs, offset};
+    seg.indexedAt = offset;
+}
+
+// Offset of the record `seq` in `seg`, or its size if `seq` is past the end:
+// bisect the index, then walk record headers from the entry found.
+static uint64_t Locate(const StoreSegment& seg, uint64_t seq) {
+    size_t lo = 0;
+    size_t hi = seg.indexCount;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (seg.index[mid].seq <= seq) lo = mid + 1;
+        else hi = mid;
+    }
+    uint64_t pos = lo ? seg.index[lo - 1].offset : 0;
+    uint64_t at = lo ? seg.index[lo - 1].seq : seg.firstSeq;
+    char header[kFrameHeaderSize];
+    while (at < seq && pos < seg.size) {
+        if (pread(seg.fd, header, sizeof(header), static_cast<off_t>(pos)) != static_cast<ssize_t>(sizeof(header))) {
+            return seg.size;
+        }
+        pos += kFrameHeaderSize + ReadFrameHeader(header).length;
+        ++at;
+    }
+    return pos < seg.size ? pos : seg.size;
+}
+
+// Offset of the first indexed record at or after `offset`, or the end, with
+// its sequence number in `seq`.
+static uint64_t SeekIndex(const StoreSegment& seg, uint64_t offset, uint64_t& seq) {
+    const StoreIndexEntry* begin = seg.index;
+    const StoreIndexEntry* end = begin + seg.indexCount;
+    const StoreIndexEntry* it = std::lower_bound(begin, end, offset,
+        [](const StoreIndexEntry& e, uint64_t off) { return e.offset < off; });
+    seq = it == end ? seg.lastSeq + 1 : it->seq;
+    return it == end ? seg.size : it->offset;
+}
+
+MessageStore::MessageStore() = default;
+
+MessageStore::~MessageStore() {
+    Close();
+}
+
+// With `spare`, creates an empty segment under kSpareName for Roll() to
+// rename once its first sequence number is known.
+std::shared_ptr<StoreSegment> MessageStore::OpenSegment(uint64_t firstSeq, bool spare, std::string& error) {
+    auto seg = std::make_shared<StoreSegment>();
+    seg->firstSeq = firstSeq;
+    seg->lastSeq = firstSeq - 1;
+    if (spare) {
+        seg->logPath = config.dir + "/" + kSpareName + kLogSuffix;
+        seg->indexPath = config.dir + "/" + kSpareName + kIndexSuffix;
+        unlink(seg->logPath.c_str());
+        unlink(seg->indexPath.c_str());
+    } else {
+        seg->logPath = PathFor(config.dir, firstSeq, kLogSuffix);
+        seg->indexPath = PathFor(config.dir, firstSeq, kIndexSuffix);
+    }
+    seg->fd = open(seg->logPath.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (seg->fd < 0) {
+        error = "cannot open " + seg->logPath + ": " + std::strerror(errno);
+        return nullptr;
+    }
+    int indexFd = open(seg->indexPath.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    struct stat st{};
+    if (indexFd < 0 || fstat(indexFd, &st) != 0) {
+        error = "cannot open " + seg->indexPath + ": " + std::strerror(errno);
+        if (indexFd >= 0) close(indexFd);
+        return nullptr;
+    }
+    seg->indexBytes = static_cast<size_t>(st.st_size);
+    if (seg->indexBytes == 0) {
+        size_t entries = config.segmentBytes / config.indexIntervalBytes + 2;
+        seg->indexBytes = (entries * sizeof(StoreIndexEntry) + kStorePage - 1) & ~(kStorePage - 1);
+        if (ftruncate(indexFd, static_cast<off_t>(seg->indexBytes)) != 0) {
+            error = "cannot size " + seg->indexPath + ": " + std::strerror(errno);
+            close(indexFd);
+            return nullptr;
+        }
+    }
+    void* p = mmap(nullptr, seg->indexBytes, PROT_READ | PROT_WRITE, MAP_SHARED, indexFd, 0);
+    close(indexFd);
+    if (p == MAP_FAILED) {
+        error = "cannot map " + seg->indexPath;
+        return nullptr;
+    }
+    seg->index = static_cast<StoreIndexEntry*>(p);
+    seg->indexCap = seg->indexBytes / sizeof(StoreIndexEntry);
+    if (!Recover(*seg)) {
+        error = "cannot recover " + seg->logPath;
+        return nullptr;
+    }
+    return seg;
+}
+
+// Finds the end of the last whole record, cutting off a torn tail and any
+// index entries past it, and indexes records the index missed. Only the
+// records after the last surviving entry are read.
+bool MessageStore::Recover(StoreSegment& seg) {
+    struct stat st{};
+    if (fstat(seg.fd, &st) != 0) return false;
+    uint64_t fileSize = static_cast<uint64_t>(st.st_size);
+    // Entries are filled in order, so the first empty one is found by bisection.
+    size_t lo = 0;
+    size_t hi = seg.indexCap;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (seg.index[mid].seq != 0) lo = mid + 1;
+        else hi = mid;
+    }
+    seg.indexCount = lo;
+    while (seg.indexCount && seg.index[seg.indexCount - 1].offset >= fileSize) {
+        seg.index[--seg.indexCount] = StoreIndexEntry{};
+    }
+    const StoreIndexEntry* last = seg.indexCount ? &seg.index[seg.indexCount - 1] : nullptr;
+    uint64_t pos = last ? last->offset : 0;
+    uint64_t at = last ? last->seq : seg.firstSeq;
+    int64_t timeMs = last ? last->timeMs : static_cast<int64_t>(st.st_mtime) * 1000;
+    seg.indexedAt = pos;
+    char header[kFrameHeaderSize];
+    while (pos + kFrameHeaderSize <= fileSize) {
+        if (pread(seg.fd, header, sizeof(header), static_cast<off_t>(pos)) != static_cast<ssize_t>(sizeof(header))) {
+            break;
+        }
+        FrameHeader h = ReadFrameHeader(header);
+        if (h.version != kFrameVersion || h.type != FrameType::Text || h.seq != at ||
+            pos + kFrameHeaderSize + h.length > fileSize) {
+            break;
+        }
+        if (!seg.indexCount || pos - seg.indexedAt >= config.indexIntervalBytes) AddIndex(seg, at, timeMs, pos);
+        pos += kFrameHeaderSize + h.length;
+        ++at;
+    }
+    if (pos < fileSize && ftruncate(seg.fd, static_cast<off_t>(pos)) != 0) return false;
+    seg.size = pos;
+    seg.lastSeq = at - 1;
+    return true;
+}
+
+bool MessageStore::Open(const StoreConfig& cfg, std::string& error) {
+    Close();
+    config = cfg;
+    if (config.segmentBytes < 1024 * 1024) config.segmentBytes = 1024 * 1024;
+    if (config.indexIntervalBytes < 256) config.indexIntervalBytes = 256;
+    if (mkdir(config.dir.c_str(), 0755) != 0 && errno != EEXIST) {
+        error = "cannot create " + config.dir + ": " + std::strerror(errno);
+        return false;
+    }
+    std::string idPath = config.dir + "/stream.id";
+    streamId = 0;
+    if (FILE* f = std::fopen(idPath.c_str(), "r")) {
+        if (std::fscanf(f, "%" SCNx64, &streamId) != 1) streamId = 0;
+        std::fclose(f);
+    }
+    if (!streamId) {
+        streamId = RandomId();
+        FILE* f = std::fopen(idPath.c_str(), "w");
+        if (!f || std::fprintf(f, "%016" PRIx64 "\n", streamId) < 0 || std::fclose(f) != 0) {
+            error = "cannot write " + idPath;
+            return false;
+        }
+    }
+    std::vector<uint64_t> existing = ListSegments(config.dir);
+    if (existing.empty()) existing.push_back(1);
+    std::lock_guard<std::mutex> lock(mutex);
+    for (uint64_t firstSeq : existing) {
+        auto seg = OpenSegment(firstSeq, false, error);
+        if (!seg) {
+            segments.clear();
+            return false;
+        }
+        totalBytes += seg->size;
+        segments.push_back(std::move(seg));
+    }
+    nextSeq = segments.back()->lastSeq + 1;
+    syncedSeq = nextSeq - 1;
+    stopping = false;
+    if (config.syncMs) syncThread = std::thread(&MessageStore::SyncLoop, this);
+    return true;
+}
+
+void MessageStore::Close() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    syncCv.notify_all();
+    if (syncThread.joinable()) syncThread.join();
+    SyncAll();
+    std::lock_guard<std::mutex> lock(mutex);
+    segments.clear();
+    unsynced.clear();
+    totalBytes = 0;
+    if (spare) {
+        unlink(spare->logPath.c_str());
+        unlink(spare->indexPath.c_str());
+        spare.reset();
+    }
+}
+
+bool MessageStore::IsOpen() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return !segments.empty();
+}
+
+SharedFrame MessageStore::Append(const char* payload, size_t len) {
+    if (len > kMaxFramePayload) return nullptr;
+    std::string frame;
+    AppendFrame(frame, FrameType::Text, kFrameSequenced, 0, payload, len);
+    Prepare(frame.size());
+
+    // Segments retention drops are unlinked and closed after the lock.
+    std::vector<std::shared_ptr<StoreSegment>> dropped;
+    std::unique_lock<std::mutex> lock(mutex);
+    if (segments.empty()) return nullptr;
+    // A record larger than a segment gets one to itself.
+    if (segments.back()->size && segments.back()->size + frame.size() > config.segmentBytes && !Roll(dropped)) {
+        return nullptr;
+    }
+    StoreSegment& seg = *segments.back();
+    FrameHeader header;
+    header.flags = kFrameSequenced | kFrameReplayed;
+    header.length = static_cast<uint32_t>(len);
+    header.seq = nextSeq;
+    char stored[kFrameHeaderSize];
+    WriteFrameHeader(stored, header);
+    iovec iov[2] = {{stored, kFrameHeaderSize}, {&frame[kFrameHeaderSize], len}};
+    ssize_t n = pwritev(seg.fd, iov, 2, static_cast<off_t>(seg.size));
+    bool written = n == static_cast<ssize_t>(frame.size());
+    if (written) {
+        if (!seg.indexCount || seg.size - seg.indexedAt >= config.indexIntervalBytes) {
+            AddIndex(seg, nextSeq, WallMs(), seg.size);
+        }
+        seg.size += frame.size();
+        seg.lastSeq = nextSeq;
+        totalBytes += frame.size();
+        ++appended;
+        header.flags = kFrameSequenced;
+        WriteFrameHeader(&frame[0], header);
+        ++nextSeq;
+    } else if (n > 0) {
+        // Should this fail too, Recover() cuts the partial record on reopen.
+        int ignored = ftruncate(seg.fd, static_cast<off_t>(seg.size));
+        (void)ignored;
+    }
+    lock.unlock();
+    for (const auto& old : dropped) {
+        unlink(old->logPath.c_str());
+        unlink(old->indexPath.c_str());
+    }
+    return written ? ShareFrame(std::move(frame)) : nullptr;
+}
+
+// Creates the next segment once the current one is within an eighth of
+// full, outside the lock, so that Roll() only has to rename it.
+void MessageStore::Prepare(size_t frameBytes) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (segments.empty() || spare || preparing) return;
+        uint64_t headroom = std::max<uint64_t>(frameBytes, config.segmentBytes / 8);
+        if (segments.back()->size + headroom <= config.segmentBytes) return;
+        preparing = true;
+    }
+    std::string error;
+    auto next = OpenSegment(0, true, error);
+    std::lock_guard<std::mutex> lock(mutex);
+    preparing = false;
+    if (!segments.empty()) spare = std::move(next);
+}
+
+// Starts a segment at the next sequence number, from the spare if Prepare()
+// made one. The old one is synced by the next group commit and never written
+// again.
+bool MessageStore::Roll(std::vector<std::shared_ptr<StoreSegment>>& dropped) {
+    std::shared_ptr<StoreSegment> next = std::move(spare);
+    std::string logPath = PathFor(config.dir, nextSeq, kLogSuffix);
+    std::string indexPath = PathFor(config.dir, nextSeq, kIndexSuffix);
+    if (next && (rename(next->logPath.c_str(), logPath.c_str()) != 0 ||
+                 rename(next->indexPath.c_str(), indexPath.c_str()) != 0)) {
+        next.reset();
+    }
+    if (next) {
+        next->firstSeq = nextSeq;
+        next->lastSeq = nextSeq - 1;
+        next->logPath = logPath;
+        next->indexPath = indexPath;
+    } else {
+        std::string error;
+        next = OpenSegment(nextSeq, false, error);
+        if (!next) return false;
+    }
+    if (config.syncMs) unsynced.push_back(segments.back());
+    segments.push_back(std::move(next));
+    ApplyRetention(dropped);
+    return true;
+}
+
+void MessageStore::ApplyRetention(std::vector<std::shared_ptr<StoreSegment>>& dropped) {
+    if (!config.maxBytes) return;
+    while (segments.size() > 1 && totalBytes > config.maxBytes) {
+        totalBytes -= segments.front()->size;
+        dropped.push_back(std::move(segments.front()));
+        segments.erase(segments.begin());
+    }
+}
+
+void MessageStore::SyncLoop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!stopping) {
+        syncCv.wait_for(lock, std::chrono::milliseconds(config.syncMs));
+        if (stopping || (syncedSeq + 1 == nextSeq && unsynced.empty())) continue;
+        lock.unlock();
+        SyncAll();
+        lock.lock();
+    }
+}
+
+// One fdatasync per touched segment covers every append made before it, so
+// however many messages arrived since the last commit share its cost.
+void MessageStore::SyncAll() {
+    std::vector<std::shared_ptr<StoreSegment>> batch;
+    uint64_t upTo;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (segments.empty()) return;
+        batch.swap(unsynced);
+        batch.push_back(segments.back());
+        upTo = nextSeq - 1;
+    }
+    for (const auto& seg : batch) {
+        fdatasync(seg->fd);
+        msync(seg->index, seg->indexBytes, MS_SYNC);
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    if (upTo > syncedSeq) syncedSeq = upTo;
+    ++syncs;
+}
+
+std::vector<StoreRange> MessageStore::SinceLocked(uint64_t seq, uint64_t* first) const {
+    std::vector<StoreRange> out;
+    uint64_t from = nextSeq;
+    if (first) *first = from;
+    if (segments.empty() || seq >= nextSeq) return out;
+    if (seq < segments.front()->firstSeq) seq = segments.front()->firstSeq;
+    size_t oldest = segments.size() - 1;
+    while (oldest > 0 && segments[oldest]->firstSeq > seq) --oldest;
+    uint64_t start = Locate(*segments[oldest], seq);
+
+    // Walk back from the newest segment so the cap keeps the latest records.
+    uint64_t budget = config.maxReplayBytes ? config.maxReplayBytes : UINT64_MAX;
+    for (size_t i = segments.size(); i-- > oldest && budget;) {
+        const StoreSegment& seg = *segments[i];
+        uint64_t offset = i == oldest ? start : 0;
+        uint64_t at = i == oldest ? seq : seg.firstSeq;
+        if (seg.size <= offset) continue;
+        if (seg.size - offset > budget) {
+            offset = SeekIndex(seg, seg.size - budget, at);
+            budget = 0;
+        } else {
+            budget -= seg.size - offset;
+        }
+        if (seg.size > offset) {
+            out.push_back(StoreRange{seg.fd, offset, seg.size - offset, segments[i]});
+            from = at;
+        }
+    }
+    std::reverse(out.begin(), out.end());
+    if (first) *first = from;
+    return out;
+}
+
+std::vector<StoreRange> MessageStore::Since(uint64_t seq, uint64_t* first) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return SinceLocked(seq, first);
+}
+
+std::vector<StoreRange> MessageStore::Last(uint64_t count) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!count) return {};
+    return SinceLocked(nextSeq > count ? nextSeq - count : 1);
+}
+
+std::vector<StoreRange> MessageStore::SinceTime(int64_t timeMs) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (size_t i = segments.size(); i-- > 0;) {
+        const StoreSegment& seg = *segments[i];
+        if (!seg.indexCount || seg.index[0].timeMs >= timeMs) continue;
+        // The last entry before `timeMs`: records after it may be newer.
+        const StoreIndexEntry* begin = seg.index;
+        const StoreIndexEntry* end = begin + seg.indexCount;
+        const StoreIndexEntry* it = std::lower_bound(begin, end, timeMs,
+            [](const StoreIndexEntry& e, int64_t ms) { return e.timeMs < ms; });
+        return SinceLocked((it - 1)->seq);
+    }
+    return SinceLocked(0);
+}
+
+StoreStats MessageStore::Stats() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    StoreStats st;
+    st.appended = appended;
+    st.syncs = syncs;
+    st.lastSeq = nextSeq - 1;
+    st.syncedSeq = syncedSeq;
+    st.bytes = totalBytes;
+    return st;
+}
+
+} // namespace chat
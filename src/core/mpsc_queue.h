@@ -0,0 +1,61 @@
+#pragma once
+
+#include <atomic>
+#include <utility>
+
+namespace chat {
+
+// Unbounded multi-producer / single-consumer queue (Vyukov). Push is a single
+// atomic exchange and never blocks; Pop must only be called from the owning
+// consumer thread. Pop can briefly report empty while a producer is between
+// its exchange and its link store, so consumers pair the queue with a wake-up
+// that producers trigger after Push returns.
+template <typename T>
+class MpscQueue {
+public:
+    MpscQueue() {
+        Node* dummy = new Node();
+        head.store(dummy, std::memory_order_relaxed);
+        tail = dummy;
+    }
+
+    ~MpscQueue() {
+        T ignored;
+        while (Pop(ignored)) {}
+        delete tail;
+    }
+
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue& operator=(const MpscQueue&) = delete;
+
+    void Push(T value) {
+        Node* node = new Node();
+        node->value = std::move(value);
+        Node* prev = head.exchange(node, std::memory_order_acq_rel);
+        prev->next.store(node, std::memory_order_release);
+    }
+
+    bool Pop(T& out) {
+        Node* next = tail->next.load(std::memory_order_acquire);
+        if (!next) return false;
+        out = std::move(next->value);
+        delete tail;
+        tail = next;
+        return true;
+    }
+
+    bool Empty() const {
+        return tail->next.load(std::memory_order_acquire) == nullptr;
+    }
+
+private:
+    struct Node {
+        std::atomic<Node*> next{nullptr};
+        T value{};
+    };
+
+    alignas(64) std::atomic<Node*> head;
+    alignas(64) Node* tail;
+};
+
+} // namespace chat
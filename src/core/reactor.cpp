@@ -0,0 +1,806 @@
+#include "core/reactor.h"
+#include "core/uring.h"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <utility>
+
+namespace chat {
+
+constexpr size_t kMinRead = 4096;
+constexpr int kMaxEvents = 256;
+// A queue this large goes out immediately instead of waiting for the window.
+constexpr size_t kEagerFlushBytes = 64 * 1024;
+// Further Joins from a connection already in this many rooms are ignored.
+constexpr size_t kMaxRoomsPerConnection = 1024;
+// Runs of a session's own sequence numbers kept for its next resume.
+constexpr size_t kRecentOwnRanges = 64;
+
+int64_t NowNs() {
+    timespec ts{};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+// epoll_wait() only takes milliseconds; flush windows are in microseconds,
+// so prefer epoll_pwait2() where the kernel has it.
+static int WaitEvents(int epollFd, epoll_event* events, int max, int64_t timeoutNs) {
+#ifdef __NR_epoll_pwait2
+    static std::atomic<bool> havePwait2{true};
+    if (timeoutNs >= 0 && havePwait2.load(std::memory_order_relaxed)) {
+        timespec ts{};
+        ts.tv_sec = static_cast<time_t>(timeoutNs / 1000000000);
+        ts.tv_nsec = static_cast<long>(timeoutNs % 1000000000);
+        long n = syscall(__NR_epoll_pwait2, epollFd, events, max, &ts, nullptr, 8);
+        if (n >= 0 || errno != ENOSYS) return static_cast<int>(n);
+        havePwait2.store(false, std::memory_order_relaxed);
+    }
+#endif
+    int ms = timeoutNs < 0 ? -1 : static_cast<int>((timeoutNs + 999999) / 1000000);
+    return epoll_wait(epollFd, events, max, ms);
+}
+
+static std::string PeerName(const sockaddr_in& addr, socklen_t len) {
+    char host[NI_MAXHOST] = {};
+    char svc[NI_MAXSERV] = {};
+    getnameinfo(reinterpret_cast<const sockaddr*>(&addr), len,
+                host, sizeof(host), svc, sizeof(svc),
+                NI_NUMERICHOST | NI_NUMERICSERV);
+    return std::string(host) + ":" + svc;
+}
+
+static void SetCork(int fd, bool on) {
+    int v = on ? 1 : 0;
+    setsockopt(fd, IPPROTO_TCP, TCP_CORK, &v, sizeof(v));
+}
+
+Reactor::Reactor(const SocketConfig& config, EventCallback onEvent, unsigned shard)
+    : config(config), onEvent(std::move(onEvent)), shard(shard), nextId((static_cast<uint64_t>(shard) << 48) | 1) {}
+
+Reactor::~Reactor() {
+    // Tear the ring down first so no in-flight send still points into a queue.
+    uring.reset();
+    for (auto& entry : connections) close(entry.first);
+    connections.clear();
+    draining.clear();
+    if (listenFd >= 0) close(listenFd);
+    if (wakeFd >= 0) close(wakeFd);
+    if (epollFd >= 0) close(epollFd);
+}
+
+bool Reactor::Open() {
+    // io_uring arms its own poll for sockets, and honours O_NONBLOCK by
+    // failing with EAGAIN instead, so its descriptors stay blocking.
+    bool wantUring = config.transport == Transport::IoUring;
+    int nonBlock = wantUring ? 0 : SOCK_NONBLOCK;
+    listenFd = socket(AF_INET, SOCK_STREAM | nonBlock | SOCK_CLOEXEC, IPPROTO_TCP);
+    if (listenFd < 0) {
+        EmitLog(onEvent, "Failed to create socket.");
+        return false;
+    }
+    int yes = 1;
+    setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    if (setsockopt(listenFd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes)) < 0 && shard > 0) {
+        EmitLog(onEvent, "SO_REUSEPORT is not supported; cannot shard the listener.");
+        return false;
+    }
+
+    sockaddr_in hint{};
+    hint.sin_family = AF_INET;
+    hint.sin_port = htons(static_cast<uint16_t>(config.port));
+    hint.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(listenFd, reinterpret_cast<sockaddr*>(&hint), sizeof(hint)) < 0) {
+        EmitLog(onEvent, "Bind failed. Is the port in use?");
+        return false;
+    }
+    if (listen(listenFd, SOMAXCONN) < 0) {
+        EmitLog(onEvent, "Listen failed.");
+        return false;
+    }
+
+    if (wantUring) {
+        if (InitUring()) {
+            running = true;
+            return true;
+        }
+        EmitLog(onEvent, "io_uring unavailable; falling back to epoll.");
+        uring.reset();
+        config.transport = Transport::Epoll;
+        int flags = fcntl(listenFd, F_GETFL);
+        fcntl(listenFd, F_SETFL, flags | O_NONBLOCK);
+    }
+
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epollFd < 0 || wakeFd < 0) {
+        EmitLog(onEvent, "Failed to create epoll instance.");
+        return false;
+    }
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.fd = listenFd;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &ev);
+    ev.data.fd = wakeFd;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &ev);
+    running = true;
+    return true;
+}
+
+void Reactor::Stop() {
+    running = false;
+    if (wakeFd >= 0) {
+        uint64_t one = 1;
+        ssize_t ignored = write(wakeFd, &one, sizeof(one));
+        (void)ignored;
+    }
+}
+
+void Reactor::Wake() {
+    // Only the first poster after a drain pays for the eventfd write.
+    if (wakePending.exchange(true, std::memory_order_acq_rel)) return;
+    uint64_t one = 1;
+    Count();
+    ssize_t ignored = write(wakeFd, &one, sizeof(one));
+    (void)ignored;
+}
+
+void Reactor::Post(ShardMessage msg) {
+    mailbox.Push(std::move(msg));
+    Wake();
+}
+
+void Reactor::Run() {
+    if (uring) {
+        RunUring();
+    } else {
+        RunEpoll();
+    }
+}
+
+void Reactor::RunEpoll() {
+    epoll_event events[kMaxEvents];
+    while (running) {
+        Count();
+        int n = WaitEvents(epollFd, events, kMaxEvents, NextTimeoutNs(NowNs()));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            EmitLog(onEvent, "epoll_wait failed.");
+            break;
+        }
+        for (int i = 0; i < n; ++i) {
+            int fd = events[i].data.fd;
+            if (fd == listenFd) {
+                HandleAccept();
+                continue;
+            }
+            if (fd == wakeFd) {
+                uint64_t count;
+                Count();
+                ssize_t ignored = read(wakeFd, &count, sizeof(count));
+                (void)ignored;
+                wakePending.store(false, std::memory_order_release);
+                DrainMailbox();
+                continue;
+            }
+            auto it = connections.find(fd);
+            if (it == connections.end()) continue;
+            Connection& conn = *it->second;
+            if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                closing.push_back(fd);
+                continue;
+            }
+            if (events[i].events & EPOLLIN) HandleRead(conn);
+            if (events[i].events & EPOLLOUT) FlushConnection(conn);
+        }
+        ResumeInput();
+        FlushDue(NowNs());
+        for (int fd : closing) CloseConnection(fd);
+        closing.clear();
+    }
+}
+
+void Reactor::HandleAccept() {
+    for (;;) {
+        sockaddr_in addr{};
+        socklen_t len = sizeof(addr);
+        Count();
+        int fd = accept4(listenFd, reinterpret_cast<sockaddr*>(&addr), &len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                EmitLog(onEvent, "Accept failed.");
+            }
+            return;
+        }
+        Connection* conn = AddConnection(fd, addr, len);
+        if (!conn) continue;
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        Count();
+        if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            CloseConnection(fd);
+        }
+    }
+}
+
+Connection* Reactor::AddConnection(int fd, const sockaddr_in& addr, socklen_t len) {
+    int noDelay = config.tcpNoDelay ? 1 : 0;
+    Count();
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+    auto conn = std::make_unique<Connection>();
+    conn->fd = fd;
+    conn->id = nextId++;
+    conn->peer = PeerName(addr, len);
+    Connection* raw = conn.get();
+    connections[fd] = std::move(conn);
+    ++connectionCount;
+    EmitLog(onEvent, "Connected: " + raw->peer);
+    EmitConnected(onEvent, raw->id, true);
+    if (stream) {
+        raw->session = RandomId();
+        if (sessions) sessions->Open(raw->session, SessionOwner{shard, fd, raw->id});
+        QueueFrame(*raw, ShareFrame(EncodeSession(FrameType::Session, kSessionRoomsLive, stream->LastSeq(),
+                                                  raw->session, stream->StreamId())), nullptr);
+    }
+    return raw;
+}
+
+void Reactor::HandleRead(Connection& conn) {
+    size_t want = conn.decoder.Missing() > kMinRead ? conn.decoder.Missing() : kMinRead;
+    char* dst = conn.inbuf.Prepare(want);
+    Count();
+    ssize_t res = recv(conn.fd, dst, conn.inbuf.Writable(), 0);
+    if (res < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) return;
+    if (res <= 0) {
+        closing.push_back(conn.fd);
+        return;
+    }
+    conn.inbuf.Commit(static_cast<size_t>(res));
+    stats.bytesIn.fetch_add(static_cast<uint64_t>(res), std::memory_order_relaxed);
+    ProcessInput(conn);
+}
+
+void Reactor::ProcessInput(Connection& conn) {
+    FrameView frame;
+    DecodeResult result = DecodeResult::NeedMore;
+    // A paused producer keeps its unread frames buffered until resumed.
+    while (conn.pausedBy == 0 && (result = conn.decoder.Next(frame)) == DecodeResult::Frame) {
+        HandleFrame(conn, frame);
+    }
+    if (result == DecodeResult::Error) {
+        EmitLog(onEvent, "[!] Protocol error from " + conn.peer);
+        closing.push_back(conn.fd);
+    }
+}
+
+void Reactor::ResumeInput() {
+    std::vector<std::pair<int, uint64_t>> ready;
+    ready.swap(resumed);
+    for (const auto& r : ready) {
+        auto it = connections.find(r.first);
+        if (it == connections.end() || it->second->id != r.second) continue;
+        if (it->second->pausedBy == 0) ProcessInput(*it->second);
+    }
+}
+
+void Reactor::HandleFrame(Connection& conn, const FrameView& frame) {
+    if (frame.header.type == FrameType::HistoryRequest || frame.header.type == FrameType::Resume) {
+        // One replay per connection at a time: history is not bounded by the
+        // queue caps, so the next request has to wait for the last to go out.
+        if (!conn.history.empty()) {
+            stats.replaysRefused.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        if (frame.header.type == FrameType::Resume) {
+            ResumeSession(conn, frame);
+        } else if (store) {
+            QueueHistory(conn, frame.header);
+        }
+        return;
+    }
+    if (frame.header.type == FrameType::Join || frame.header.type == FrameType::Leave) {
+        SetMembership(conn, frame);
+        return;
+    }
+    if (frame.header.type != FrameType::Text && frame.header.type != FrameType::Publish) return;
+    bool numbered = frame.header.seq != 0;
+    if (numbered && !conn.received.Accept(frame.header.seq)) {
+        OweAck(conn);
+        stats.duplicates.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    stats.messagesIn.fetch_add(1, std::memory_order_relaxed);
+    if (frame.header.type == FrameType::Publish) {
+        PublishToRoom(conn, frame);
+        if (numbered) OweAck(conn);
+        return;
+    }
+    SharedFrame out = stream ? stream->Publish(frame.payload, frame.header.length, conn.session)
+                             : ShareFrame(std::string(frame.raw, frame.rawSize));
+    FrameHeader sent = ReadFrameHeader(out->data());
+    if (sent.flags & kFrameSequenced) {
+        AppendSeq(conn.own, sent.seq);
+        AppendSeq(conn.recentOwn, sent.seq);
+        if (conn.recentOwn.size() > kRecentOwnRanges) conn.recentOwn.erase(conn.recentOwn.begin());
+    } else if (stream) {
+        stats.storeFailures.fetch_add(1, std::memory_order_relaxed);
+    }
+    Relay(out, conn);
+    if (numbered || !conn.own.empty()) OweAck(conn);
+    EmitMessage(onEvent, conn.id, conn.peer, std::string(frame.payload, frame.header.length));
+}
+
+void Reactor::SetMembership(Connection& conn, const FrameView& frame) {
+    size_t len = frame.header.length;
+    if (len == 0 || len > kMaxRoomName) return;
+    std::string room(frame.payload, len);
+    if (frame.header.type == FrameType::Join) {
+        if (conn.rooms.size() >= kMaxRoomsPerConnection || !rooms.Join(room, &conn)) return;
+        if (roomShards && rooms.Subscribers(room)->size() == 1) roomShards->Add(room, shard);
+        conn.rooms.push_back(std::move(room));
+    } else if (rooms.Leave(room, &conn)) {
+        LeftRoom(room);
+        conn.rooms.erase(std::find(conn.rooms.begin(), conn.rooms.end(), room));
+    }
+}
+
+void Reactor::LeftRoom(const std::string& room) {
+    if (roomShards && !rooms.Subscribers(room)) roomShards->Remove(room, shard);
+}
+
+// The relayed copy drops the client's sequence number; room messages are not
+// part of the relay's stream.
+void Reactor::PublishToRoom(Connection& conn, const FrameView& frame) {
+    std::string room;
+    const char* text = nullptr;
+    size_t len = 0;
+    if (!ReadPublish(frame, room, text, len)) return;
+    SharedFrame out = ShareFrame(EncodePublish(0, room, text, len));
+    FanOut(room, out, conn.id, &conn);
+    uint64_t mask = roomShards ? roomShards->Shards(room) : ~uint64_t(0);
+    for (size_t i = 0; i < peers.size(); ++i) {
+        if (i != shard && ((mask >> i) & 1)) peers[i]->Post(ShardMessage{out, conn.id, room});
+    }
+    EmitMessage(onEvent, conn.id, conn.peer + " #" + room, std::string(text, len));
+}
+
+void Reactor::QueueHistory(Connection& conn, const FrameHeader& request) {
+    std::vector<StoreRange> ranges;
+    switch (static_cast<HistoryMode>(request.flags)) {
+    case HistoryMode::SinceSeq:
+        ranges = store->Since(request.seq);
+        break;
+    case HistoryMode::Last:
+        ranges = store->Last(request.seq);
+        break;
+    case HistoryMode::SinceTime:
+        ranges = store->SinceTime(static_cast<int64_t>(request.seq));
+        break;
+    default:
+        return;
+    }
+    stats.replayRequests.fetch_add(1, std::memory_order_relaxed);
+    if (ranges.empty() || conn.closed) return;
+    for (StoreRange& r : ranges) conn.history.push_back(HistoryRange{std::move(r), nullptr});
+    if (!conn.wantWrite && !conn.inflight) FlushConnection(conn);
+}
+
+// A Resume from another stream (the relay restarted without a store) is
+// ignored; the client learns that from the Session frame it was greeted with.
+// If the session is still connected (a half-open socket the client gave up
+// on, maybe on another shard), that connection is closed and this one's
+// input held until its window is parked, so resent frames are still
+// recognised.
+void Reactor::ResumeSession(Connection& conn, const FrameView& frame) {
+    uint64_t token = 0;
+    uint64_t streamId = 0;
+    if (!stream || !ReadSession(frame, token, streamId) || !token || streamId != stream->StreamId()) return;
+    conn.resumeFrom = frame.header.seq;
+    if (sessions && token != conn.session) {
+        SessionOwner next;
+        sessions->Close(conn.session, conn.id, false, conn.received, conn.recentOwn, next);
+        SessionOwner previous;
+        SessionOwner displaced;
+        bool ready = sessions->Claim(token, SessionOwner{shard, conn.fd, conn.id}, conn.received, conn.recentOwn,
+                                     previous, displaced);
+        if (displaced.id) {
+            peers[displaced.shard]->Post(
+                ShardMessage{nullptr, 0, std::string(), ShardControl::CloseSession, displaced.fd, displaced.id});
+        }
+        if (!ready) {
+            conn.session = token;
+            conn.awaitingSession = true;
+            ++conn.pausedBy;
+            SetReading(conn);
+            peers[previous.shard]->Post(
+                ShardMessage{nullptr, 0, std::string(), ShardControl::CloseSession, previous.fd, previous.id});
+            return;
+        }
+    }
+    conn.session = token;
+    ReplaySession(conn);
+}
+
+// The replay goes out like history, after what is already queued and beyond
+// the reach of the overflow policy. It leads with kAckOwn Acks for the
+// client's latest own messages past its resume point (their first report may
+// have been lost with the connection), so the client drops them from a store
+// replay, which cannot tell them apart, and with a kAckLost Ack for whatever
+// the store can no longer replay.
+void Reactor::ReplaySession(Connection& conn) {
+    uint64_t from = conn.resumeFrom;
+    QueueFrame(conn, ShareFrame(EncodeSession(FrameType::Session, kSessionResumed | kSessionRoomsLive,
+                                              stream->LastSeq(), conn.session, stream->StreamId())), nullptr);
+    std::vector<AckRange> own;
+    for (const AckRange& r : conn.recentOwn) {
+        if (r.second > from) own.emplace_back(std::max(r.first, from + 1), r.second);
+    }
+    std::string missed;
+    for (size_t i = 0; i < own.size(); i += kMaxAckRanges) {
+        std::vector<AckRange> part(own.begin() + i, own.begin() + std::min(i + kMaxAckRanges, own.size()));
+        missed += EncodeAck(0, part, kAckOwn);
+    }
+    if (stream->Since(from, conn.session, missed)) {
+        stats.resumes.fetch_add(1, std::memory_order_relaxed);
+        QueueReplay(conn, std::move(missed));
+    } else if (store) {
+        stats.resumesFromStore.fetch_add(1, std::memory_order_relaxed);
+        uint64_t first = 0;
+        std::vector<StoreRange> ranges = store->Since(from + 1, &first);
+        if (first > from + 1) {
+            // Gone to retention or past StoreConfig::maxReplayBytes. Saying
+            // so lets the client report the loss and move its window on.
+            missed += EncodeAck(0, {AckRange{from + 1, first - 1}}, kAckLost);
+        }
+        QueueReplay(conn, std::move(missed));
+        if (!conn.closed) {
+            for (StoreRange& r : ranges) conn.history.push_back(HistoryRange{std::move(r), nullptr});
+        }
+    } else {
+        stats.resumeMisses.fetch_add(1, std::memory_order_relaxed);
+        QueueReplay(conn, std::move(missed));
+    }
+    if (!conn.closed && !conn.wantWrite && !conn.inflight) FlushConnection(conn);
+}
+
+void Reactor::HandOver(const ShardMessage& msg) {
+    auto it = connections.find(msg.fd);
+    if (it == connections.end() || it->second->id != msg.connId) return;
+    Connection& conn = *it->second;
+    if (msg.control == ShardControl::CloseSession) {
+        EmitLog(onEvent, "[!] Session resumed on a new connection; closing " + conn.peer);
+        closing.push_back(conn.fd);
+        return;
+    }
+    // Not the newest claimant any more: a CloseSession is on its way.
+    if (!conn.awaitingSession || !sessions->Take(conn.session, conn.id, conn.received, conn.recentOwn)) return;
+    conn.awaitingSession = false;
+    ReplaySession(conn);
+    if (--conn.pausedBy == 0) SetReading(conn);
+}
+
+void Reactor::QueueReplay(Connection& conn, std::string frames) {
+    if (frames.empty() || conn.closed) return;
+    uint64_t length = frames.size();
+    conn.history.push_back(HistoryRange{StoreRange{-1, 0, length, nullptr}, ShareFrame(std::move(frames))});
+}
+
+void Reactor::OweAck(Connection& conn) {
+    if (++conn.acksOwed >= config.ackEvery || conn.own.size() >= kMaxAckRanges) {
+        SendAck(conn);
+        return;
+    }
+    if (!conn.ackScheduled) {
+        conn.ackScheduled = true;
+        ackQueue.push_back(PendingFlush{conn.fd, conn.id, NowNs() + int64_t(config.ackDelayUs) * 1000});
+    }
+}
+
+void Reactor::SendAck(Connection& conn) {
+    conn.acksOwed = 0;
+    std::vector<AckRange> ranges;
+    conn.received.Ranges(ranges, kMaxAckRanges);
+    QueueFrame(conn, ShareFrame(EncodeAck(conn.received.Cumulative(), ranges)), nullptr);
+    if (!conn.own.empty()) {
+        QueueFrame(conn, ShareFrame(EncodeAck(0, conn.own, kAckOwn)), nullptr);
+        conn.own.clear();
+    }
+    stats.acksSent.fetch_add(1, std::memory_order_relaxed);
+}
+
+FlushResult Reactor::SendHistory(Connection& conn) {
+    while (!conn.history.empty()) {
+        HistoryRange& next = conn.history.front();
+        StoreRange& range = next.file;
+        off_t offset = static_cast<off_t>(range.offset);
+        Count();
+        ssize_t n = next.memory ? send(conn.fd, next.memory->data() + range.offset, range.length, MSG_NOSIGNAL)
+                                : sendfile(conn.fd, range.fd, &offset, range.length);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return FlushResult::Blocked;
+            return FlushResult::Error;
+        }
+        // Stored records never shrink; a short file means the stream is lost.
+        if (n == 0) return FlushResult::Error;
+        range.offset += static_cast<uint64_t>(n);
+        range.length -= static_cast<uint64_t>(n);
+        stats.bytesOut.fetch_add(static_cast<uint64_t>(n), std::memory_order_relaxed);
+        stats.replayBytes.fetch_add(static_cast<uint64_t>(n), std::memory_order_relaxed);
+        conn.replaying = range.length != 0;
+        if (!conn.replaying) conn.history.pop_front();
+    }
+    return FlushResult::Done;
+}
+
+void Reactor::QueueFrame(Connection& conn, const SharedFrame& frame, Connection* producer) {
+    if (conn.closed || !Admit(conn, frame->size(), producer)) return;
+    conn.sendq.Push(frame);
+    NoteQueue(conn);
+    // A connection waiting for EPOLLOUT (or for its in-flight io_uring sends)
+    // is flushed when that completes; otherwise start its window on the first
+    // frame and cut it short for big bursts.
+    if (conn.wantWrite || conn.inflight) return;
+    if (conn.sendq.Bytes() >= kEagerFlushBytes) {
+        FlushConnection(conn);
+        return;
+    }
+    if (!conn.flushScheduled) {
+        conn.flushScheduled = true;
+        flushQueue.push_back(PendingFlush{conn.fd, conn.id, NowNs() + int64_t(config.flushWindowUs) * 1000});
+    }
+}
+
+void Reactor::FlushConnection(Connection& conn) {
+    conn.flushScheduled = false;
+    if (uring) {
+        SubmitSends(conn);
+        return;
+    }
+    FlushResult result = FlushResult::Done;
+    if (conn.replaying) result = SendHistory(conn);
+    if (result == FlushResult::Done && !conn.sendq.Empty()) {
+        bool cork = config.tcpCork && conn.sendq.Frames() > 1;
+        if (cork) SetCork(conn.fd, true);
+        uint64_t before = conn.sendq.Syscalls();
+        size_t bytes = conn.sendq.Bytes();
+        result = conn.sendq.Flush(conn.fd);
+        Count(conn.sendq.Syscalls() - before + (cork ? 2 : 0));
+        stats.bytesOut.fetch_add(bytes - conn.sendq.Bytes(), std::memory_order_relaxed);
+        if (cork) SetCork(conn.fd, false);
+        AfterSend(conn);
+    }
+    // Queued frames go first, so history starts on a frame boundary.
+    if (result == FlushResult::Done && !conn.history.empty()) result = SendHistory(conn);
+    if (result == FlushResult::Error) {
+        closing.push_back(conn.fd);
+        return;
+    }
+    UpdateInterest(conn);
+}
+
+void Reactor::FlushDue(int64_t nowNs) {
+    while (!flushQueue.empty() && flushQueue.front().deadlineNs <= nowNs) {
+        PendingFlush due = flushQueue.front();
+        flushQueue.pop_front();
+        auto it = connections.find(due.fd);
+        if (it == connections.end() || it->second->id != due.id) continue;
+        Connection& conn = *it->second;
+        if (conn.flushScheduled) FlushConnection(conn);
+    }
+    while (!ackQueue.empty() && ackQueue.front().deadlineNs <= nowNs) {
+        PendingFlush due = ackQueue.front();
+        ackQueue.pop_front();
+        auto it = connections.find(due.fd);
+        if (it == connections.end() || it->second->id != due.id) continue;
+        Connection& conn = *it->second;
+        conn.ackScheduled = false;
+        if (conn.acksOwed) SendAck(conn);
+    }
+}
+
+int64_t Reactor::NextTimeoutNs(int64_t nowNs) const {
+    if (flushQueue.empty() && ackQueue.empty()) return -1;
+    int64_t next = INT64_MAX;
+    if (!flushQueue.empty()) next = flushQueue.front().deadlineNs;
+    if (!ackQueue.empty() && ackQueue.front().deadlineNs < next) next = ackQueue.front().deadlineNs;
+    int64_t wait = next - nowNs;
+    return wait > 0 ? wait : 0;
+}
+
+void Reactor::UpdateInterest(Connection& conn) {
+    bool want = !conn.sendq.Empty() || !conn.history.empty();
+    bool read = conn.pausedBy == 0;
+    if (want == conn.wantWrite && read == conn.reading) return;
+    conn.wantWrite = want;
+    conn.reading = read;
+    epoll_event ev{};
+    ev.events = (read ? EPOLLIN : 0u) | (want ? EPOLLOUT : 0u);
+    ev.data.fd = conn.fd;
+    Count();
+    epoll_ctl(epollFd, EPOLL_CTL_MOD, conn.fd, &ev);
+}
+
+void Reactor::Broadcast(const SharedFrame& frame, uint64_t exceptId, Connection* producer) {
+    for (auto& entry : connections) {
+        Connection& target = *entry.second;
+        if (target.id == exceptId) continue;
+        QueueFrame(target, frame, producer);
+    }
+}
+
+void Reactor::Relay(const SharedFrame& frame, Connection& producer) {
+    Broadcast(frame, producer.id, &producer);
+    for (Reactor* other : peers) {
+        if (other != this) other->Post(ShardMessage{frame, producer.id, std::string()});
+    }
+}
+
+void Reactor::FanOut(const std::string& room, const SharedFrame& frame, uint64_t exceptId, Connection* producer) {
+    const std::vector<Connection*>* subscribers = rooms.Subscribers(room);
+    if (!subscribers) return;
+    for (Connection* target : *subscribers) {
+        if (target->id != exceptId) QueueFrame(*target, frame, producer);
+    }
+}
+
+void Reactor::DrainMailbox() {
+    ShardMessage msg;
+    while (mailbox.Pop(msg)) {
+        if (msg.control != ShardControl::None) {
+            HandOver(msg);
+        } else if (msg.room.empty()) {
+            Broadcast(msg.frame, msg.exceptId, nullptr);
+        } else {
+            FanOut(msg.room, msg.frame, msg.exceptId, nullptr);
+        }
+    }
+}
+
+// Decides whether a frame of `size` bytes may join conn's queue, applying the
+// overflow policy when it would not fit.
+bool Reactor::Admit(Connection& conn, size_t size, Connection* producer) {
+    auto full = [&] {
+        return conn.sendq.Bytes() + size > config.maxQueueBytes ||
+               conn.sendq.Frames() + 1 > config.maxQueueFrames;
+    };
+    if (!full()) return true;
+    switch (config.overflow) {
+    case OverflowPolicy::DropOldest: {
+        uint64_t dropped = 0;
+        while (full() && conn.sendq.DropOldest(conn.inflight)) ++dropped;
+        stats.droppedFrames.fetch_add(dropped, std::memory_order_relaxed);
+        NoteQueue(conn);
+        if (!full()) return true;
+        break;
+    }
+    case OverflowPolicy::DropNewest:
+        break;
+    case OverflowPolicy::Disconnect:
+        EmitLog(onEvent, "[!] Send queue full, disconnecting " + conn.peer);
+        stats.slowDisconnects.fetch_add(1, std::memory_order_relaxed);
+        conn.closed = true;
+        closing.push_back(conn.fd);
+        return false;
+    case OverflowPolicy::PauseProducer:
+        if (!producer) break;
+        PauseProducer(conn, *producer);
+        return true;
+    }
+    stats.droppedFrames.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+void Reactor::PauseProducer(Connection& slow, Connection& producer) {
+    for (const auto& p : slow.pausedProducers) {
+        if (p.second == producer.id) return;
+    }
+    slow.pausedProducers.emplace_back(producer.fd, producer.id);
+    if (producer.pausedBy++ == 0) {
+        stats.producerPauses.fetch_add(1, std::memory_order_relaxed);
+        SetReading(producer);
+    }
+}
+
+void Reactor::ReleaseProducers(Connection& slow) {
+    for (const auto& p : slow.pausedProducers) {
+        auto it = connections.find(p.first);
+        if (it == connections.end() || it->second->id != p.second) continue;
+        Connection& producer = *it->second;
+        if (--producer.pausedBy == 0) SetReading(producer);
+    }
+    slow.pausedProducers.clear();
+}
+
+void Reactor::SetReading(Connection& conn) {
+    if (conn.pausedBy == 0) resumed.emplace_back(conn.fd, conn.id);
+    if (!uring) {
+        UpdateInterest(conn);
+    } else if (conn.pausedBy) {
+        CancelRecv(conn);
+    } else if (conn.recvs == 0) {
+        // A recv still being cancelled re-arms itself when it ends.
+        ArmRecv(conn);
+    }
+}
+
+void Reactor::AfterSend(Connection& conn) {
+    NoteQueue(conn);
+    if (!conn.pausedProducers.empty() &&
+        conn.sendq.Bytes() <= config.maxQueueBytes / 2 &&
+        conn.sendq.Frames() <= config.maxQueueFrames / 2) {
+        ReleaseProducers(conn);
+    }
+}
+
+void Reactor::NoteQueue(Connection& conn) {
+    size_t bytes = conn.sendq.Bytes();
+    size_t frames = conn.sendq.Frames();
+    // Unsigned wrap-around turns a shrinking queue into a subtraction.
+    stats.queuedBytes.fetch_add(uint64_t(bytes) - conn.reportedBytes, std::memory_order_relaxed);
+    stats.queuedFrames.fetch_add(uint64_t(frames) - conn.reportedFrames, std::memory_order_relaxed);
+    conn.reportedBytes = bytes;
+    conn.reportedFrames = frames;
+    if (bytes > stats.peakQueueBytes.load(std::memory_order_relaxed)) {
+        stats.peakQueueBytes.store(bytes, std::memory_order_relaxed);
+    }
+}
+
+void Reactor::CloseConnection(int fd) {
+    auto it = connections.find(fd);
+    if (it == connections.end()) return;
+    std::unique_ptr<Connection> conn = std::move(it->second);
+    connections.erase(it);
+    --connectionCount;
+    conn->closed = true;
+    ReleaseProducers(*conn);
+    stats.queuedBytes.fetch_sub(conn->reportedBytes, std::memory_order_relaxed);
+    stats.queuedFrames.fetch_sub(conn->reportedFrames, std::memory_order_relaxed);
+    if (sessions && conn->session) {
+        // A connection still waiting for its session's window holds none;
+        // whoever claimed the session after it gets the parked one.
+        bool holding = !conn->awaitingSession && (conn->received.Started() || !conn->recentOwn.empty());
+        SessionOwner next;
+        if (sessions->Close(conn->session, conn->id, holding, conn->received, conn->recentOwn, next)) {
+            peers[next.shard]->Post(
+                ShardMessage{nullptr, 0, std::string(), ShardControl::SessionReady, next.fd, next.id});
+        }
+    }
+    for (const std::string& room : conn->rooms) {
+        rooms.Leave(room, conn.get());
+        LeftRoom(room);
+    }
+    EmitLog(onEvent, "[!] Disconnected: " + conn->peer);
+    EmitConnected(onEvent, conn->id, false);
+    if (uring) {
+        // SQEs already queued for this fd are submitted while the number is
+        // still ours. Outstanding multishot recvs end once the socket is shut
+        // down; sends still in flight point into the queue, so it outlives the
+        // socket until their completions arrive.
+        uring->Submit(0, 0);
+        shutdown(fd, SHUT_RDWR);
+        close(fd);
+        Count(2);
+        if (conn->inflight) draining[static_cast<uint32_t>(conn->id)] = std::move(conn);
+        return;
+    }
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+    close(fd);
+    Count(2);
+}
+
+} // namespace chat
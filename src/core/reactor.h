@@ -0,0 +1,269 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "core/ack.h"
+#include "core/chat_events.h"
+#include "core/frame.h"
+#include "core/message_store.h"
+#include "core/mpsc_queue.h"
+#include "core/room_table.h"
+#include "core/send_queue.h"
+#include "core/socket_engine.h"
+#include "core/stream_log.h"
+
+struct io_uring_cqe;
+
+namespace chat {
+
+class Uring;
+
+// A stretch of history still to send: a byte range of a segment file, or,
+// when `memory` is set, of those frames instead (a resume served from the
+// StreamLog).
+struct HistoryRange {
+    StoreRange file;
+    SharedFrame memory;
+};
+
+// CLOCK_MONOTONIC in nanoseconds; flush deadlines are kept on this clock.
+int64_t NowNs();
+
+struct Connection {
+    int fd{-1};
+    uint64_t id{0};
+    // Session token, issued at accept or adopted from a Resume.
+    uint64_t session{0};
+    std::string peer;
+    RecvBuffer inbuf;
+    FrameDecoder decoder{inbuf};
+    SendQueue sendq;
+    bool flushScheduled{false};
+    bool wantWrite{false};
+    // epoll only: whether EPOLLIN is currently registered.
+    bool reading{true};
+    // io_uring only: queued frames handed to the in-flight sendmsg (with its
+    // gather list, which must outlive it), multishot recvs in flight, and
+    // whether the socket is gone.
+    unsigned inflight{0};
+    std::vector<iovec> sendIov;
+    msghdr sendMsg{};
+    unsigned recvs{0};
+    bool closed{false};
+    // Backpressure: producers (fd, id) this connection's full queue has
+    // paused, and how many slow connections are pausing this one.
+    std::vector<std::pair<int, uint64_t>> pausedProducers;
+    unsigned pausedBy{0};
+    // Queue depth last added to ShardStats.
+    size_t reportedBytes{0};
+    size_t reportedFrames{0};
+    // History and resume replays still to send, straight from the segment
+    // files or memory (io_uring reads it into the send queue a chunk at a
+    // time). Once a range has started going out it finishes before any queued
+    // frame. It is not subject to the queue caps, so only one request is
+    // served at a time.
+    std::deque<HistoryRange> history;
+    bool replaying{false};
+    // Numbered Text frames received from this session, and how many arrived
+    // since the last Ack was queued.
+    AckWindow received;
+    unsigned acksOwed{0};
+    // Sequence numbers given to this connection's messages since the last
+    // Ack, reported back with it (kAckOwn), and the latest of them whether
+    // reported or not, for the session's next resume.
+    std::vector<AckRange> own;
+    std::vector<AckRange> recentOwn;
+    bool ackScheduled{false};
+    // A Resume waiting, with input paused, for the session's previous
+    // connection to close and hand its window over; and the resume point.
+    bool awaitingSession{false};
+    uint64_t resumeFrom{0};
+    // Rooms joined, so closing the connection can leave them.
+    std::vector<std::string> rooms;
+};
+
+// Session handover between connections, possibly on different shards:
+// close the one holding a resumed session, or tell the one that resumed it
+// that the window is parked.
+enum class ShardControl : uint8_t { None, CloseSession, SessionReady };
+
+// An encoded frame on its way to every connection of a shard except the
+// one it came from, or only to the subscribers of `room` when set; or, with
+// `control` set, a handover for the connection (fd, connId).
+struct ShardMessage {
+    SharedFrame frame;
+    uint64_t exceptId{0};
+    std::string room;
+    ShardControl control{ShardControl::None};
+    int fd{-1};
+    uint64_t connId{0};
+};
+
+struct ShardStats {
+    std::atomic<uint64_t> syscalls{0};
+    std::atomic<uint64_t> messagesIn{0};
+    std::atomic<uint64_t> bytesIn{0};
+    std::atomic<uint64_t> bytesOut{0};
+    std::atomic<uint64_t> queuedBytes{0};
+    std::atomic<uint64_t> queuedFrames{0};
+    std::atomic<uint64_t> peakQueueBytes{0};
+    std::atomic<uint64_t> droppedFrames{0};
+    std::atomic<uint64_t> slowDisconnects{0};
+    std::atomic<uint64_t> producerPauses{0};
+    std::atomic<uint64_t> replayRequests{0};
+    std::atomic<uint64_t> replayBytes{0};
+    std::atomic<uint64_t> replaysRefused{0};
+    std::atomic<uint64_t> resumes{0};
+    std::atomic<uint64_t> resumesFromStore{0};
+    std::atomic<uint64_t> resumeMisses{0};
+    std::atomic<uint64_t> storeFailures{0};
+    std::atomic<uint64_t> acksSent{0};
+    std::atomic<uint64_t> duplicates{0};
+};
+
+// Single-threaded event loop that owns a listening socket and every
+// connection accepted on it. Several reactors can share a port via
+// SO_REUSEPORT; each is one shard with its own poller and connection table.
+// Other threads only talk to a shard through Post() and Stop(), which go
+// through a lock-free mailbox and an eventfd doorbell.
+//
+// The poller is epoll or io_uring (multishot accept, multishot recv into
+// provided buffers, one gathered sendmsg in flight per connection), chosen by
+// SocketConfig::transport.
+// Outbound frames are queued per connection and flushed in one batch per
+// connection once the configured flush window has elapsed (or at the end of
+// the current loop iteration when the window is zero).
+// Messages are numbered by the shared StreamLog before they are relayed, and
+// stored when there is a MessageStore; history requests are answered with
+// sendfile() from the segment files (io_uring copies them through the send
+// queue a chunk at a time). Resumed sessions get what they missed from the
+// StreamLog, or from the store once the StreamLog has dropped it, after the
+// sequence numbers of their latest own messages.
+// Numbered client frames are acknowledged in batches (every
+// SocketConfig::ackEvery frames or ackDelayUs after the first unacknowledged
+// one) and resent ones are dropped by the session's AckWindow, which is
+// parked in SessionWindows while the client is away. A Resume for a session
+// still connected elsewhere closes that connection, on whichever shard, and
+// waits for its window before replaying.
+// Room messages (FrameType::Publish) go only to the room's subscribers, found
+// in each shard's own RoomTable, and are posted only to the shards RoomShards
+// lists for the room.
+class Reactor {
+public:
+    Reactor(const SocketConfig& config, EventCallback onEvent, unsigned shard);
+    ~Reactor();
+    Reactor(const Reactor&) = delete;
+    Reactor& operator=(const Reactor&) = delete;
+
+    bool Open();
+    void Run();
+    void Stop();
+    void Post(ShardMessage msg);
+    void SetPeers(const std::vector<Reactor*>& shards) { peers = shards; }
+    void SetStore(MessageStore* messageStore) { store = messageStore; }
+    void SetStream(StreamLog* streamLog) { stream = streamLog; }
+    void SetSessions(SessionWindows* windows) { sessions = windows; }
+    void SetRoomShards(RoomShards* table) { roomShards = table; }
+
+    size_t ConnectionCount() const { return connectionCount; }
+    const ShardStats& Stats() const { return stats; }
+    bool UsingUring() const { return uring != nullptr; }
+
+private:
+    struct PendingFlush {
+        int fd;
+        uint64_t id;
+        int64_t deadlineNs;
+    };
+
+    void RunEpoll();
+    void HandleAccept();
+    void HandleRead(Connection& conn);
+    Connection* AddConnection(int fd, const sockaddr_in& addr, socklen_t len);
+    void ProcessInput(Connection& conn);
+    void ResumeInput();
+    void HandleFrame(Connection& conn, const FrameView& frame);
+    void QueueHistory(Connection& conn, const FrameHeader& request);
+    void ResumeSession(Connection& conn, const FrameView& frame);
+    void ReplaySession(Connection& conn);
+    void HandOver(const ShardMessage& msg);
+    void QueueReplay(Connection& conn, std::string frames);
+    void SetMembership(Connection& conn, const FrameView& frame);
+    void LeftRoom(const std::string& room);
+    void PublishToRoom(Connection& conn, const FrameView& frame);
+    void FanOut(const std::string& room, const SharedFrame& frame, uint64_t exceptId, Connection* producer);
+    void OweAck(Connection& conn);
+    void SendAck(Connection& conn);
+    FlushResult SendHistory(Connection& conn);
+    void Wake();
+    void DrainMailbox();
+    void Broadcast(const SharedFrame& frame, uint64_t exceptId, Connection* producer);
+    void Relay(const SharedFrame& frame, Connection& producer);
+    void QueueFrame(Connection& conn, const SharedFrame& frame, Connection* producer);
+    bool Admit(Connection& conn, size_t size, Connection* producer);
+    void PauseProducer(Connection& slow, Connection& producer);
+    void ReleaseProducers(Connection& slow);
+    void SetReading(Connection& conn);
+    void AfterSend(Connection& conn);
+    void NoteQueue(Connection& conn);
+    void FlushConnection(Connection& conn);
+    void FlushDue(int64_t nowNs);
+    int64_t NextTimeoutNs(int64_t nowNs) const;
+    void UpdateInterest(Connection& conn);
+    void CloseConnection(int fd);
+    void Count(uint64_t n = 1) { stats.syscalls.fetch_add(n, std::memory_order_relaxed); }
+
+    bool InitUring();
+    void RunUring();
+    void ArmAccept();
+    void ArmWake();
+    void ArmRecv(Connection& conn);
+    void CancelRecv(Connection& conn);
+    void SubmitSends(Connection& conn);
+    bool LoadHistory(Connection& conn);
+    void HandleCqe(const io_uring_cqe& cqe);
+    Connection* FindByKey(uint64_t key);
+
+    SocketConfig config;
+    EventCallback onEvent;
+    unsigned shard{0};
+    std::vector<Reactor*> peers;
+    MessageStore* store{nullptr};
+    StreamLog* stream{nullptr};
+    SessionWindows* sessions{nullptr};
+    RoomShards* roomShards{nullptr};
+    int listenFd{-1};
+    int epollFd{-1};
+    int wakeFd{-1};
+    std::atomic<bool> running{false};
+    std::atomic<size_t> connectionCount{0};
+    uint64_t nextId{1};
+    std::unordered_map<int, std::unique_ptr<Connection>> connections;
+    RoomTable rooms;
+    std::deque<PendingFlush> flushQueue;
+    std::deque<PendingFlush> ackQueue;
+    std::vector<int> closing;
+    std::vector<std::pair<int, uint64_t>> resumed;
+    ShardStats stats;
+
+    std::unique_ptr<Uring> uring;
+    std::unordered_map<uint32_t, std::unique_ptr<Connection>> draining;
+    uint64_t wakeValue{0};
+    uint64_t uringSyscallsSeen{0};
+
+    MpscQueue<ShardMessage> mailbox;
+    std::atomic<bool> wakePending{false};
+};
+
+} // namespace chat
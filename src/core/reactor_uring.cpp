@@ -0,0 +1,296 @@
+#include "core/reactor.h"
+#include "core/uring.h"
+
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+namespace chat {
+
+constexpr unsigned kRingEntries = 4096;
+constexpr unsigned kRecvBuffers = 1024;
+constexpr unsigned kRecvBufferSize = 4096;
+constexpr uint16_t kRecvGroup = 0;
+// Frames gathered into one sendmsg. Only one is in flight per connection, so
+// this is wider than SendQueue::Flush() uses.
+constexpr size_t kMaxSendIov = 256;
+// History read into the send queue at a time, there being no sendfile.
+constexpr size_t kHistoryChunk = 256 * 1024;
+// Completions handled between submissions. A multishot recv can post
+// megabytes per wait; chunking lets sends start before all of it is relayed,
+// so queues are drained at the rate they fill.
+constexpr unsigned kCqeBatch = 16;
+
+// user_data layout: tag in the top byte, then the fd (24 bits) and the low 32
+// bits of the connection id, so completions for a recycled fd are told apart.
+enum class OpTag : uint64_t { Buffers = 0, Accept = 1, Wake = 2, Recv = 3, Send = 4, Cancel = 5 };
+
+static uint64_t MakeKey(OpTag tag, int fd = 0, uint64_t id = 0) {
+    return (static_cast<uint64_t>(tag) << 56) |
+           ((static_cast<uint64_t>(fd) & 0xFFFFFF) << 32) |
+           (id & 0xFFFFFFFF);
+}
+
+static OpTag KeyTag(uint64_t key) { return static_cast<OpTag>(key >> 56); }
+
+// Grabs a submission entry, handing the queued ones to the kernel first if
+// the ring is full.
+static io_uring_sqe* NextSqe(Uring& ring) {
+    io_uring_sqe* sqe = ring.GetSqe();
+    if (!sqe) {
+        ring.Submit(0, 0);
+        sqe = ring.GetSqe();
+    }
+    return sqe;
+}
+
+bool Reactor::InitUring() {
+    auto ring = std::make_unique<Uring>();
+    if (!ring->Init(kRingEntries)) return false;
+    // The wake read blocks inside the ring, so the eventfd itself stays blocking.
+    wakeFd = eventfd(0, EFD_CLOEXEC);
+    if (wakeFd < 0) return false;
+    uring = std::move(ring);
+    return true;
+}
+
+void Reactor::RunUring() {
+    if (!uring->Enable() || !uring->InitBuffers(kRecvBuffers, kRecvBufferSize, kRecvGroup)) {
+        EmitLog(onEvent, "Failed to start io_uring.");
+        return;
+    }
+    ArmAccept();
+    ArmWake();
+    while (running) {
+        int res = uring->Submit(1, NextTimeoutNs(NowNs()));
+        if (res < 0 && res != -EBUSY && res != -EAGAIN) {
+            EmitLog(onEvent, "io_uring_enter failed.");
+            break;
+        }
+        while (uring->ForEachCqe([this](const io_uring_cqe& cqe) { HandleCqe(cqe); }, kCqeBatch) == kCqeBatch) {
+            uring->PublishBuffers();
+            uring->Submit(0, 0);
+        }
+        uring->PublishBuffers();
+        ResumeInput();
+        FlushDue(NowNs());
+        for (int fd : closing) CloseConnection(fd);
+        closing.clear();
+        Count(uring->Syscalls() - uringSyscallsSeen);
+        uringSyscallsSeen = uring->Syscalls();
+    }
+}
+
+void Reactor::ArmAccept() {
+    io_uring_sqe* sqe = NextSqe(*uring);
+    if (!sqe) return;
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listenFd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = MakeKey(OpTag::Accept);
+}
+
+void Reactor::ArmWake() {
+    io_uring_sqe* sqe = NextSqe(*uring);
+    if (!sqe) return;
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = wakeFd;
+    sqe->addr = reinterpret_cast<uint64_t>(&wakeValue);
+    sqe->len = sizeof(wakeValue);
+    sqe->user_data = MakeKey(OpTag::Wake);
+}
+
+void Reactor::ArmRecv(Connection& conn) {
+    io_uring_sqe* sqe = NextSqe(*uring);
+    if (!sqe) {
+        closing.push_back(conn.fd);
+        return;
+    }
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn.fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = uring->BufferGroup();
+    sqe->user_data = MakeKey(OpTag::Recv, conn.fd, conn.id);
+    ++conn.recvs;
+}
+
+void Reactor::CancelRecv(Connection& conn) {
+    if (conn.recvs == 0) return;
+    io_uring_sqe* sqe = NextSqe(*uring);
+    if (!sqe) return;
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = MakeKey(OpTag::Recv, conn.fd, conn.id);
+    sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+    sqe->user_data = MakeKey(OpTag::Cancel);
+}
+
+void Reactor::SubmitSends(Connection& conn) {
+    if (conn.closed || conn.inflight) return;
+    if (conn.sendq.Empty()) {
+        if (conn.history.empty()) return;
+        if (!LoadHistory(conn)) {
+            conn.closed = true;
+            closing.push_back(conn.fd);
+            return;
+        }
+    }
+    io_uring_sqe* sqe = NextSqe(*uring);
+    if (!sqe) {
+        conn.flushScheduled = true;
+        flushQueue.push_back(PendingFlush{conn.fd, conn.id, 0});
+        return;
+    }
+    conn.sendIov.resize(kMaxSendIov);
+    conn.sendMsg = msghdr{};
+    conn.sendMsg.msg_iov = conn.sendIov.data();
+    conn.sendMsg.msg_iovlen = conn.sendq.Gather(conn.sendIov.data(), kMaxSendIov);
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = conn.fd;
+    sqe->addr = reinterpret_cast<uint64_t>(&conn.sendMsg);
+    sqe->len = 1;
+    // WAITALL makes the kernel retry short sends itself.
+    sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+    sqe->user_data = MakeKey(OpTag::Send, conn.fd, conn.id);
+    conn.inflight = static_cast<unsigned>(conn.sendMsg.msg_iovlen);
+}
+
+// Moves the next stretch of history into the empty send queue: frames in
+// memory as they are, file ranges read a chunk at a time and cut at a frame
+// boundary so live frames can follow. A frame bigger than the chunk goes out
+// whole. False if the segment file came up short.
+bool Reactor::LoadHistory(Connection& conn) {
+    HistoryRange& next = conn.history.front();
+    if (next.memory) {
+        stats.replayBytes.fetch_add(next.memory->size(), std::memory_order_relaxed);
+        conn.sendq.Push(std::move(next.memory));
+        conn.history.pop_front();
+        NoteQueue(conn);
+        return true;
+    }
+    StoreRange& range = next.file;
+    size_t want = static_cast<size_t>(range.length < kHistoryChunk ? range.length : kHistoryChunk);
+    std::string bytes(want, '\0');
+    Count();
+    if (pread(range.fd, &bytes[0], want, static_cast<off_t>(range.offset)) != static_cast<ssize_t>(want)) return false;
+    size_t whole = 0;
+    while (whole + kFrameHeaderSize <= want) {
+        size_t total = kFrameHeaderSize + ReadFrameHeader(&bytes[whole]).length;
+        if (whole + total <= want) {
+            whole += total;
+            continue;
+        }
+        if (whole || total > range.length) break;
+        bytes.resize(total);
+        Count();
+        if (pread(range.fd, &bytes[want], total - want, static_cast<off_t>(range.offset + want)) !=
+            static_cast<ssize_t>(total - want)) {
+            return false;
+        }
+        whole = total;
+    }
+    if (!whole) return false;
+    bytes.resize(whole);
+    range.offset += whole;
+    range.length -= whole;
+    if (!range.length) conn.history.pop_front();
+    stats.replayBytes.fetch_add(whole, std::memory_order_relaxed);
+    conn.sendq.Push(std::move(bytes));
+    NoteQueue(conn);
+    return true;
+}
+
+Connection* Reactor::FindByKey(uint64_t key) {
+    int fd = static_cast<int>((key >> 32) & 0xFFFFFF);
+    auto it = connections.find(fd);
+    if (it == connections.end()) return nullptr;
+    if (static_cast<uint32_t>(it->second->id) != static_cast<uint32_t>(key)) return nullptr;
+    return it->second.get();
+}
+
+void Reactor::HandleCqe(const io_uring_cqe& cqe) {
+    bool more = (cqe.flags & IORING_CQE_F_MORE) != 0;
+    switch (KeyTag(cqe.user_data)) {
+    case OpTag::Buffers:
+        // Only failed buffer returns post a completion.
+        EmitLog(onEvent, "io_uring buffer return failed: " + std::to_string(-cqe.res));
+        break;
+    case OpTag::Accept: {
+        if (cqe.res >= 0) {
+            sockaddr_in addr{};
+            socklen_t len = sizeof(addr);
+            Count();
+            getpeername(cqe.res, reinterpret_cast<sockaddr*>(&addr), &len);
+            ArmRecv(*AddConnection(cqe.res, addr, len));
+        } else if (cqe.res != -ECANCELED) {
+            EmitLog(onEvent, "Accept failed.");
+        }
+        if (!more && running) ArmAccept();
+        break;
+    }
+    case OpTag::Cancel:
+        // The recv may already have ended on its own; nothing to do either way.
+        break;
+    case OpTag::Wake:
+        wakePending.store(false, std::memory_order_release);
+        DrainMailbox();
+        if (running) ArmWake();
+        break;
+    case OpTag::Recv: {
+        Connection* conn = FindByKey(cqe.user_data);
+        if (cqe.flags & IORING_CQE_F_BUFFER) {
+            uint16_t bid = static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+            if (conn && cqe.res > 0) {
+                std::memcpy(conn->inbuf.Prepare(static_cast<size_t>(cqe.res)), uring->Buffer(bid),
+                            static_cast<size_t>(cqe.res));
+                conn->inbuf.Commit(static_cast<size_t>(cqe.res));
+            }
+            uring->RecycleBuffer(bid);
+        }
+        if (!conn) break;
+        if (!more) --conn->recvs;
+        if (cqe.res > 0) {
+            stats.bytesIn.fetch_add(static_cast<uint64_t>(cqe.res), std::memory_order_relaxed);
+            ProcessInput(*conn);
+        } else if (cqe.res != -ENOBUFS && cqe.res != -ECANCELED) {
+            closing.push_back(conn->fd);
+            break;
+        }
+        // ENOBUFS means every provided buffer was in use; they are back after
+        // this reap. ECANCELED is a backpressure pause, which may have been
+        // lifted again by now.
+        if (!more && conn->recvs == 0 && conn->pausedBy == 0) ArmRecv(*conn);
+        break;
+    }
+    case OpTag::Send: {
+        Connection* conn = FindByKey(cqe.user_data);
+        bool live = conn != nullptr;
+        if (!conn) {
+            auto it = draining.find(static_cast<uint32_t>(cqe.user_data));
+            if (it == draining.end()) break;
+            conn = it->second.get();
+        }
+        conn->inflight = 0;
+        if (cqe.res > 0) {
+            conn->sendq.Consume(static_cast<size_t>(cqe.res));
+            stats.bytesOut.fetch_add(static_cast<uint64_t>(cqe.res), std::memory_order_relaxed);
+            if (live) AfterSend(*conn);
+        } else if (live) {
+            conn->closed = true;
+            closing.push_back(conn->fd);
+        }
+        if (!live) {
+            draining.erase(static_cast<uint32_t>(cqe.user_data));
+        } else if (!conn->sendq.Empty() || !conn->history.empty()) {
+            SubmitSends(*conn);
+        }
+        break;
+    }
+    }
+}
+
+} // namespace chat
@@ -0,0 +1,52 @@
+#include "core/room_table.h"
+
+#include <algorithm>
+#include <functional>
+#include <mutex>
+
+namespace chat {
+
+bool RoomTable::Join(const std::string& room, Connection* conn) {
+    std::vector<Connection*>& subs = rooms[room];
+    auto it = std::lower_bound(subs.begin(), subs.end(), conn, std::less<Connection*>());
+    if (it != subs.end() && *it == conn) return false;
+    subs.insert(it, conn);
+    return true;
+}
+
+bool RoomTable::Leave(const std::string& room, Connection* conn) {
+    auto found = rooms.find(room);
+    if (found == rooms.end()) return false;
+    std::vector<Connection*>& subs = found->second;
+    auto it = std::lower_bound(subs.begin(), subs.end(), conn, std::less<Connection*>());
+    if (it == subs.end() || *it != conn) return false;
+    subs.erase(it);
+    if (subs.empty()) rooms.erase(found);
+    return true;
+}
+
+const std::vector<Connection*>* RoomTable::Subscribers(const std::string& room) const {
+    auto found = rooms.find(room);
+    return found == rooms.end() ? nullptr : &found->second;
+}
+
+void RoomShards::Add(const std::string& room, unsigned shard) {
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    masks[room] |= uint64_t(1) << shard;
+}
+
+void RoomShards::Remove(const std::string& room, unsigned shard) {
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    auto found = masks.find(room);
+    if (found == masks.end()) return;
+    found->second &= ~(uint64_t(1) << shard);
+    if (!found->second) masks.erase(found);
+}
+
+uint64_t RoomShards::Shards(const std::string& room) const {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    auto found = masks.find(room);
+    return found == masks.end() ? 0 : found->second;
+}
+
+} // namespace chat
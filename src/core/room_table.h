@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace chat {
+
+struct Connection;
+
+// One reactor's share of the routing table: room name to the connections of
+// that shard subscribed to it, kept as a flat vector sorted by address so
+// fan-out walks contiguous memory and a join or leave is one binary search.
+// Every shard holds its own, so lookups need no lock; a message published on
+// one shard reaches the others through their mailboxes.
+class RoomTable {
+public:
+    // False if `conn` was already in (or, for Leave, not in) the room.
+    bool Join(const std::string& room, Connection* conn);
+    bool Leave(const std::string& room, Connection* conn);
+    // Null when nobody on this shard is in the room.
+    const std::vector<Connection*>* Subscribers(const std::string& room) const;
+
+    size_t Rooms() const { return rooms.size(); }
+
+private:
+    std::unordered_map<std::string, std::vector<Connection*>> rooms;
+};
+
+// The shards with subscribers in each room, one bit per shard (hence at most
+// kMaxShards), so a room message is posted only to those. A shard sets its
+// bit on its first subscriber's Join and clears it on its last one's Leave.
+// Shared by every reactor; publishers only read it.
+class RoomShards {
+public:
+    static constexpr unsigned kMaxShards = 64;
+
+    void Add(const std::string& room, unsigned shard);
+    void Remove(const std::string& room, unsigned shard);
+    uint64_t Shards(const std::string& room) const;
+
+private:
+    mutable std::shared_mutex mutex;
+    std::unordered_map<std::string, uint64_t> masks;
+};
+
+} // namespace chat
@@ -0,0 +1,69 @@
+#include "core/send_queue.h"
+
+#include <sys/socket.h>
+
+#include <cerrno>
+#include <utility>
+
+namespace chat {
+
+constexpr size_t kMaxIov = 64;
+
+void SendQueue::Push(SharedFrame frame) {
+    if (!frame || frame->empty()) return;
+    bytes += frame->size();
+    frames.push_back(std::move(frame));
+}
+
+size_t SendQueue::Gather(iovec* iov, size_t max) const {
+    size_t n = 0;
+    for (auto it = frames.begin(); it != frames.end() && n < max; ++it, ++n) {
+        size_t skip = (n == 0) ? headOffset : 0;
+        iov[n].iov_base = const_cast<char*>((*it)->data() + skip);
+        iov[n].iov_len = (*it)->size() - skip;
+    }
+    return n;
+}
+
+void SendQueue::Consume(size_t n) {
+    bytes -= n;
+    while (n > 0 && !frames.empty()) {
+        size_t left = frames.front()->size() - headOffset;
+        if (n < left) {
+            headOffset += n;
+            return;
+        }
+        n -= left;
+        frames.pop_front();
+        headOffset = 0;
+    }
+}
+
+bool SendQueue::DropOldest(size_t pinned) {
+    if (headOffset > 0 && pinned == 0) pinned = 1;
+    if (frames.size() <= pinned) return false;
+    auto it = frames.begin() + static_cast<std::ptrdiff_t>(pinned);
+    bytes -= (*it)->size();
+    frames.erase(it);
+    return true;
+}
+
+FlushResult SendQueue::Flush(int fd) {
+    iovec iov[kMaxIov];
+    while (!frames.empty()) {
+        msghdr msg{};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = Gather(iov, kMaxIov);
+        ++syscalls;
+        ssize_t n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return FlushResult::Blocked;
+            return FlushResult::Error;
+        }
+        Consume(static_cast<size_t>(n));
+    }
+    return FlushResult::Done;
+}
+
+} // namespace chat
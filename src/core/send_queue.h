@@ -0,0 +1,45 @@
+#pragma once
+
+#include <sys/uio.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <utility>
+
+#include "core/frame.h"
+
+namespace chat {
+
+enum class FlushResult { Done, Blocked, Error };
+
+// Per-connection outbound queue of encoded frames. Flush() hands as many
+// queued frames as fit in one iovec array to a single sendmsg() call and
+// keeps track of partial writes, so a burst of N frames costs one syscall
+// instead of N. Frames are shared, not copied, so one broadcast frame can sit
+// in every recipient's queue at once.
+class SendQueue {
+public:
+    void Push(SharedFrame frame);
+    void Push(std::string frame) { Push(ShareFrame(std::move(frame))); }
+    size_t Gather(iovec* iov, size_t max) const;
+    void Consume(size_t bytes);
+    FlushResult Flush(int fd);
+    // Drops the oldest frame that has not started going out, keeping the
+    // first `pinned` frames (already handed to the kernel). False if none.
+    bool DropOldest(size_t pinned);
+
+    bool Empty() const { return frames.empty(); }
+    size_t Bytes() const { return bytes; }
+    size_t Frames() const { return frames.size(); }
+    uint64_t Syscalls() const { return syscalls; }
+
+private:
+    std::deque<SharedFrame> frames;
+    size_t headOffset{0};
+    size_t bytes{0};
+    uint64_t syscalls{0};
+};
+
+} // namespace chat
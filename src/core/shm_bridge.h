@@ -0,0 +1,99 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "core/chat_events.h"
+#include "core/send_queue.h"
+#include "core/shm_engine.h"
+#include "core/socket_engine.h"
+
+namespace chat {
+
+// A local shm channel and the name it goes by on the link. Two bridges pair
+// channels by wire name, so the local names may differ (which is what lets
+// both ends of a loopback test live on one machine).
+struct BridgeChannel {
+    std::string local;
+    std::string remote;
+};
+
+struct BridgeConfig {
+    // The server end listens for one peer bridge at a time; the client end
+    // connects to it and reconnects whenever the link drops.
+    Role role{Role::Server};
+    std::string host{"127.0.0.1"};
+    int port{54100};
+    std::vector<BridgeChannel> channels;
+    // Settings for every channel's engine; `channel` is filled in per entry.
+    ShmConfig shm;
+    // Outbound bytes buffered for the link before local readers wait on it.
+    size_t maxPendingBytes{4 * 1024 * 1024};
+};
+
+struct BridgeStats {
+    uint64_t recordsOut{0};
+    uint64_t bytesOut{0};
+    uint64_t syscalls{0};
+    uint64_t recordsIn{0};
+    // Local messages that arrived while no peer bridge was connected.
+    uint64_t dropped{0};
+};
+
+// Relays shm channels to a peer bridge on another host over one TCP
+// connection. Each channel is joined as an ordinary bus peer; every message
+// another local peer publishes goes out as a ChannelData frame and every
+// frame from the link is published locally, so the bridge's own records are
+// never sent back. Frames queue while a write is in flight and leave together
+// in as few sendmsg() calls as the iovec limit allows. Bridges must form a
+// tree: a cycle of links would relay messages forever.
+class ShmBridge {
+public:
+    explicit ShmBridge(EventCallback onEvent);
+    ~ShmBridge();
+    ShmBridge(const ShmBridge&) = delete;
+    ShmBridge& operator=(const ShmBridge&) = delete;
+
+    bool Start(const BridgeConfig& cfg);
+    void Stop();
+
+    bool Running() const { return running; }
+    BridgeStats Stats() const;
+
+private:
+    void LinkLoop();
+    void WriteLoop();
+    bool Listen();
+    int AcceptPeer();
+    int ConnectPeer(bool quiet);
+    void Serve(int fd);
+    void OnLocal(uint16_t channel, const ChatEvent& ev);
+
+    EventCallback onEvent;
+    BridgeConfig config;
+    std::atomic<bool> running{false};
+    std::vector<std::unique_ptr<ShmEngine>> engines;
+    int listenFd{-1};
+    std::thread linkThread;
+    std::thread writeThread;
+
+    // Guards everything below.
+    mutable std::mutex outMutex;
+    std::condition_variable outReady;
+    std::condition_variable outDrained;
+    int linkFd{-1};
+    bool writing{false};
+    SendQueue pending;
+    uint64_t pendingRecords{0};
+    uint64_t sendSeq{0};
+    BridgeStats stats;
+};
+
+} // namespace chat
@@ -0,0 +1,301 @@
+#include "core/shm_bridge.h"
+#include "core/frame.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <string_view>
+#include <utility>
+
+namespace chat {
+
+constexpr int kPollMs = 200;
+constexpr int kReconnectMs = 1000;
+// OnLocal blocks the channel engine's receive thread, which also keeps the
+// bridge's bus heartbeat going, so it waits for room on the link at most
+// this long before dropping the message.
+constexpr int kOutWaitMs = 2000;
+
+ShmBridge::ShmBridge(EventCallback onEvent) : onEvent(std::move(onEvent)) {}
+
+ShmBridge::~ShmBridge() {
+    Stop();
+}
+
+bool ShmBridge::Start(const BridgeConfig& cfg) {
+    if (running) {
+        EmitLog(onEvent, "Already running.");
+        return false;
+    }
+    config = cfg;
+    if (config.channels.empty()) {
+        EmitLog(onEvent, "No channels to bridge.");
+        return false;
+    }
+    if (config.channels.size() > UINT16_MAX) {
+        EmitLog(onEvent, "Too many channels to bridge.");
+        return false;
+    }
+    if (config.role == Role::Server && !Listen()) return false;
+
+    stats = BridgeStats{};
+    running = true;
+    for (size_t i = 0; i < config.channels.size(); ++i) {
+        ShmConfig shm = config.shm;
+        shm.channel = config.channels[i].local;
+        uint16_t id = static_cast<uint16_t>(i);
+        auto engine = std::make_unique<ShmEngine>([this, id](const ChatEvent& ev) { OnLocal(id, ev); });
+        if (!engine->Start(shm)) {
+            Stop();
+            return false;
+        }
+        engines.push_back(std::move(engine));
+    }
+    writeThread = std::thread(&ShmBridge::WriteLoop, this);
+    linkThread = std::thread(&ShmBridge::LinkLoop, this);
+    EmitStatus(onEvent, "Bridging " + std::to_string(engines.size()) +
+                            (engines.size() == 1 ? " channel " : " channels ") +
+                            (config.role == Role::Server ? "on port " + std::to_string(config.port)
+                                                         : "to " + config.host + ":" + std::to_string(config.port)));
+    return true;
+}
+
+void ShmBridge::Stop() {
+    bool wasRunning = running.exchange(false);
+    {
+        std::lock_guard<std::mutex> lock(outMutex);
+        if (linkFd >= 0) shutdown(linkFd, SHUT_RDWR);
+        outReady.notify_all();
+        outDrained.notify_all();
+    }
+    if (linkThread.joinable()) linkThread.join();
+    if (writeThread.joinable()) writeThread.join();
+    for (auto& engine : engines) engine->Stop();
+    engines.clear();
+    if (listenFd >= 0) {
+        close(listenFd);
+        listenFd = -1;
+    }
+    if (wasRunning) EmitStatus(onEvent, "Bridge offline");
+}
+
+BridgeStats ShmBridge::Stats() const {
+    std::lock_guard<std::mutex> lock(outMutex);
+    return stats;
+}
+
+bool ShmBridge::Listen() {
+    listenFd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, IPPROTO_TCP);
+    if (listenFd < 0) {
+        EmitLog(onEvent, "Failed to create socket.");
+        return false;
+    }
+    int yes = 1;
+    setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    sockaddr_in hint{};
+    hint.sin_family = AF_INET;
+    hint.sin_port = htons(static_cast<uint16_t>(config.port));
+    hint.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(listenFd, reinterpret_cast<sockaddr*>(&hint), sizeof(hint)) < 0 || listen(listenFd, 4) < 0) {
+        EmitLog(onEvent, "Bind failed. Is the port in use?");
+        close(listenFd);
+        listenFd = -1;
+        return false;
+    }
+    return true;
+}
+
+int ShmBridge::AcceptPeer() {
+    while (running) {
+        pollfd pfd{listenFd, POLLIN, 0};
+        if (poll(&pfd, 1, kPollMs) <= 0) continue;
+        int fd = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd >= 0) return fd;
+    }
+    return -1;
+}
+
+int ShmBridge::ConnectPeer(bool quiet) {
+    sockaddr_in hint{};
+    hint.sin_family = AF_INET;
+    hint.sin_port = htons(static_cast<uint16_t>(config.port));
+    if (inet_pton(AF_INET, config.host.c_str(), &hint.sin_addr) != 1) {
+        EmitLog(onEvent, "Invalid host address: " + config.host);
+        running = false;
+        return -1;
+    }
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, IPPROTO_TCP);
+    if (fd < 0) return -1;
+    if (!quiet) EmitLog(onEvent, "Connecting to " + config.host + ":" + std::to_string(config.port) + "...");
+    if (connect(fd, reinterpret_cast<sockaddr*>(&hint), sizeof(hint)) < 0) {
+        if (!quiet) EmitLog(onEvent, "Connect failed; retrying every " + std::to_string(kReconnectMs / 1000) + " s.");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+void ShmBridge::LinkLoop() {
+    bool quiet = false;
+    while (running) {
+        int fd = config.role == Role::Server ? AcceptPeer() : ConnectPeer(quiet);
+        if (fd < 0) {
+            // Only the first failure of an outage is worth a log line.
+            quiet = true;
+            for (int waited = 0; running && waited < kReconnectMs; waited += kPollMs) usleep(kPollMs * 1000);
+            continue;
+        }
+        quiet = false;
+        Serve(fd);
+    }
+}
+
+// Owns one link from handshake to teardown. The write side belongs to
+// WriteLoop(); this thread reads, and on the way out waits for any write in
+// flight before the descriptor is closed.
+void ShmBridge::Serve(int fd) {
+    int noDelay = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+    {
+        std::lock_guard<std::mutex> lock(outMutex);
+        pending = SendQueue();
+        pendingRecords = 0;
+        for (size_t i = 0; i < config.channels.size(); ++i) {
+            const std::string& name = config.channels[i].remote;
+            std::string frame;
+            AppendFrame(frame, FrameType::ChannelOpen, static_cast<uint16_t>(i), 0, name.data(), name.size());
+            pending.Push(std::move(frame));
+        }
+        linkFd = fd;
+        outReady.notify_all();
+    }
+    EmitLog(onEvent, "Peer bridge connected.");
+    EmitConnected(onEvent, 0, true);
+
+    // Remote channel id -> index into `engines`, or -1 if not bridged here.
+    std::vector<int> route;
+    RecvBuffer inbuf(64 * 1024);
+    FrameDecoder decoder(inbuf);
+    while (running) {
+        pollfd pfd{fd, POLLIN, 0};
+        int ready = poll(&pfd, 1, kPollMs);
+        if (ready < 0 && errno != EINTR) break;
+        if (ready <= 0) continue;
+        size_t want = decoder.Missing() > 4096 ? decoder.Missing() : 4096;
+        char* dst = inbuf.Prepare(want);
+        ssize_t res = recv(fd, dst, inbuf.Writable(), 0);
+        if (res < 0 && errno == EINTR) continue;
+        if (res <= 0) break;
+        inbuf.Commit(static_cast<size_t>(res));
+
+        FrameView frame;
+        DecodeResult result;
+        while ((result = decoder.Next(frame)) == DecodeResult::Frame) {
+            uint16_t id = frame.header.flags;
+            if (frame.header.type == FrameType::ChannelOpen) {
+                std::string name(frame.payload, frame.header.length);
+                if (route.size() <= id) route.resize(size_t(id) + 1, -1);
+                route[id] = -1;
+                for (size_t i = 0; i < config.channels.size(); ++i) {
+                    if (config.channels[i].remote == name) route[id] = static_cast<int>(i);
+                }
+                if (route[id] < 0) {
+                    EmitLog(onEvent, "[!] Peer bridge offers channel \"" + name + "\", which is not bridged here.");
+                } else {
+                    EmitLog(onEvent, "Bridging channel \"" + name + "\".");
+                }
+            } else if (frame.header.type == FrameType::ChannelData) {
+                if (id >= route.size() || route[id] < 0) continue;
+                engines[static_cast<size_t>(route[id])]->Send(std::string(frame.payload, frame.header.length));
+                std::lock_guard<std::mutex> lock(outMutex);
+                ++stats.recordsIn;
+            }
+        }
+        if (result == DecodeResult::Error) {
+            EmitLog(onEvent, "[!] Protocol error from peer bridge.");
+            break;
+        }
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(outMutex);
+        linkFd = -1;
+        shutdown(fd, SHUT_RDWR);
+        outDrained.wait(lock, [this] { return !writing; });
+        stats.dropped += pendingRecords;
+        pending = SendQueue();
+        pendingRecords = 0;
+        outDrained.notify_all();
+    }
+    close(fd);
+    if (running) EmitLog(onEvent, "[!] Peer bridge disconnected.");
+    EmitConnected(onEvent, 0, false);
+}
+
+// Takes whatever queued up during the previous write and sends it in one go:
+// the busier the channels, the more records share each syscall.
+void ShmBridge::WriteLoop() {
+    std::unique_lock<std::mutex> lock(outMutex);
+    while (running) {
+        outReady.wait(lock, [this] { return !running || (linkFd >= 0 && !pending.Empty()); });
+        if (!running) break;
+        SendQueue batch = std::move(pending);
+        pending = SendQueue();
+        uint64_t records = pendingRecords;
+        pendingRecords = 0;
+        size_t bytes = batch.Bytes();
+        int fd = linkFd;
+        writing = true;
+        outDrained.notify_all();
+        lock.unlock();
+
+        FlushResult result = batch.Flush(fd);
+
+        lock.lock();
+        writing = false;
+        stats.syscalls += batch.Syscalls();
+        if (result == FlushResult::Done) {
+            stats.recordsOut += records;
+            stats.bytesOut += bytes;
+        } else {
+            // The reader notices the dead link and tears it down.
+            stats.dropped += records;
+            shutdown(fd, SHUT_RDWR);
+        }
+        outDrained.notify_all();
+    }
+}
+
+// Runs on the channel engine's receive thread. A brief wait for room rides
+// out a burst; a link that stays slow loses messages here (stats.dropped)
+// rather than stalling the receive thread and with it the heartbeat.
+void ShmBridge::OnLocal(uint16_t channel, const ChatEvent& ev) {
+    if (ev.type == EventType::Log || ev.type == EventType::Status) {
+        EmitLog(onEvent, "[" + config.channels[channel].local + "] " + ev.text);
+        return;
+    }
+    if (ev.type != EventType::Message) return;
+    std::string_view body = ev.Body();
+    std::unique_lock<std::mutex> lock(outMutex);
+    bool room = outDrained.wait_for(lock, std::chrono::milliseconds(kOutWaitMs), [this] {
+        return !running || linkFd < 0 || pending.Bytes() < config.maxPendingBytes;
+    });
+    if (!room || !running || linkFd < 0) {
+        ++stats.dropped;
+        return;
+    }
+    std::string frame;
+    AppendFrame(frame, FrameType::ChannelData, channel, ++sendSeq, body.data(), body.size());
+    bool wake = pending.Empty();
+    pending.Push(std::move(frame));
+    ++pendingRecords;
+    if (wake) outReady.notify_one();
+}
+
+} // namespace chat
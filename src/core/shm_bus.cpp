@@ -0,0 +1,221 @@
+#include "core/shm_bus.h"
+
+#include <cstring>
+#include <thread>
+
+namespace chat {
+
+static size_t RecordSize(size_t len) {
+    return (sizeof(BusRecord) + len + sizeof(BusRecord) - 1) & ~(sizeof(BusRecord) - 1);
+}
+
+bool BusPeer::Join(ShmBus* target, int32_t pid, uint64_t nowMs) {
+    for (uint32_t i = 0; i < kMaxBusPeers; ++i) {
+        BusPeerSlot& slot = target->peers[i];
+        uint64_t expected = slot.tag.load(std::memory_order_acquire);
+        if (PeerTagState(expected) != kPeerFree) continue;
+        // Publish a cursor before the row turns active so a writer never sees
+        // a stale one, then move it to the end of the log: writers that
+        // scanned the table before we appeared only protected bytes up to
+        // the commit they saw, which is no later than the one read here. A
+        // fresh heartbeat keeps survivors off the row until the pid is set.
+        slot.cursor.store(target->commit.load(std::memory_order_seq_cst), std::memory_order_relaxed);
+        slot.heartbeatMs.store(nowMs, std::memory_order_relaxed);
+        uint64_t claimed = MakePeerTag(PeerTagGeneration(expected) + 1, kPeerActive);
+        if (!slot.tag.compare_exchange_strong(expected, claimed, std::memory_order_seq_cst)) continue;
+        slot.pendingStart.store(kNoReservation, std::memory_order_relaxed);
+        slot.heartbeatMs.store(nowMs, std::memory_order_relaxed);
+        slot.pid.store(pid, std::memory_order_release);
+        uint64_t start = target->commit.load(std::memory_order_seq_cst);
+        slot.cursor.store(start, std::memory_order_release);
+        bus = target;
+        id = i;
+        tag = claimed;
+        cursor = start;
+        cachedCommit = start;
+        cachedMin = start;
+        lostSeen = bus->lost.load(std::memory_order_relaxed);
+        bus->membership.fetch_add(1, std::memory_order_release);
+        return true;
+    }
+    return false;
+}
+
+void BusPeer::Leave() {
+    if (!bus) return;
+    BusPeerSlot& slot = bus->peers[id];
+    uint64_t expected = tag;
+    // An evicted peer no longer owns its row; whoever does now keeps it.
+    if (slot.tag.compare_exchange_strong(expected, MakePeerTag(Generation(), kPeerFree), std::memory_order_acq_rel)) {
+        slot.pid.store(0, std::memory_order_relaxed);
+        bus->membership.fetch_add(1, std::memory_order_release);
+    }
+    bus = nullptr;
+}
+
+uint64_t BusPeer::MinCursor() const {
+    uint64_t low = bus->commit.load(std::memory_order_seq_cst);
+    for (const BusPeerSlot& slot : bus->peers) {
+        if (PeerTagState(slot.tag.load(std::memory_order_seq_cst)) != kPeerActive) continue;
+        uint64_t c = slot.cursor.load(std::memory_order_acquire);
+        if (c < low) low = c;
+    }
+    return low;
+}
+
+PushResult BusPeer::Publish(const char* data, size_t len, uint32_t tick, uint32_t flags, uint64_t* end,
+                            CommitHook* hook) {
+    if (Evicted()) return PushResult::Lost;
+    if (len > kMaxBusRecord) len = kMaxBusRecord;
+    size_t size = RecordSize(len);
+    BusPeerSlot& self = bus->peers[id];
+    uint64_t start = bus->reserve.load(std::memory_order_relaxed);
+    size_t pos, pad;
+    for (;;) {
+        pos = static_cast<size_t>(start & (kBusBytes - 1));
+        pad = (kBusBytes - pos < size) ? kBusBytes - pos : 0;
+        uint64_t stop = start + pad + size;
+        if (stop - cachedMin.load(std::memory_order_relaxed) > kBusBytes) {
+            cachedMin.store(MinCursor(), std::memory_order_relaxed);
+            if (stop - cachedMin.load(std::memory_order_relaxed) > kBusBytes) return PushResult::Full;
+        }
+        self.pendingEnd.store(stop, std::memory_order_relaxed);
+        self.pendingStart.store(start, std::memory_order_release);
+        if (bus->reserve.compare_exchange_weak(start, stop, std::memory_order_acq_rel)) break;
+    }
+
+    char* base = bus->data;
+    if (pad) {
+        BusRecord marker{kPadRecord, 0, id, 0};
+        std::memcpy(base + pos, &marker, sizeof(marker));
+        pos = 0;
+    }
+    BusRecord header{static_cast<uint32_t>(len), tick, id, flags};
+    std::memcpy(base + pos, &header, sizeof(header));
+    std::memcpy(base + pos + sizeof(header), data, len);
+
+    // Commits go out in reservation order; earlier writers are mid-memcpy.
+    // A commit already past our start means a survivor took us for dead and
+    // wrote the reservation off; the row is no longer ours to touch.
+    for (unsigned spins = 0;; ++spins) {
+        uint64_t committed = bus->commit.load(std::memory_order_acquire);
+        if (committed == start) break;
+        if (committed > start) return PushResult::Lost;
+        if (spins > 64) std::this_thread::yield();
+    }
+    if (hook) hook->BeforeCommit(start + pad + size);
+    bus->commit.store(start + pad + size, std::memory_order_release);
+    self.pendingStart.store(kNoReservation, std::memory_order_release);
+    if (end) *end = start + pad + size;
+    return PushResult::Ok;
+}
+
+bool BusPeer::Poll(BusMessage& out) {
+    if (Evicted()) return false;
+    for (;;) {
+        if (cursor >= cachedCommit) {
+            cachedCommit = bus->commit.load(std::memory_order_acquire);
+            if (cursor >= cachedCommit) return false;
+        }
+        size_t pos = static_cast<size_t>(cursor & (kBusBytes - 1));
+        BusRecord header;
+        std::memcpy(&header, bus->data + pos, sizeof(header));
+        // Commits land on record boundaries, so a whole record never runs
+        // past the committed end.
+        uint64_t next = header.length == kPadRecord ? cursor + (kBusBytes - pos)
+                        : header.length <= kMaxBusRecord ? cursor + RecordSize(header.length)
+                                                         : cachedCommit + 1;
+        if (next > cachedCommit) {
+            skipped += cachedCommit - cursor;
+            cursor = cachedCommit;
+            continue;
+        }
+        if (header.length == kPadRecord) {
+            cursor = next;
+            continue;
+        }
+        size_t len = header.length;
+        bool skip = header.sender == id || (header.flags & kRecordVoid);
+        if (!skip) {
+            out.sender = header.sender;
+            out.tick = header.tick;
+            out.flags = header.flags;
+            out.text.assign(bus->data + pos + sizeof(header), len);
+        }
+        cursor = next;
+        if (!skip) return true;
+    }
+}
+
+void BusPeer::Consume() {
+    // An evicted peer's row may belong to someone else by now.
+    if (!Evicted()) bus->peers[id].cursor.store(cursor, std::memory_order_release);
+}
+
+uint64_t BusPeer::TakeLost() {
+    uint64_t now = bus->lost.load(std::memory_order_relaxed);
+    uint64_t delta = now - lostSeen;
+    lostSeen = now;
+    return delta;
+}
+
+uint64_t BusPeer::TakeSkipped() {
+    uint64_t n = skipped;
+    skipped = 0;
+    return n;
+}
+
+uint64_t BusPeer::ActivePeers() const {
+    uint64_t mask = 0;
+    for (uint32_t i = 0; i < kMaxBusPeers; ++i) {
+        if (PeerTagState(bus->peers[i].tag.load(std::memory_order_acquire)) == kPeerActive) mask |= uint64_t(1) << i;
+    }
+    return mask;
+}
+
+bool ReservationPending(const ShmBus& bus, uint32_t slot) {
+    uint64_t start = bus.peers[slot].pendingStart.load(std::memory_order_acquire);
+    if (start == kNoReservation) return false;
+    // If `reserve` never moved past `start` the peer's CAS did not land.
+    return bus.reserve.load(std::memory_order_acquire) > start && bus.commit.load(std::memory_order_acquire) <= start;
+}
+
+bool FinishReservation(ShmBus& bus, uint32_t slot) {
+    BusPeerSlot& peer = bus.peers[slot];
+    uint64_t start = peer.pendingStart.load(std::memory_order_acquire);
+    uint64_t stop = peer.pendingEnd.load(std::memory_order_acquire);
+    if (start == kNoReservation || bus.commit.load(std::memory_order_acquire) != start) return false;
+    if (bus.reserve.load(std::memory_order_acquire) < stop) return false;
+
+    // Same shape Publish() would have laid down: a pad to the end of the
+    // buffer if the reservation wrapped, then one record covering the rest.
+    size_t pos = static_cast<size_t>(start & (kBusBytes - 1));
+    uint64_t size = stop - start;
+    if (pos + size > kBusBytes) {
+        BusRecord marker{kPadRecord, 0, slot, 0};
+        std::memcpy(bus.data + pos, &marker, sizeof(marker));
+        size -= kBusBytes - pos;
+        pos = 0;
+    }
+    BusRecord filler{static_cast<uint32_t>(size - sizeof(BusRecord)), 0, slot, kRecordVoid};
+    std::memcpy(bus.data + pos, &filler, sizeof(filler));
+    if (!bus.commit.compare_exchange_strong(start, stop, std::memory_order_acq_rel)) return false;
+    peer.pendingStart.store(kNoReservation, std::memory_order_release);
+    return true;
+}
+
+bool ClaimPeer(ShmBus& bus, uint32_t slot, uint64_t tag) {
+    if (PeerTagState(tag) != kPeerActive) return false;
+    return bus.peers[slot].tag.compare_exchange_strong(tag, MakePeerTag(PeerTagGeneration(tag), kPeerReaping),
+                                                       std::memory_order_acq_rel);
+}
+
+void FreePeer(ShmBus& bus, uint32_t slot) {
+    BusPeerSlot& peer = bus.peers[slot];
+    uint64_t tag = peer.tag.load(std::memory_order_acquire);
+    peer.pid.store(0, std::memory_order_relaxed);
+    peer.tag.store(MakePeerTag(PeerTagGeneration(tag), kPeerFree), std::memory_order_release);
+    bus.membership.fetch_add(1, std::memory_order_release);
+}
+
+} // namespace chat
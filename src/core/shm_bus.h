@@ -0,0 +1,175 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "core/shm_ring.h"
+
+namespace chat {
+
+constexpr size_t kBusBytes = 1024 * 1024;
+constexpr size_t kMaxBusRecord = kBusBytes / 4;
+constexpr uint32_t kMaxBusPeers = 64;
+
+static_assert((kBusBytes & (kBusBytes - 1)) == 0, "bus size must be a power of two");
+
+// Records are 16-byte aligned: this header, then `length` bytes of UTF-8.
+// A header with length == kPadRecord covers the unused end of the buffer
+// before a wrap.
+struct BusRecord {
+    uint32_t length;
+    uint32_t tick;
+    uint32_t sender;
+    uint32_t flags;
+};
+
+// The record's payload is a SlabHandle (shm_slab.h), not the text itself.
+constexpr uint32_t kRecordSlab = 1;
+// Filler written over a reservation whose writer died; readers skip it.
+constexpr uint32_t kRecordVoid = 2;
+
+// A row being reclaimed from a dead peer is neither free nor active.
+enum BusPeerState : uint32_t { kPeerFree = 0, kPeerActive = 1, kPeerReaping = 2 };
+
+// A row's tag is its state plus a generation bumped by every join, so a
+// survivor can tell a restarted peer from the one it presumed dead.
+inline uint64_t MakePeerTag(uint32_t generation, uint32_t state) {
+    return (uint64_t(generation) << 32) | state;
+}
+inline uint32_t PeerTagState(uint64_t tag) { return static_cast<uint32_t>(tag); }
+inline uint32_t PeerTagGeneration(uint64_t tag) { return static_cast<uint32_t>(tag >> 32); }
+
+constexpr uint64_t kNoReservation = ~uint64_t(0);
+
+// One row of the peer table: the byte offset the peer has consumed up to and
+// enough about the process behind it for the others to notice it dying.
+// `pendingStart`/`pendingEnd` describe the reservation the peer is trying to
+// take, written before each attempt, so a survivor can commit past it if the
+// peer dies before committing. `heartbeatMs` is CLOCK_MONOTONIC time.
+struct BusPeerSlot {
+    alignas(kCounterAlign) std::atomic<uint64_t> cursor;
+    std::atomic<uint64_t> pendingStart;
+    std::atomic<uint64_t> pendingEnd;
+    std::atomic<uint64_t> tag;
+    std::atomic<uint64_t> heartbeatMs;
+    std::atomic<int32_t> pid;
+};
+
+// Broadcast log shared by every process attached to a channel. Any peer may
+// publish: it claims space by CAS on `reserve`, writes its record, then
+// advances `commit` once every earlier reservation has committed, so readers
+// only ever see whole records in order. Each peer reads the whole log from
+// its own cursor in `peers`; a writer may not reuse bytes until every active
+// cursor has passed them, so nobody misses a message. A peer that dies keeps
+// its row, and so holds every writer back, until a survivor reclaims it.
+struct ShmBus {
+    alignas(kCounterAlign) std::atomic<uint64_t> reserve;
+    alignas(kCounterAlign) std::atomic<uint64_t> commit;
+    // Messages publishers could not place because the log was full.
+    alignas(kCounterAlign) std::atomic<uint64_t> lost;
+    // Futex word a publisher bumps to wake parked readers, and a counter
+    // bumped on every join and leave; both written by publishers/joiners.
+    alignas(kCounterAlign) std::atomic<uint32_t> doorbell;
+    std::atomic<uint32_t> membership;
+    // Readers currently parked on the doorbell; written by readers.
+    alignas(kCounterAlign) std::atomic<uint32_t> sleepers;
+    BusPeerSlot peers[kMaxBusPeers];
+    alignas(kCounterAlign) char data[kBusBytes];
+};
+
+struct BusMessage {
+    uint32_t sender{0};
+    uint32_t tick{0};
+    uint32_t flags{0};
+    std::string text;
+};
+
+// Runs inside Publish() once the record is written and every earlier record
+// has committed, just before this one commits. Hooks therefore run one at a
+// time across every process on the bus, in log order, and anything they do
+// is visible before a reader can see the record.
+class CommitHook {
+public:
+    virtual void BeforeCommit(uint64_t end) = 0;
+
+protected:
+    ~CommitHook() = default;
+};
+
+// One process's membership of a bus: a claimed row in the peer table plus
+// the reader and writer state that goes with it. Publish() may be called
+// from any thread; Poll() from one.
+class BusPeer {
+public:
+    // Claims a free row for process `pid`, starting at the current end of
+    // the log. False if the table is full.
+    bool Join(ShmBus* target, int32_t pid, uint64_t nowMs);
+    void Leave();
+    bool Joined() const { return bus != nullptr; }
+    uint32_t Id() const { return id; }
+    // Log offset this peer has read up to.
+    uint64_t Position() const { return cursor; }
+    uint32_t Generation() const { return PeerTagGeneration(tag); }
+    void Heartbeat(uint64_t nowMs) { bus->peers[id].heartbeatMs.store(nowMs, std::memory_order_release); }
+    // True once another peer has presumed this one dead and taken its row;
+    // the caller should Leave() and Join() again.
+    bool Evicted() const { return bus->peers[id].tag.load(std::memory_order_acquire) != tag; }
+
+    // On success `end` (if given) is the log offset just past the record.
+    // Lost if this peer was evicted first, or while waiting to commit (a
+    // survivor then filled the reservation in and committed past it).
+    PushResult Publish(const char* data, size_t len, uint32_t tick, uint32_t flags = 0, uint64_t* end = nullptr,
+                       CommitHook* hook = nullptr);
+    void NoteLost() { bus->lost.fetch_add(1, std::memory_order_relaxed); }
+    // Next record from another peer; this peer's own records and void
+    // fillers are skipped.
+    // Records stay reserved for this peer until Consume() publishes the new
+    // cursor, so anything they point at can be claimed first. Nothing is
+    // read once this peer has been evicted, and a header that would carry
+    // the cursor past the committed end (overwritten under a reader that
+    // fell behind) skips it to that end instead; TakeSkipped() counts those.
+    bool Poll(BusMessage& out);
+    void Consume();
+    // Whether the log has records past this peer's cursor (including its
+    // own, which Poll() skips).
+    bool Pending() const { return bus->commit.load(std::memory_order_acquire) != cursor; }
+    uint64_t TakeLost();
+    uint64_t TakeSkipped();
+    // Bit i set if row i is in use.
+    uint64_t ActivePeers() const;
+    uint32_t PeerGeneration(uint32_t slot) const {
+        return PeerTagGeneration(bus->peers[slot].tag.load(std::memory_order_acquire));
+    }
+    uint32_t Membership() const { return bus->membership.load(std::memory_order_acquire); }
+    // Lowest cursor of any active peer: every byte before it has been read.
+    uint64_t MinCursor() const;
+
+private:
+    ShmBus* bus{nullptr};
+    uint32_t id{0};
+    uint64_t tag{0};
+    uint64_t cursor{0};
+    uint64_t cachedCommit{0};
+    std::atomic<uint64_t> cachedMin{0};
+    uint64_t lostSeen{0};
+    uint64_t skipped{0};
+};
+
+// Recovery from peers that died holding a row. Deciding that a peer is dead
+// is up to the caller; these only keep the log consistent while its row is
+// taken back.
+//
+// Whether `slot` reserved space the log has not committed past yet.
+bool ReservationPending(const ShmBus& bus, uint32_t slot);
+// Commits past the reservation `slot` was taking, filling it with a void
+// record, if the log is stuck at its start. Only safe once its writer is
+// known to be gone.
+bool FinishReservation(ShmBus& bus, uint32_t slot);
+// Moves a row still tagged `tag` to kPeerReaping so exactly one survivor
+// cleans up after it; FreePeer() then hands the row back to joiners.
+bool ClaimPeer(ShmBus& bus, uint32_t slot, uint64_t tag);
+void FreePeer(ShmBus& bus, uint32_t slot);
+
+} // namespace chat
@@ -0,0 +1,155 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "core/chat_events.h"
+#include "core/shm_bus.h"
+#include "core/shm_journal.h"
+#include "core/shm_slab.h"
+
+namespace chat {
+
+// What Send() does when the slowest peer has not caught up and the log is
+// full.
+enum class FullPolicy { Block, Fail };
+
+// How a receiver waits for the next message. BusyPoll spins on the log and
+// never sleeps (lowest latency, one core per receiver); Hybrid spins briefly,
+// then yields, then parks on a futex; Blocking parks straight away and costs
+// nothing while the channel is idle.
+enum class WaitMode { BusyPoll, Hybrid, Blocking };
+
+// Bump kShmLayoutVersion whenever SharedRegion or anything inside it changes
+// shape; a build that finds a different version or size refuses to attach.
+constexpr uint32_t kShmMagic = 0x4D485343; // "CSHM"
+constexpr uint32_t kShmLayoutVersion = 5;
+
+struct RegionHeader {
+    // Written last by the creator, once the rest of the header is valid.
+    std::atomic<uint32_t> magic;
+    uint32_t version;
+    uint64_t regionBytes;
+    uint64_t busBytes;
+    uint32_t maxPeers;
+    // Pid of the process initialising the region; a joiner that finds it dead
+    // with `magic` still unset takes the initialisation over.
+    std::atomic<int32_t> creator;
+    // Differs every time the region is initialised; journal records carry it
+    // to tell this bus's offsets from those of an earlier one.
+    uint64_t incarnation;
+};
+
+struct SharedRegion {
+    RegionHeader header;
+    std::atomic<int32_t> attached;
+    ShmBus bus;
+};
+
+struct ShmConfig {
+    std::string channel{"demo"};
+    FullPolicy whenFull{FullPolicy::Block};
+    WaitMode wait{WaitMode::Hybrid};
+    // Longest message copied into the log itself (capped at kMaxBusRecord).
+    // Longer ones go through the slab, or are truncated if there is none.
+    size_t maxMessageBytes{16 * 1024};
+    // Size of the channel's slab mapping for large payloads, used by
+    // whichever peer creates it; 0 sends nothing through a slab.
+    size_t slabBytes{64 * 1024 * 1024};
+    // Directory on a hugetlbfs mount (e.g. /dev/hugepages) to back the
+    // region with 2 MiB pages; empty uses ordinary POSIX shared memory.
+    std::string hugePageDir;
+    // Fault the whole region in at attach instead of on first touch.
+    bool prefault{true};
+    // Optional on-disk history of the channel (see shm_journal.h).
+    JournalConfig journal;
+};
+
+struct ShmHandles;
+struct SlabMapping;
+
+// A slab block being filled by the sender; see ShmEngine::Allocate().
+struct ShmBuffer {
+    char* data{nullptr};
+    size_t capacity{0};
+    SlabHandle handle{};
+};
+
+// Headless shared-memory chat between up to kMaxBusPeers local processes
+// attached to the same channel name. Every message goes into one broadcast
+// log (see shm_bus.h) that each peer reads at its own pace; nothing is
+// overwritten before every peer has consumed it. Peers can join and leave at
+// any time and are reported through Connected/Disconnected events. Text is
+// UTF-8. Messages longer than ShmConfig::maxMessageBytes are written once
+// into a block of the channel's slab and only a handle goes through the log;
+// receivers get them in place (ChatEvent::payload). Each engine keeps a
+// heartbeat in its row of the peer table and reclaims the rows, pending
+// reservations and slab blocks of peers whose process has exited or whose
+// heartbeat has stopped, so a crashed peer never wedges the channel. With a
+// journal configured every message is also appended to memory-mapped segment
+// files, and a joining peer first receives that history in place.
+class ShmEngine {
+public:
+    explicit ShmEngine(EventCallback onEvent);
+    ~ShmEngine();
+    ShmEngine(const ShmEngine&) = delete;
+    ShmEngine& operator=(const ShmEngine&) = delete;
+
+    bool Start(const ShmConfig& cfg);
+    void Stop();
+    bool Send(const std::string& text);
+    // Zero-copy path for large payloads: fill `out.data` (up to
+    // `out.capacity` bytes) and hand it to SendBuffer(), which publishes the
+    // first `size` bytes. False if there is no slab or no free block.
+    bool Allocate(size_t size, ShmBuffer& out);
+    bool SendBuffer(ShmBuffer& buf, size_t size);
+
+    bool Running() const { return running; }
+    // 1-based row in the channel's peer table; this is the peerId other
+    // engines report for messages and joins from this one.
+    uint64_t PeerId() const { return member.Id() + 1; }
+    // Messages this side failed to send because the ring stayed full.
+    uint64_t Dropped() const { return dropped; }
+    // Messages sent but not journaled: larger than a segment, or no space.
+    uint64_t Unjournaled() const { return unjournaled; }
+
+private:
+    void ReceiveLoop();
+    void CloseHandles();
+    void WaitForMessages();
+    void RingDoorbell(bool force);
+    void ReportPeers();
+    void CheckIn(uint64_t now);
+    void Sweep(uint64_t now);
+    bool PublishRecord(const char* data, size_t len, uint32_t flags, uint64_t* end, const char* body, size_t bodyLen);
+    void DeliverSlab(const BusMessage& msg);
+    std::shared_ptr<SlabMapping> LoadSlab(bool map);
+    void ReplayHistory();
+
+    EventCallback onEvent;
+    ShmConfig config;
+    std::atomic<bool> running{false};
+    ShmHandles* handles{nullptr};
+    SharedRegion* region{nullptr};
+    std::thread recvThread;
+    BusPeer member;
+    // Read and swapped only through LoadSlab() and std::atomic_store.
+    std::shared_ptr<SlabMapping> slab;
+    std::unique_ptr<JournalWriter> journal;
+    uint64_t peersSeen{0};
+    uint32_t generationsSeen[kMaxBusPeers]{};
+    uint32_t membershipSeen{0};
+    uint64_t lastBeat{0};
+    uint64_t lastSweep{0};
+    uint64_t stallCommit{0};
+    uint64_t stallSince{0};
+    std::atomic<uint64_t> dropped{0};
+    std::atomic<uint64_t> unjournaled{0};
+    std::mutex sendMutex;
+};
+
+} // namespace chat
@@ -0,0 +1,654 @@
+#include "core/shm_engine.h"
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <thread>
+#include <utility>
+
+namespace chat {
+
+// The region is a POSIX shared memory object, or a file on hugetlbfs when
+// ShmConfig::hugePageDir is set; `mapPath` is whichever name it has. The
+// slab for large payloads sits next to it under `slabPath`.
+struct ShmHandles {
+    std::string mapPath;
+    std::string slabPath;
+    bool hugetlb{false};
+    size_t mappedBytes{0};
+};
+
+// Outstanding in-place payloads keep the slab mapped after Stop().
+struct SlabMapping {
+    char* addr{nullptr};
+    size_t bytes{0};
+    Slab slab;
+
+    ~SlabMapping() {
+        if (addr) munmap(addr, bytes);
+    }
+};
+
+constexpr size_t kHugePageBytes = 2 * 1024 * 1024;
+
+// Hybrid receivers spin this many times on the log, then yield this many
+// times, before parking on the doorbell.
+constexpr unsigned kSpinLimit = 4096;
+constexpr unsigned kYieldLimit = 64;
+// BusyPoll receivers come up for air after this many spins.
+constexpr unsigned kBusySpinLimit = 1u << 20;
+// A parked receiver wakes at least this often to notice peers that went away.
+constexpr long kParkTimeoutNs = 1000 * 1000000L;
+
+// Receivers refresh their heartbeat every kHeartbeatMs and look for dead
+// peers every kSweepMs. A peer is dead once its pid is gone. A row whose pid
+// is not set yet goes once its heartbeat is kPeerTimeoutMs old; one whose
+// process is still there only after kHungPeerMs without a heartbeat (a hung
+// process, or a reused pid), since taking the row from a live process costs
+// it whatever it was writing. A dead writer's reservation is only filled in
+// once the log has sat stuck at it for kStallMs, which a live writer never
+// takes to commit.
+constexpr uint64_t kHeartbeatMs = 250;
+constexpr uint64_t kSweepMs = 1000;
+constexpr uint64_t kPeerTimeoutMs = 10 * 1000;
+constexpr uint64_t kHungPeerMs = 5 * 60 * 1000;
+constexpr uint64_t kStallMs = 200;
+
+static inline void CpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+// The region is shared between processes, so these are not FUTEX_PRIVATE.
+static void FutexWait(std::atomic<uint32_t>& word, uint32_t expected, long timeoutNs) {
+    timespec ts{timeoutNs / 1000000000L, timeoutNs % 1000000000L};
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT, expected, &ts, nullptr, 0);
+}
+
+static void FutexWake(std::atomic<uint32_t>& word) {
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+
+// CLOCK_MONOTONIC is system-wide, so heartbeats compare across processes.
+static uint64_t NowMs() {
+    timespec ts{};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000 + static_cast<uint64_t>(ts.tv_nsec / 1000000);
+}
+
+static uint32_t TickMs() {
+    return static_cast<uint32_t>(NowMs());
+}
+
+static bool ProcessAlive(int32_t pid) {
+    return kill(pid, 0) == 0 || errno != ESRCH;
+}
+
+static bool PeerAlive(const BusPeerSlot& slot, uint64_t now) {
+    // A joiner sets its pid just after claiming the row; until then only
+    // the heartbeat it wrote first speaks for it.
+    int32_t pid = slot.pid.load(std::memory_order_acquire);
+    if (pid > 0 && !ProcessAlive(pid)) return false;
+    uint64_t beat = slot.heartbeatMs.load(std::memory_order_acquire);
+    return beat >= now || now - beat < (pid > 0 ? kHungPeerMs : kPeerTimeoutMs);
+}
+
+static size_t Utf8Prefix(const std::string& text, size_t maxBytes) {
+    if (text.size() <= maxBytes) return text.size();
+    size_t n = maxBytes;
+    while (n > 0 && (static_cast<unsigned char>(text[n]) & 0xC0) == 0x80) --n;
+    return n;
+}
+
+static int OpenRegion(const ShmHandles& h, const std::string& path, int flags) {
+    return h.hugetlb ? open(path.c_str(), flags, 0600) : shm_open(path.c_str(), flags, 0600);
+}
+
+static void UnlinkRegion(const ShmHandles& h, const std::string& path) {
+    if (h.hugetlb) unlink(path.c_str());
+    else shm_unlink(path.c_str());
+}
+
+static SharedRegion* MapRegion(ShmHandles& h, bool prefault, bool& created) {
+    int fd = OpenRegion(h, h.mapPath, O_RDWR | O_CREAT | O_EXCL);
+    created = fd >= 0;
+    if (!created && errno == EEXIST) {
+        fd = OpenRegion(h, h.mapPath, O_RDWR);
+    }
+    if (fd < 0) return nullptr;
+    off_t size = static_cast<off_t>(h.mappedBytes);
+    if (created && ftruncate(fd, size) != 0) {
+        close(fd);
+        UnlinkRegion(h, h.mapPath);
+        return nullptr;
+    }
+    if (!created) {
+        // The creator may not have sized the object yet. A smaller object
+        // that never grows is an older layout; the header check reports it.
+        struct stat st{};
+        for (int i = 0; i < 100 && fstat(fd, &st) == 0 && st.st_size < size; ++i) {
+            usleep(1000);
+        }
+        // Still empty: the creator died before sizing it. Growing it here is
+        // harmless if several joiners race to do so.
+        if (st.st_size == 0 && ftruncate(fd, size) == 0) st.st_size = size;
+        if (st.st_size < static_cast<off_t>(sizeof(RegionHeader))) {
+            close(fd);
+            return nullptr;
+        }
+        if (st.st_size < size) h.mappedBytes = static_cast<size_t>(st.st_size);
+    }
+    int flags = MAP_SHARED | (prefault ? MAP_POPULATE : 0);
+    void* p = mmap(nullptr, h.mappedBytes, PROT_READ | PROT_WRITE, flags, fd, 0);
+    close(fd);
+    return p == MAP_FAILED ? nullptr : static_cast<SharedRegion*>(p);
+}
+
+// Creates the channel's slab if `budget` is non-zero and nobody has yet,
+// otherwise opens the existing one. Null if there is none or it is unusable.
+static std::shared_ptr<SlabMapping> MapSlab(const ShmHandles& h, size_t budget) {
+    SlabHeader layout{};
+    size_t want = budget ? SlabLayout(budget, layout) : 0;
+    if (h.hugetlb) want = (want + kHugePageBytes - 1) & ~(kHugePageBytes - 1);
+    int fd = want ? OpenRegion(h, h.slabPath, O_RDWR | O_CREAT | O_EXCL) : -1;
+    bool created = fd >= 0;
+    if (!created) fd = OpenRegion(h, h.slabPath, O_RDWR);
+    if (fd < 0) return nullptr;
+    if (created && ftruncate(fd, static_cast<off_t>(want)) != 0) {
+        close(fd);
+        UnlinkRegion(h, h.slabPath);
+        return nullptr;
+    }
+    struct stat st{};
+    for (int i = 0; i < 100 && fstat(fd, &st) == 0 && st.st_size == 0; ++i) usleep(1000);
+    auto mapping = std::make_shared<SlabMapping>();
+    mapping->bytes = static_cast<size_t>(st.st_size);
+    void* p = mapping->bytes ? mmap(nullptr, mapping->bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (p == MAP_FAILED) return nullptr;
+    mapping->addr = static_cast<char*>(p);
+    if (created) mapping->slab.Format(mapping->addr, layout, kShmMagic, kShmLayoutVersion);
+    for (int i = 0; i < 100; ++i) {
+        if (mapping->slab.Attach(mapping->addr, mapping->bytes, kShmMagic, kShmLayoutVersion)) break;
+        usleep(1000);
+    }
+    return mapping->slab.Attached() ? mapping : nullptr;
+}
+
+// Zeroes everything after the header and fills the header in, magic last.
+// Only whoever holds RegionHeader::creator calls this.
+static void InitRegion(SharedRegion* region) {
+    std::memset(reinterpret_cast<char*>(region) + sizeof(RegionHeader), 0, sizeof(SharedRegion) - sizeof(RegionHeader));
+    RegionHeader& h = region->header;
+    h.version = kShmLayoutVersion;
+    h.regionBytes = sizeof(SharedRegion);
+    h.busBytes = kBusBytes;
+    h.maxPeers = kMaxBusPeers;
+    timespec ts{};
+    clock_gettime(CLOCK_REALTIME, &ts);
+    h.incarnation = (static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + static_cast<uint64_t>(ts.tv_nsec)) ^
+                    (static_cast<uint64_t>(getpid()) << 48);
+    h.magic.store(kShmMagic, std::memory_order_release);
+}
+
+// Waits for the creator to initialise the region. If it died first, or never
+// got as far as claiming it, the first joiner to claim it finishes the job.
+static void AwaitInit(SharedRegion* region, size_t mappedBytes) {
+    RegionHeader& h = region->header;
+    for (int i = 0; i < 2000 && h.magic.load(std::memory_order_acquire) != kShmMagic; ++i) {
+        if (i >= 100 && mappedBytes >= sizeof(SharedRegion)) {
+            int32_t owner = h.creator.load(std::memory_order_acquire);
+            if ((owner == 0 || !ProcessAlive(owner)) && h.creator.compare_exchange_strong(owner, getpid())) {
+                InitRegion(region);
+                return;
+            }
+        }
+        usleep(1000);
+    }
+}
+
+// Journals a message from inside the bus's ordered commit, so the journal
+// sees messages in exactly the order readers do.
+struct JournalHook final : CommitHook {
+    JournalWriter* journal;
+    const char* data;
+    size_t len;
+    uint32_t sender;
+    uint64_t incarnation;
+    bool journaled{true};
+
+    JournalHook(JournalWriter* journal, const char* data, size_t len, uint32_t sender, uint64_t incarnation)
+        : journal(journal), data(data), len(len), sender(sender), incarnation(incarnation) {}
+
+    void BeforeCommit(uint64_t end) override { journaled = journal->Append(data, len, sender, incarnation, end); }
+};
+
+// Empty if the region was laid out by this build, otherwise why not.
+static std::string CheckLayout(const SharedRegion* region, size_t mappedBytes) {
+    const RegionHeader& h = region->header;
+    if (h.magic.load(std::memory_order_acquire) != kShmMagic) {
+        return "region was never initialised or predates layout versioning";
+    }
+    if (h.version != kShmLayoutVersion || h.regionBytes != sizeof(SharedRegion) || h.busBytes != kBusBytes ||
+        h.maxPeers != kMaxBusPeers || mappedBytes < sizeof(SharedRegion)) {
+        return "layout v" + std::to_string(h.version) + " (" + std::to_string(h.regionBytes) +
+               " bytes), this build uses v" + std::to_string(kShmLayoutVersion) + " (" +
+               std::to_string(sizeof(SharedRegion)) + " bytes)";
+    }
+    return std::string();
+}
+
+ShmEngine::ShmEngine(EventCallback onEvent) : onEvent(std::move(onEvent)) {}
+
+ShmEngine::~ShmEngine() {
+    Stop();
+}
+
+void ShmEngine::CloseHandles() {
+    if (!handles) return;
+    bool last = false;
+    if (region) {
+        // The peer that evicted this one already gave up its attachment.
+        bool evicted = member.Joined() && member.Evicted();
+        if (member.Joined()) {
+            // Reclaim anyone who died first so the last live peer out still
+            // removes the channel.
+            Sweep(NowMs());
+            member.Leave();
+            RingDoorbell(true);
+        }
+        if (!evicted) last = region->attached.fetch_sub(1) == 1;
+        munmap(region, handles->mappedBytes);
+        region = nullptr;
+    }
+    // Named objects on POSIX outlive their users; drop them with the last
+    // peer so the channel behaves like a kernel-refcounted Win32 mapping.
+    std::atomic_store(&slab, std::shared_ptr<SlabMapping>());
+    if (journal && config.journal.sync != JournalSync::None) journal->Sync();
+    journal.reset();
+    if (last) {
+        UnlinkRegion(*handles, handles->mapPath);
+        UnlinkRegion(*handles, handles->slabPath);
+    }
+    delete handles;
+    handles = nullptr;
+}
+
+bool ShmEngine::Start(const ShmConfig& cfg) {
+    if (running) {
+        EmitLog(onEvent, "Already running.");
+        return false;
+    }
+    config = cfg;
+    if (config.channel.empty()) config.channel = "demo";
+
+    handles = new ShmHandles();
+    std::string name = "/ShmChat_" + config.channel;
+    handles->hugetlb = !config.hugePageDir.empty();
+    if (handles->hugetlb) name = config.hugePageDir + name;
+    handles->mapPath = name + "_map";
+    handles->slabPath = name + "_slab";
+    handles->mappedBytes = sizeof(SharedRegion);
+    if (handles->hugetlb) {
+        handles->mappedBytes = (sizeof(SharedRegion) + kHugePageBytes - 1) & ~(kHugePageBytes - 1);
+    }
+
+    bool created = false;
+    region = MapRegion(*handles, config.prefault, created);
+    if (!region) {
+        EmitLog(onEvent, handles->hugetlb ? "Failed to create shared memory on " + config.hugePageDir + "."
+                                          : "Failed to create shared memory.");
+        CloseHandles();
+        return false;
+    }
+    int32_t unclaimed = 0;
+    if (created && region->header.creator.compare_exchange_strong(unclaimed, getpid())) {
+        InitRegion(region);
+    } else {
+        AwaitInit(region, handles->mappedBytes);
+        std::string mismatch = CheckLayout(region, handles->mappedBytes);
+        if (!mismatch.empty()) {
+            EmitLog(onEvent, "Channel \"" + config.channel + "\" is incompatible: " + mismatch + ".");
+            munmap(region, handles->mappedBytes);
+            region = nullptr;
+            CloseHandles();
+            return false;
+        }
+    }
+    region->attached.fetch_add(1);
+
+    uint64_t now = NowMs();
+    stallCommit = region->bus.commit.load(std::memory_order_acquire);
+    stallSince = now;
+    Sweep(now);
+    if (!member.Join(&region->bus, getpid(), now)) {
+        EmitLog(onEvent, "Channel is full (" + std::to_string(kMaxBusPeers) + " peers).");
+        CloseHandles();
+        return false;
+    }
+    RingDoorbell(true);
+    std::atomic_store(&slab, MapSlab(*handles, config.slabBytes));
+    if (!LoadSlab(false) && config.slabBytes) {
+        EmitLog(onEvent, "[!] No slab for large messages; they will be truncated.");
+    }
+    if (!config.journal.dir.empty()) {
+        std::string error;
+        journal = std::make_unique<JournalWriter>();
+        if (!journal->Open(config.channel, config.journal, error)) {
+            EmitLog(onEvent, "[!] Journal disabled: " + error + ".");
+            journal.reset();
+        }
+    }
+
+    peersSeen = uint64_t(1) << member.Id();
+    std::fill(std::begin(generationsSeen), std::end(generationsSeen), 0);
+    generationsSeen[member.Id()] = member.Generation();
+    membershipSeen = member.Membership() - 1;
+    lastBeat = now;
+    lastSweep = now;
+    dropped = 0;
+    unjournaled = 0;
+    running = true;
+    EmitStatus(onEvent, "Connected to channel \"" + config.channel + "\" as Peer " + std::to_string(PeerId()));
+    EmitLog(onEvent, "Shared memory ready.");
+    recvThread = std::thread(&ShmEngine::ReceiveLoop, this);
+    return true;
+}
+
+void ShmEngine::Stop() {
+    bool wasRunning = running.exchange(false);
+    if (wasRunning) RingDoorbell(true);
+    if (recvThread.joinable()) recvThread.join();
+    CloseHandles();
+    if (wasRunning) EmitStatus(onEvent, "Shared Memory Chat - Offline");
+}
+
+// Publishers only make the wake syscall when a receiver is parked. The fence
+// pairs with the one in WaitForMessages: either the publisher sees the
+// sleeper, or the sleeper sees the new commit before it parks.
+void ShmEngine::RingDoorbell(bool force) {
+    ShmBus& bus = region->bus;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!force && bus.sleepers.load(std::memory_order_relaxed) == 0) return;
+    bus.doorbell.fetch_add(1, std::memory_order_release);
+    FutexWake(bus.doorbell);
+}
+
+void ShmEngine::WaitForMessages() {
+    if (member.Pending()) return;
+    if (config.wait != WaitMode::Blocking) {
+        unsigned spins = config.wait == WaitMode::BusyPoll ? kBusySpinLimit : kSpinLimit;
+        for (unsigned i = 0; i < spins && running; ++i) {
+            if (member.Pending()) return;
+            if (config.wait == WaitMode::BusyPoll && member.Membership() != membershipSeen) return;
+            CpuRelax();
+        }
+        if (config.wait == WaitMode::BusyPoll) return;
+        for (unsigned i = 0; i < kYieldLimit; ++i) {
+            std::this_thread::yield();
+            if (member.Pending()) return;
+        }
+    }
+    ShmBus& bus = region->bus;
+    bus.sleepers.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    uint32_t ticket = bus.doorbell.load(std::memory_order_acquire);
+    if (running && !member.Pending() && member.Membership() == membershipSeen) {
+        FutexWait(bus.doorbell, ticket, kParkTimeoutNs);
+    }
+    bus.sleepers.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void ShmEngine::ReportPeers() {
+    uint32_t epoch = member.Membership();
+    if (epoch == membershipSeen) return;
+    membershipSeen = epoch;
+    uint64_t active = member.ActivePeers();
+    // A row we knew that came back with a new generation is a restarted
+    // peer: report the old one gone before the new one arrives.
+    for (uint32_t i = 0; i < kMaxBusPeers; ++i) {
+        if (!((active >> i) & 1)) continue;
+        uint32_t generation = member.PeerGeneration(i);
+        if (((peersSeen >> i) & 1) && generation != generationsSeen[i]) {
+            EmitConnected(onEvent, i + 1, false);
+            peersSeen &= ~(uint64_t(1) << i);
+        }
+        generationsSeen[i] = generation;
+    }
+    uint64_t changed = active ^ peersSeen;
+    for (uint32_t i = 0; changed; ++i, changed >>= 1) {
+        if (changed & 1) EmitConnected(onEvent, i + 1, (active >> i) & 1);
+    }
+    peersSeen = active;
+}
+
+void ShmEngine::CheckIn(uint64_t now) {
+    if (member.Evicted()) {
+        // Presumed dead after stalling for kHungPeerMs. Whoever took the row
+        // dropped our place in the log, so come back as a new peer at its
+        // current end. Senders give up on the old row by themselves, so the
+        // lock is free.
+        std::lock_guard<std::mutex> lock(sendMutex);
+        member.Leave();
+        region->attached.fetch_add(1);
+        if (!member.Join(&region->bus, getpid(), now)) {
+            region->attached.fetch_sub(1);
+            EmitLog(onEvent, "[!] Dropped from the channel as unresponsive and it is now full.");
+            running = false;
+            return;
+        }
+        peersSeen |= uint64_t(1) << member.Id();
+        generationsSeen[member.Id()] = member.Generation();
+        EmitLog(onEvent, "[!] Dropped from the channel as unresponsive; rejoined as Peer " +
+                             std::to_string(PeerId()) + ".");
+        lastBeat = 0;
+    }
+    if (now - lastBeat < kHeartbeatMs) return;
+    lastBeat = now;
+    member.Heartbeat(now);
+    if (journal) {
+        std::lock_guard<std::mutex> lock(sendMutex);
+        journal->MaybeSync(now);
+    }
+    if (now - lastSweep >= kSweepMs) {
+        lastSweep = now;
+        Sweep(now);
+    }
+}
+
+void ShmEngine::Sweep(uint64_t now) {
+    ShmBus& bus = region->bus;
+    uint64_t commit = bus.commit.load(std::memory_order_acquire);
+    if (commit != stallCommit || commit == bus.reserve.load(std::memory_order_acquire)) {
+        stallCommit = commit;
+        stallSince = now;
+    }
+    bool stalled = now - stallSince >= kStallMs;
+    for (uint32_t i = 0; i < kMaxBusPeers; ++i) {
+        if (member.Joined() && i == member.Id()) continue;
+        BusPeerSlot& slot = bus.peers[i];
+        uint64_t tag = slot.tag.load(std::memory_order_acquire);
+        if (PeerTagState(tag) != kPeerActive || PeerAlive(slot, now)) continue;
+        // Its reservation has to be committed past before the row goes, or
+        // every later writer waits on it forever.
+        if (ReservationPending(bus, i) && !(stalled && FinishReservation(bus, i))) continue;
+        if (!ClaimPeer(bus, i, tag)) continue;
+        int32_t pid = slot.pid.load(std::memory_order_acquire);
+        if (std::shared_ptr<SlabMapping> mapped = LoadSlab(true)) mapped->slab.ReclaimPeer(i);
+        FreePeer(bus, i);
+        region->attached.fetch_sub(1);
+        EmitLog(onEvent, "[!] Peer " + std::to_string(i + 1) + " (pid " + std::to_string(pid) +
+                             ") stopped responding; reclaimed its slot.");
+    }
+}
+
+// History goes out before the first live message: everything journaled by an
+// earlier bus, then this bus's records up to where our cursor started.
+// Entries point into the mapped segments, so nothing is copied.
+void ShmEngine::ReplayHistory() {
+    uint64_t incarnation = region->header.incarnation;
+    uint64_t joinedAt = member.Position();
+    size_t replayed = 0;
+    ReplayJournal(config.journal.dir, config.channel, [&](const JournalEntry& e) {
+        if (e.record.incarnation == incarnation && e.record.busEnd > joinedAt) return;
+        std::string from = "Peer " + std::to_string(e.record.sender + 1);
+        EmitPayload(onEvent, e.record.sender + 1, from, e.data, e.record.length, e.ref);
+        ++replayed;
+    });
+    if (replayed) EmitLog(onEvent, "Replayed " + std::to_string(replayed) + " message(s) from the journal.");
+}
+
+void ShmEngine::ReceiveLoop() {
+    BusMessage msg;
+    if (!config.journal.dir.empty() && config.journal.replay) ReplayHistory();
+    ReportPeers();
+    while (running) {
+        WaitForMessages();
+        if (!running) break;
+        CheckIn(NowMs());
+        unsigned batch = 0;
+        while (member.Poll(msg)) {
+            if (msg.flags & kRecordSlab) DeliverSlab(msg);
+            else EmitMessage(onEvent, msg.sender + 1, "Peer " + std::to_string(msg.sender + 1), std::move(msg.text));
+            if (++batch % 32 == 0) member.Consume();
+        }
+        member.Consume();
+        uint64_t lost = member.TakeLost();
+        if (lost) EmitLog(onEvent, "[!] Peers dropped " + std::to_string(lost) + " message(s): channel full.");
+        uint64_t skipped = member.TakeSkipped();
+        if (skipped) EmitLog(onEvent, "[!] Skipped " + std::to_string(skipped) + " overwritten byte(s) of the log.");
+        ReportPeers();
+    }
+}
+
+void ShmEngine::DeliverSlab(const BusMessage& msg) {
+    SlabHandle h;
+    if (msg.text.size() != sizeof(h)) return;
+    std::memcpy(&h, msg.text.data(), sizeof(h));
+    std::shared_ptr<SlabMapping> owner = LoadSlab(true);
+    uint32_t reader = member.Id();
+    const char* data = owner ? owner->slab.Acquire(h, reader) : nullptr;
+    if (!data) {
+        EmitLog(onEvent, "[!] Lost a large message from Peer " + std::to_string(msg.sender + 1) + ".");
+        return;
+    }
+    std::shared_ptr<const void> ref(data, [owner, h, reader](const void*) { owner->slab.Release(h, reader); });
+    EmitPayload(onEvent, msg.sender + 1, "Peer " + std::to_string(msg.sender + 1), data, h.length, std::move(ref));
+}
+
+bool ShmEngine::PublishRecord(const char* data, size_t len, uint32_t flags, uint64_t* end, const char* body,
+                              size_t bodyLen) {
+    std::lock_guard<std::mutex> lock(sendMutex);
+    JournalHook hook(journal.get(), body, bodyLen, member.Id(), region->header.incarnation);
+    CommitHook* hooks = journal ? &hook : nullptr;
+    if (journal) journal->Prepare(bodyLen);
+    PushResult result;
+    while ((result = member.Publish(data, len, TickMs(), flags, end, hooks)) == PushResult::Full) {
+        if (config.whenFull == FullPolicy::Fail || !running) {
+            member.NoteLost();
+            ++dropped;
+            return false;
+        }
+        timespec pause{0, 50 * 1000};
+        nanosleep(&pause, nullptr);
+    }
+    if (result == PushResult::Lost) {
+        ++dropped;
+        EmitLog(onEvent, "[!] Message lost: dropped from the channel as unresponsive.");
+        return false;
+    }
+    RingDoorbell(false);
+    if (journal) journal->MaybeSync(NowMs());
+    if (!hook.journaled) {
+        uint64_t missed = ++unjournaled;
+        // Logged at powers of two so a run of oversized messages stays quiet.
+        if ((missed & (missed - 1)) == 0) {
+            EmitLog(onEvent, "[!] " + std::to_string(missed) + " message(s) left out of the journal (latest " +
+                                 std::to_string(bodyLen) + " bytes).");
+        }
+    }
+    return true;
+}
+
+// The slab may be created by a peer that joins after us; the receive thread
+// maps it then (`map`), while senders only look. Every access goes through
+// the atomic shared_ptr functions because the two threads race on it.
+std::shared_ptr<SlabMapping> ShmEngine::LoadSlab(bool map) {
+    std::shared_ptr<SlabMapping> current = std::atomic_load(&slab);
+    if (current || !map || !handles) return current;
+    std::shared_ptr<SlabMapping> mapped = MapSlab(*handles, 0);
+    if (mapped && !std::atomic_compare_exchange_strong(&slab, &current, mapped)) return current;
+    return mapped;
+}
+
+bool ShmEngine::Allocate(size_t size, ShmBuffer& out) {
+    std::shared_ptr<SlabMapping> mapped = LoadSlab(false);
+    if (!running || !mapped || size > mapped->slab.MaxPayload()) return false;
+    for (;;) {
+        {
+            std::lock_guard<std::mutex> lock(sendMutex);
+            // An evicted peer's blocks are reclaimed under its old id.
+            if (member.Evicted()) {
+                ++dropped;
+                return false;
+            }
+            if (mapped->slab.Allocate(size, member.MinCursor(), member.Id(), out.handle, out.data)) break;
+        }
+        if (config.whenFull == FullPolicy::Fail || !running) {
+            member.NoteLost();
+            ++dropped;
+            return false;
+        }
+        timespec pause{0, 50 * 1000};
+        nanosleep(&pause, nullptr);
+    }
+    out.capacity = size;
+    return true;
+}
+
+bool ShmEngine::SendBuffer(ShmBuffer& buf, size_t size) {
+    std::shared_ptr<SlabMapping> mapped = LoadSlab(false);
+    if (!buf.data || !mapped) return false;
+    buf.handle.length = std::min(size, buf.capacity);
+    mapped->slab.Publish(buf.handle);
+    uint64_t end = 0;
+    bool ok = PublishRecord(reinterpret_cast<const char*>(&buf.handle), sizeof(buf.handle), kRecordSlab, &end,
+                            buf.data, buf.handle.length);
+    if (ok) mapped->slab.Retire(buf.handle, end);
+    else mapped->slab.Abandon(buf.handle);
+    buf = ShmBuffer{};
+    return ok;
+}
+
+bool ShmEngine::Send(const std::string& text) {
+    if (!running || !region) {
+        EmitLog(onEvent, "Not connected.");
+        return false;
+    }
+    if (text.empty()) return false;
+    std::shared_ptr<SlabMapping> mapped = LoadSlab(false);
+    if (text.size() > std::min(config.maxMessageBytes, kMaxBusRecord) && mapped) {
+        ShmBuffer buf;
+        size_t len = Utf8Prefix(text, mapped->slab.MaxPayload());
+        if (!Allocate(len, buf)) return false;
+        std::memcpy(buf.data, text.data(), len);
+        return SendBuffer(buf, len);
+    }
+    size_t len = Utf8Prefix(text, std::min(config.maxMessageBytes, kMaxBusRecord));
+    return PublishRecord(text.data(), len, 0, nullptr, text.data(), len);
+}
+
+} // namespace chat
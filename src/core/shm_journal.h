@@ -0,0 +1,131 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+
+namespace chat {
+
+// When journal writes are forced to disk. None leaves it to the kernel's
+// writeback; Interval syncs at most every `syncIntervalMs`; EveryN syncs
+// after every `syncEveryN` messages this process appends.
+enum class JournalSync { None, Interval, EveryN };
+
+struct JournalConfig {
+    // Directory holding the channel's segment files; empty disables the
+    // journal.
+    std::string dir;
+    size_t segmentBytes{64 * 1024 * 1024};
+    // Sealed segments are deleted oldest first while the journal is larger
+    // than `maxBytes` or was last written more than `maxAgeSec` ago; 0 turns
+    // either limit off. Checked at every rollover and when a peer opens it.
+    uint64_t maxBytes{1024ull * 1024 * 1024};
+    uint64_t maxAgeSec{0};
+    JournalSync sync{JournalSync::None};
+    uint32_t syncIntervalMs{1000};
+    uint32_t syncEveryN{1};
+    // Hand the journaled history to this peer before any live message.
+    bool replay{true};
+};
+
+constexpr uint32_t kJournalMagic = 0x4C4E524A; // "JRNL"
+constexpr uint32_t kJournalVersion = 1;
+// Records start on the first page after the header.
+constexpr size_t kJournalDataOffset = 4096;
+
+// Start of each segment file. Records are appended after
+// kJournalDataOffset and `end` is advanced past each one only once it is
+// complete, so a reader never sees a torn record, even after a crash.
+struct JournalSegmentHeader {
+    std::atomic<uint32_t> magic;
+    uint32_t version;
+    uint64_t index;
+    uint64_t capacity;
+    int64_t createdMs;
+    std::atomic<uint64_t> end;
+    std::atomic<int64_t> lastWriteMs;
+    // Set once the next segment exists and nothing more goes in this one.
+    std::atomic<uint32_t> sealed;
+};
+
+// Records are 16-byte aligned: this header, then `length` payload bytes.
+// `incarnation` and `busEnd` place the message in the live bus (see
+// RegionHeader::incarnation) so a replaying peer can stop exactly where its
+// live feed begins. Times are CLOCK_REALTIME milliseconds.
+struct JournalRecord {
+    uint32_t length;
+    uint32_t sender;
+    int64_t timeMs;
+    uint64_t incarnation;
+    uint64_t busEnd;
+};
+
+struct JournalSegment;
+
+// A journaled message as replay hands it out. `data` points into the mapped
+// segment and stays valid while `ref` (or a copy) is alive.
+struct JournalEntry {
+    JournalRecord record;
+    const char* data{nullptr};
+    std::shared_ptr<const void> ref;
+};
+
+// Append side of a channel's journal: a run of fixed-size, memory-mapped
+// segment files named <channel>.<index>.journal. Every peer of the channel
+// appends through its own writer, but only from inside the bus's ordered
+// commit (see CommitHook in shm_bus.h), so appends never overlap and the
+// journal holds messages in log order. The writer that finds the current
+// segment full seals it and moves on to the next one; the others follow the
+// seal. Creating that next segment, syncing the sealed one and applying
+// retention all happen in Prepare(), outside the commit, so other publishers
+// never wait on that disk I/O.
+class JournalWriter {
+public:
+    JournalWriter();
+    ~JournalWriter();
+    JournalWriter(const JournalWriter&) = delete;
+    JournalWriter& operator=(const JournalWriter&) = delete;
+
+    // False with `error` set if the directory or newest segment is unusable.
+    bool Open(const std::string& channel, const JournalConfig& cfg, std::string& error);
+    // Call before publishing a message of `len` bytes, outside the commit.
+    void Prepare(size_t len);
+    // False if the message could not be journaled (too large, or no space).
+    bool Append(const char* data, size_t len, uint32_t sender, uint64_t incarnation, uint64_t busEnd);
+    // Applies the sync policy; call after appending and now and then while
+    // idle. `nowMs` is any monotonic millisecond clock.
+    void MaybeSync(uint64_t nowMs);
+    // Forces everything appended so far to disk, including the tail of a
+    // segment sealed since the last sync.
+    void Sync();
+
+private:
+    std::string SegmentPath(uint64_t index) const;
+    std::shared_ptr<JournalSegment> OpenSegment(uint64_t index, bool create);
+    bool FollowSeals();
+    bool Roll();
+    void ApplyRetention();
+
+    std::string channel;
+    JournalConfig config;
+    std::shared_ptr<JournalSegment> current;
+    // The next segment, created ahead of the rollover that needs it.
+    std::shared_ptr<JournalSegment> spare;
+    // A segment this writer sealed, still to be synced up to its end.
+    std::shared_ptr<JournalSegment> retired;
+    uint64_t retiredSyncedEnd{0};
+    bool retentionDue{false};
+    uint64_t syncedEnd{0};
+    uint32_t unsynced{0};
+    uint64_t lastSyncMs{0};
+};
+
+// Calls `fn` for every complete record of `channel`'s journal in `dir`,
+// oldest first, straight from the mapped segments. Returns how many it saw.
+size_t ReplayJournal(const std::string& dir, const std::string& channel,
+                     const std::function<void(const JournalEntry&)>& fn);
+
+} // namespace chat
@@ -0,0 +1,330 @@
+#include "core/shm_journal.h"
+#include "core/shm_slab.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+namespace chat {
+
+constexpr size_t kJournalPage = 4096;
+constexpr char kJournalSuffix[] = ".journal";
+
+static_assert(sizeof(JournalSegmentHeader) <= kJournalDataOffset, "segment header must fit before the data");
+
+// One mapped segment file. Replayed entries hold a reference so their bytes
+// outlive the writer moving on, or retention deleting the file.
+struct JournalSegment {
+    char* base{nullptr};
+    size_t bytes{0};
+    uint64_t index{0};
+
+    ~JournalSegment() {
+        if (base) munmap(base, bytes);
+    }
+
+    JournalSegmentHeader* Header() const { return reinterpret_cast<JournalSegmentHeader*>(base); }
+};
+
+static int64_t WallMs() {
+    timespec ts{};
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+static size_t RecordSize(size_t len) {
+    return (sizeof(JournalRecord) + len + 15) & ~size_t(15);
+}
+
+static bool ValidHeader(const JournalSegmentHeader* h, size_t bytes) {
+    return h->magic.load(std::memory_order_acquire) == kJournalMagic && h->version == kJournalVersion &&
+           h->capacity == bytes && kJournalDataOffset + h->end.load(std::memory_order_acquire) <= bytes;
+}
+
+// Indices of `channel`'s segments in `dir`, oldest first.
+static std::vector<uint64_t> ListSegments(const std::string& dir, const std::string& channel) {
+    std::vector<uint64_t> out;
+    DIR* d = opendir(dir.c_str());
+    if (!d) return out;
+    std::string prefix = channel + ".";
+    size_t suffixLen = sizeof(kJournalSuffix) - 1;
+    while (dirent* e = readdir(d)) {
+        std::string name = e->d_name;
+        if (name.size() <= prefix.size() + suffixLen || name.compare(0, prefix.size(), prefix) != 0) continue;
+        if (name.compare(name.size() - suffixLen, suffixLen, kJournalSuffix) != 0) continue;
+        std::string digits = name.substr(prefix.size(), name.size() - prefix.size() - suffixLen);
+        if (digits.empty() || digits.find_first_not_of("0123456789") != std::string::npos) continue;
+        out.push_back(std::strtoull(digits.c_str(), nullptr, 10));
+    }
+    closedir(d);
+    std::sort(out.begin(), out.end());
+    return out;
+}
+
+static std::string PathFor(const std::string& dir, const std::string& channel, uint64_t index) {
+    char digits[24];
+    std::snprintf(digits, sizeof(digits), "%010" PRIu64, index);
+    return dir + "/" + channel + "." + digits + kJournalSuffix;
+}
+
+static std::shared_ptr<JournalSegment> MapSegment(const std::string& path, bool writable) {
+    int fd = open(path.c_str(), (writable ? O_RDWR : O_RDONLY) | O_CLOEXEC);
+    if (fd < 0) return nullptr;
+    struct stat st{};
+    if (fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(kJournalDataOffset)) {
+        close(fd);
+        return nullptr;
+    }
+    auto seg = std::make_shared<JournalSegment>();
+    seg->bytes = static_cast<size_t>(st.st_size);
+    void* p = mmap(nullptr, seg->bytes, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) return nullptr;
+    seg->base = static_cast<char*>(p);
+    return seg;
+}
+
+// Syncs the records `seg` gained past `syncedEnd` and returns its new end.
+static uint64_t SyncSegment(const JournalSegment& seg, uint64_t syncedEnd) {
+    uint64_t end = seg.Header()->end.load(std::memory_order_acquire);
+    if (end == syncedEnd) return end;
+    size_t from = (kJournalDataOffset + syncedEnd) & ~(kJournalPage - 1);
+    size_t to = kJournalDataOffset + end;
+    msync(seg.base + from, to - from, MS_SYNC);
+    // The header carries `end`; without it the synced records are unreachable.
+    msync(seg.base, kJournalPage, MS_SYNC);
+    return end;
+}
+
+JournalWriter::JournalWriter() = default;
+JournalWriter::~JournalWriter() = default;
+
+std::string JournalWriter::SegmentPath(uint64_t index) const {
+    return PathFor(config.dir, channel, index);
+}
+
+// Maps segment `index`, creating and formatting it if `create` is set and it
+// does not exist yet. A file left half-formatted by a crashed roller is
+// formatted again.
+std::shared_ptr<JournalSegment> JournalWriter::OpenSegment(uint64_t index, bool create) {
+    std::string path = SegmentPath(index);
+    if (create) {
+        int fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (fd < 0) return nullptr;
+        struct stat st{};
+        bool fresh = fstat(fd, &st) == 0 && st.st_size == 0;
+        if (fresh && ftruncate(fd, static_cast<off_t>(config.segmentBytes)) != 0) {
+            close(fd);
+            unlink(path.c_str());
+            return nullptr;
+        }
+        close(fd);
+    }
+    auto seg = MapSegment(path, true);
+    if (!seg) return nullptr;
+    seg->index = index;
+    JournalSegmentHeader* h = seg->Header();
+    if (h->magic.load(std::memory_order_acquire) != kJournalMagic) {
+        if (!create) return nullptr;
+        h->version = kJournalVersion;
+        h->index = index;
+        h->capacity = seg->bytes;
+        h->createdMs = WallMs();
+        h->end.store(0, std::memory_order_relaxed);
+        h->lastWriteMs.store(h->createdMs, std::memory_order_relaxed);
+        h->sealed.store(0, std::memory_order_relaxed);
+        h->magic.store(kJournalMagic, std::memory_order_release);
+    }
+    return ValidHeader(h, seg->bytes) ? seg : nullptr;
+}
+
+bool JournalWriter::Open(const std::string& name, const JournalConfig& cfg, std::string& error) {
+    channel = name;
+    config = cfg;
+    // Room for at least a few of the largest messages per segment.
+    size_t minBytes = 4 * RecordSize(kMaxSlabPayload) + kJournalDataOffset;
+    if (config.segmentBytes < minBytes) config.segmentBytes = minBytes;
+    config.segmentBytes = (config.segmentBytes + kJournalPage - 1) & ~(kJournalPage - 1);
+    if (mkdir(config.dir.c_str(), 0755) != 0 && errno != EEXIST) {
+        error = "cannot create " + config.dir + ": " + std::strerror(errno);
+        return false;
+    }
+    std::vector<uint64_t> existing = ListSegments(config.dir, channel);
+    uint64_t newest = existing.empty() ? 0 : existing.back();
+    // The newest file may be another writer's spare, created before the
+    // segment ahead of it was sealed.
+    if (existing.size() >= 2 && existing[existing.size() - 2] + 1 == newest) {
+        auto previous = OpenSegment(newest - 1, false);
+        auto spareSeg = OpenSegment(newest, false);
+        if (previous && !previous->Header()->sealed.load(std::memory_order_acquire) &&
+            (!spareSeg || spareSeg->Header()->end.load(std::memory_order_acquire) == 0)) {
+            --newest;
+        }
+    }
+    current = OpenSegment(newest, true);
+    if (!current) {
+        error = "cannot map " + SegmentPath(newest);
+        return false;
+    }
+    syncedEnd = current->Header()->end.load(std::memory_order_acquire);
+    ApplyRetention();
+    return true;
+}
+
+// Another peer may have rolled over since this writer last appended.
+bool JournalWriter::FollowSeals() {
+    while (current->Header()->sealed.load(std::memory_order_acquire)) {
+        auto next = OpenSegment(current->index + 1, false);
+        if (!next) return false;
+        current = std::move(next);
+        syncedEnd = 0;
+    }
+    return true;
+}
+
+// Runs inside the commit, so it only swaps in the spare Prepare() made; the
+// file is created here only if another writer's rollover got in between.
+bool JournalWriter::Roll() {
+    std::shared_ptr<JournalSegment> next;
+    if (spare && spare->index == current->index + 1) next = std::move(spare);
+    spare.reset();
+    if (!next) next = OpenSegment(current->index + 1, true);
+    if (!next) return false;
+    current->Header()->sealed.store(1, std::memory_order_release);
+    // Whatever the policy promised for the old segment still has to hold
+    // once nobody appends to it; Prepare() or Sync() finishes it.
+    if (config.sync != JournalSync::None) {
+        retired = std::move(current);
+        retiredSyncedEnd = syncedEnd;
+    }
+    current = std::move(next);
+    syncedEnd = current->Header()->end.load(std::memory_order_acquire);
+    retentionDue = true;
+    return true;
+}
+
+void JournalWriter::Prepare(size_t len) {
+    if (!current) return;
+    if (retired) {
+        SyncSegment(*retired, retiredSyncedEnd);
+        retired.reset();
+    }
+    if (retentionDue) {
+        retentionDue = false;
+        ApplyRetention();
+    }
+    if (!FollowSeals()) return;
+    if (spare && spare->index != current->index + 1) spare.reset();
+    // Start the next segment once this one is within an eighth of full.
+    uint64_t end = current->Header()->end.load(std::memory_order_acquire);
+    size_t headroom = std::max(RecordSize(len), config.segmentBytes / 8);
+    if (!spare && kJournalDataOffset + end + headroom > current->bytes) spare = OpenSegment(current->index + 1, true);
+}
+
+bool JournalWriter::Append(const char* data, size_t len, uint32_t sender, uint64_t incarnation, uint64_t busEnd) {
+    size_t size = RecordSize(len);
+    if (!current || kJournalDataOffset + size > config.segmentBytes) return false;
+    if (!FollowSeals()) return false;
+    uint64_t end = current->Header()->end.load(std::memory_order_acquire);
+    if (kJournalDataOffset + end + size > current->bytes) {
+        if (!Roll()) return false;
+        end = current->Header()->end.load(std::memory_order_acquire);
+        if (kJournalDataOffset + end + size > current->bytes) return false;
+    }
+    JournalRecord rec{static_cast<uint32_t>(len), sender, WallMs(), incarnation, busEnd};
+    char* at = current->base + kJournalDataOffset + end;
+    std::memcpy(at, &rec, sizeof(rec));
+    std::memcpy(at + sizeof(rec), data, len);
+    JournalSegmentHeader* h = current->Header();
+    h->lastWriteMs.store(rec.timeMs, std::memory_order_relaxed);
+    h->end.store(end + size, std::memory_order_release);
+    ++unsynced;
+    return true;
+}
+
+void JournalWriter::Sync() {
+    if (retired) {
+        SyncSegment(*retired, retiredSyncedEnd);
+        retired.reset();
+    }
+    if (!current) return;
+    syncedEnd = SyncSegment(*current, syncedEnd);
+    unsynced = 0;
+}
+
+void JournalWriter::MaybeSync(uint64_t nowMs) {
+    if (!current) return;
+    switch (config.sync) {
+    case JournalSync::None:
+        return;
+    case JournalSync::EveryN:
+        if (unsynced >= config.syncEveryN) Sync();
+        return;
+    case JournalSync::Interval:
+        if (nowMs - lastSyncMs < config.syncIntervalMs) return;
+        lastSyncMs = nowMs;
+        // Other peers' appends share the page cache, so this covers theirs.
+        if (FollowSeals()) Sync();
+        return;
+    }
+}
+
+void JournalWriter::ApplyRetention() {
+    if (!config.maxBytes && !config.maxAgeSec) return;
+    std::vector<uint64_t> segments = ListSegments(config.dir, channel);
+    uint64_t total = 0;
+    std::vector<uint64_t> sizes;
+    for (uint64_t index : segments) {
+        struct stat st{};
+        sizes.push_back(stat(SegmentPath(index).c_str(), &st) == 0 ? static_cast<uint64_t>(st.st_size) : 0);
+        total += sizes.back();
+    }
+    int64_t cutoff = config.maxAgeSec ? WallMs() - static_cast<int64_t>(config.maxAgeSec) * 1000 : INT64_MIN;
+    for (size_t i = 0; i < segments.size() && segments[i] < current->index; ++i) {
+        bool tooBig = config.maxBytes && total > config.maxBytes;
+        bool tooOld = false;
+        if (!tooBig && config.maxAgeSec) {
+            auto seg = MapSegment(SegmentPath(segments[i]), false);
+            tooOld = !seg || seg->Header()->lastWriteMs.load(std::memory_order_acquire) < cutoff;
+        }
+        if (!tooBig && !tooOld) break;
+        unlink(SegmentPath(segments[i]).c_str());
+        total -= sizes[i];
+    }
+}
+
+size_t ReplayJournal(const std::string& dir, const std::string& channel,
+                     const std::function<void(const JournalEntry&)>& fn) {
+    size_t count = 0;
+    for (uint64_t index : ListSegments(dir, channel)) {
+        auto seg = MapSegment(PathFor(dir, channel, index), false);
+        if (!seg || !ValidHeader(seg->Header(), seg->bytes)) continue;
+        seg->index = index;
+        std::shared_ptr<const void> ref = seg;
+        uint64_t end = seg->Header()->end.load(std::memory_order_acquire);
+        for (uint64_t pos = 0; pos + sizeof(JournalRecord) <= end;) {
+            JournalEntry entry;
+            std::memcpy(&entry.record, seg->base + kJournalDataOffset + pos, sizeof(entry.record));
+            size_t size = RecordSize(entry.record.length);
+            if (pos + size > end) break;
+            entry.data = seg->base + kJournalDataOffset + pos + sizeof(JournalRecord);
+            entry.ref = ref;
+            fn(entry);
+            ++count;
+            pos += size;
+        }
+    }
+    return count;
+}
+
+} // namespace chat
@@ -0,0 +1,76 @@
+#include "core/shm_ring.h"
+
+#include <cstring>
+
+namespace chat {
+
+static size_t RecordSize(size_t len) {
+    return (sizeof(RecordHeader) + len + kRecordAlign - 1) & ~(kRecordAlign - 1);
+}
+
+void RingWriter::Attach(ShmRing* target) {
+    ring = target;
+    head = ring->head.load(std::memory_order_relaxed);
+    cachedTail = ring->tail.load(std::memory_order_acquire);
+}
+
+PushResult RingWriter::TryPush(const char* data, size_t len, uint32_t tick) {
+    if (len > kMaxRecord) len = kMaxRecord;
+    size_t pos = static_cast<size_t>(head & (kRingBytes - 1));
+    size_t size = RecordSize(len);
+    // A record that would run past the end is preceded by a pad record
+    // covering the rest of the buffer, and the record itself goes at 0.
+    size_t pad = (kRingBytes - pos < size) ? kRingBytes - pos : 0;
+    if (head + pad + size - cachedTail > kRingBytes) {
+        cachedTail = ring->tail.load(std::memory_order_acquire);
+        if (head + pad + size - cachedTail > kRingBytes) return PushResult::Full;
+    }
+    if (pad) {
+        RecordHeader marker{kPadRecord, 0};
+        std::memcpy(ring->data + pos, &marker, sizeof(marker));
+        pos = 0;
+    }
+    RecordHeader header{static_cast<uint32_t>(len), tick};
+    std::memcpy(ring->data + pos, &header, sizeof(header));
+    std::memcpy(ring->data + pos + sizeof(header), data, len);
+    head += pad + size;
+    ring->head.store(head, std::memory_order_release);
+    return PushResult::Ok;
+}
+
+void RingReader::Attach(ShmRing* target) {
+    ring = target;
+    tail = ring->tail.load(std::memory_order_relaxed);
+    cachedHead = ring->head.load(std::memory_order_acquire);
+    lostSeen = 0;
+}
+
+bool RingReader::TryPop(std::string& out) {
+    for (;;) {
+        if (tail == cachedHead) {
+            cachedHead = ring->head.load(std::memory_order_acquire);
+            if (tail == cachedHead) return false;
+        }
+        size_t pos = static_cast<size_t>(tail & (kRingBytes - 1));
+        RecordHeader header;
+        std::memcpy(&header, ring->data + pos, sizeof(header));
+        if (header.length == kPadRecord) {
+            tail += kRingBytes - pos;
+            continue;
+        }
+        size_t len = header.length < kMaxRecord ? header.length : kMaxRecord;
+        out.assign(ring->data + pos + sizeof(header), len);
+        tail += RecordSize(len);
+        ring->tail.store(tail, std::memory_order_release);
+        return true;
+    }
+}
+
+uint64_t RingReader::TakeLost() {
+    uint64_t now = ring->lost.load(std::memory_order_relaxed);
+    uint64_t delta = now - lostSeen;
+    lostSeen = now;
+    return delta;
+}
+
+} // namespace chat
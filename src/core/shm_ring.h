@@ -0,0 +1,82 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace chat {
+
+// Counters written by different sides are kept this far apart: adjacent-line
+// prefetchers pull 64-byte lines in pairs, so 64 alone still ping-pongs.
+constexpr size_t kCounterAlign = 128;
+constexpr size_t kRingBytes = 512 * 1024;
+// Records are 8-byte aligned and never span the end of the ring, so the
+// largest payload is bounded well below the ring size to leave room for
+// the padding a wrap may need.
+constexpr size_t kRecordAlign = 8;
+constexpr size_t kMaxRecord = kRingBytes / 4;
+
+static_assert((kRingBytes & (kRingBytes - 1)) == 0, "ring size must be a power of two");
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "ring indices must be lock-free to live in shared memory");
+
+// Every record starts with this header and is followed by `length` bytes of
+// UTF-8, padded to kRecordAlign. A header with length == kPadRecord marks the
+// unused tail of the buffer before a wrap; the reader skips to offset 0.
+struct RecordHeader {
+    uint32_t length;
+    uint32_t tick;
+};
+
+constexpr uint32_t kPadRecord = 0xFFFFFFFFu;
+
+// Single-producer / single-consumer byte ring that lives in shared memory.
+// `head` and `tail` are running byte offsets; `head` is only written by the
+// producer and `tail` only by the consumer, and each sits on its own pair of
+// cache lines so the two sides never share a line they write. A record is
+// published by a release store of `head` after it is written, and handed back
+// by a release store of `tail` after it is copied out, so neither side can
+// see a half-written message. A short message costs one 16-byte record rather than
+// a worst-case slot.
+struct ShmRing {
+    alignas(kCounterAlign) std::atomic<uint64_t> head;
+    alignas(kCounterAlign) std::atomic<uint64_t> tail;
+    // Messages the producer could not place because the ring was full.
+    alignas(kCounterAlign) std::atomic<uint64_t> lost;
+    alignas(kCounterAlign) char data[kRingBytes];
+};
+
+// Lost: the bus took the writer for dead and wrote its record off.
+enum class PushResult { Ok, Full, Lost };
+
+// Producer-side view of a ring. Keeps its own copy of `head` and a cached
+// `tail` so a push only touches the consumer's cache line when the ring looks
+// full. Payloads longer than kMaxRecord are truncated.
+class RingWriter {
+public:
+    void Attach(ShmRing* target);
+    PushResult TryPush(const char* data, size_t len, uint32_t tick);
+    void NoteLost() { ring->lost.fetch_add(1, std::memory_order_relaxed); }
+
+private:
+    ShmRing* ring{nullptr};
+    uint64_t head{0};
+    uint64_t cachedTail{0};
+};
+
+// Consumer-side view; the mirror image of RingWriter.
+class RingReader {
+public:
+    void Attach(ShmRing* target);
+    bool TryPop(std::string& out);
+    // Messages the producer has dropped since the last call.
+    uint64_t TakeLost();
+
+private:
+    ShmRing* ring{nullptr};
+    uint64_t tail{0};
+    uint64_t cachedHead{0};
+    uint64_t lostSeen{0};
+};
+
+} // namespace chat
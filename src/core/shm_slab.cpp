@@ -0,0 +1,165 @@
+#include "core/shm_slab.h"
+
+#include <cstring>
+#include <limits>
+
+namespace chat {
+
+constexpr size_t kSlabPage = 4096;
+
+static size_t RoundUp(size_t n, size_t to) {
+    return (n + to - 1) / to * to;
+}
+
+size_t SlabLayout(size_t budget, SlabHeader& out) {
+    std::memset(static_cast<void*>(&out), 0, sizeof(out));
+    uint32_t total = 0;
+    for (uint32_t c = 0; c < kSlabClasses; ++c) {
+        out.classes[c].blockBytes = kSlabBlockBytes[c];
+        out.classes[c].count = static_cast<uint32_t>(budget / kSlabClasses / kSlabBlockBytes[c]);
+        out.classes[c].firstBlock = total;
+        if (out.classes[c].count == 0) return 0;
+        total += out.classes[c].count;
+    }
+    size_t offset = RoundUp(sizeof(SlabHeader) + total * sizeof(SlabBlock), kSlabPage);
+    for (SlabClassInfo& info : out.classes) {
+        info.dataOffset = offset;
+        offset += info.count * info.blockBytes;
+    }
+    out.totalBytes = offset;
+    return offset;
+}
+
+void Slab::Format(char* mapping, const SlabHeader& layout, uint32_t magic, uint32_t version) {
+    auto* h = reinterpret_cast<SlabHeader*>(mapping);
+    h->version = version;
+    h->totalBytes = layout.totalBytes;
+    std::memcpy(h->classes, layout.classes, sizeof(layout.classes));
+    h->magic.store(magic, std::memory_order_release);
+}
+
+bool Slab::Attach(char* mapping, size_t bytes, uint32_t magic, uint32_t version) {
+    auto* h = reinterpret_cast<SlabHeader*>(mapping);
+    if (bytes < sizeof(SlabHeader) || h->magic.load(std::memory_order_acquire) != magic) return false;
+    if (h->version != version || h->totalBytes > bytes) return false;
+    base = mapping;
+    header = h;
+    blocks = reinterpret_cast<SlabBlock*>(mapping + sizeof(SlabHeader));
+    return true;
+}
+
+size_t Slab::MaxPayload() const {
+    return header ? header->classes[kSlabClasses - 1].blockBytes : 0;
+}
+
+SlabBlock* Slab::Block(const SlabHandle& h) const {
+    if (h.cls >= kSlabClasses || h.block >= header->classes[h.cls].count) return nullptr;
+    return &blocks[header->classes[h.cls].firstBlock + h.block];
+}
+
+char* Slab::Data(uint32_t cls, uint32_t index) const {
+    const SlabClassInfo& info = header->classes[cls];
+    return base + info.dataOffset + index * info.blockBytes;
+}
+
+static uint64_t PeerBit(uint32_t peer) {
+    return uint64_t(1) << (peer & 63);
+}
+
+bool Slab::Allocate(size_t len, uint64_t horizon, uint32_t peer, SlabHandle& out, char*& data) {
+    for (uint32_t c = 0; c < kSlabClasses; ++c) {
+        const SlabClassInfo& info = header->classes[c];
+        if (info.blockBytes < len) continue;
+        // Start where the last search here left off so senders do not all
+        // contend on the first few blocks.
+        uint32_t start = hint[c].load(std::memory_order_relaxed);
+        for (uint32_t n = 0; n < info.count; ++n) {
+            uint32_t i = (start + n) % info.count;
+            SlabBlock& b = blocks[info.firstBlock + i];
+            uint32_t state = b.state.load(std::memory_order_acquire);
+            if (state == kBlockWriting) continue;
+            if (state == kBlockPublished && (b.retireAt.load(std::memory_order_acquire) > horizon ||
+                                             b.readers.load(std::memory_order_seq_cst) != 0)) {
+                continue;
+            }
+            if (!b.state.compare_exchange_strong(state, kBlockWriting, std::memory_order_seq_cst)) continue;
+            // A reader that took a reference after the check above backs off
+            // when it sees the state change, but may still hold it briefly.
+            if (b.readers.load(std::memory_order_seq_cst) != 0) {
+                b.state.store(state, std::memory_order_release);
+                continue;
+            }
+            b.retireAt.store(std::numeric_limits<uint64_t>::max(), std::memory_order_relaxed);
+            b.writer.store(peer + 1, std::memory_order_release);
+            uint32_t gen = b.generation.fetch_add(1, std::memory_order_acq_rel) + 1;
+            hint[c].store(i + 1, std::memory_order_relaxed);
+            out = SlabHandle{c, i, gen, 0, len};
+            data = Data(c, i);
+            return true;
+        }
+    }
+    return false;
+}
+
+// A block reclaimed from its writer (ReclaimPeer) has moved on a
+// generation, so the writer's handle no longer reaches it.
+SlabBlock* Slab::Owned(const SlabHandle& h) const {
+    SlabBlock* b = Block(h);
+    return b && b->generation.load(std::memory_order_acquire) == h.generation ? b : nullptr;
+}
+
+void Slab::Publish(const SlabHandle& h) {
+    SlabBlock* b = Owned(h);
+    if (b) b->state.store(kBlockPublished, std::memory_order_release);
+}
+
+void Slab::Retire(const SlabHandle& h, uint64_t retireAt) {
+    SlabBlock* b = Owned(h);
+    if (!b) return;
+    b->retireAt.store(retireAt, std::memory_order_release);
+    b->writer.store(0, std::memory_order_release);
+}
+
+void Slab::Abandon(const SlabHandle& h) {
+    SlabBlock* b = Owned(h);
+    if (!b) return;
+    b->writer.store(0, std::memory_order_release);
+    b->state.store(kBlockFree, std::memory_order_release);
+}
+
+// A peer reads each block generation at most once, so one bit per peer is
+// enough: the block cannot be republished while its bit is still set.
+const char* Slab::Acquire(const SlabHandle& h, uint32_t peer) {
+    SlabBlock* b = Block(h);
+    if (!b || h.length > header->classes[h.cls].blockBytes) return nullptr;
+    b->readers.fetch_or(PeerBit(peer), std::memory_order_seq_cst);
+    if (b->state.load(std::memory_order_seq_cst) != kBlockPublished ||
+        b->generation.load(std::memory_order_acquire) != h.generation) {
+        b->readers.fetch_and(~PeerBit(peer), std::memory_order_release);
+        return nullptr;
+    }
+    return Data(h.cls, h.block);
+}
+
+void Slab::Release(const SlabHandle& h, uint32_t peer) {
+    SlabBlock* b = Block(h);
+    if (b) b->readers.fetch_and(~PeerBit(peer), std::memory_order_release);
+}
+
+void Slab::ReclaimPeer(uint32_t peer) {
+    uint32_t total = 0;
+    for (const SlabClassInfo& info : header->classes) total += info.count;
+    for (uint32_t i = 0; i < total; ++i) {
+        SlabBlock& b = blocks[i];
+        b.readers.fetch_and(~PeerBit(peer), std::memory_order_acq_rel);
+        if (b.writer.load(std::memory_order_acquire) != peer + 1) continue;
+        // Either still being written or published without its record ever
+        // going out: nobody else will retire it. A new generation keeps the
+        // writer, if it is still alive, from touching it again.
+        b.writer.store(0, std::memory_order_relaxed);
+        b.generation.fetch_add(1, std::memory_order_acq_rel);
+        b.state.store(kBlockFree, std::memory_order_release);
+    }
+}
+
+} // namespace chat
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace chat {
+
+// Large payloads live in a second mapping carved into fixed-size blocks, one
+// pool per size class. A sender fills a block in place and publishes only a
+// SlabHandle through the bus; readers use the bytes where they are.
+constexpr uint32_t kSlabClasses = 3;
+constexpr size_t kSlabBlockBytes[kSlabClasses] = {16 * 1024, 256 * 1024, 4 * 1024 * 1024};
+constexpr size_t kMaxSlabPayload = kSlabBlockBytes[kSlabClasses - 1];
+
+struct SlabHandle {
+    uint32_t cls;
+    uint32_t block;
+    uint32_t generation;
+    uint32_t reserved;
+    uint64_t length;
+};
+
+enum SlabBlockState : uint32_t { kBlockFree = 0, kBlockWriting = 1, kBlockPublished = 2 };
+
+// A published block is reused only when nobody holds a reference and every
+// reader's cursor has moved past the record that carried its handle; readers
+// take their reference before moving past it, so the two checks together
+// cover everyone who could still see the block. References are one bit per
+// bus peer and `writer` is the allocating peer plus one until the block is
+// retired, so both can be taken back from a peer that died.
+struct SlabBlock {
+    std::atomic<uint32_t> state;
+    std::atomic<uint32_t> writer;
+    std::atomic<uint32_t> generation;
+    uint32_t reserved;
+    std::atomic<uint64_t> readers;
+    std::atomic<uint64_t> retireAt;
+};
+
+struct SlabClassInfo {
+    uint64_t blockBytes;
+    uint64_t dataOffset;
+    uint32_t count;
+    uint32_t firstBlock;
+};
+
+// Start of the slab mapping; the SlabBlock table follows it and each class's
+// blocks start on a page boundary after that.
+struct SlabHeader {
+    std::atomic<uint32_t> magic;
+    uint32_t version;
+    uint64_t totalBytes;
+    SlabClassInfo classes[kSlabClasses];
+};
+
+// Splits `budget` bytes evenly between the classes; returns the mapping size
+// to create, or 0 if the budget cannot hold one block of each class.
+size_t SlabLayout(size_t budget, SlabHeader& out);
+
+class Slab {
+public:
+    // Lays out a freshly created, zeroed mapping.
+    void Format(char* mapping, const SlabHeader& layout, uint32_t magic, uint32_t version);
+    // False if the mapping was not formatted with this magic/version or is
+    // smaller than its header claims.
+    bool Attach(char* mapping, size_t bytes, uint32_t magic, uint32_t version);
+    bool Attached() const { return header != nullptr; }
+    size_t MaxPayload() const;
+
+    // Claims a block of at least `len` bytes for writing on behalf of bus
+    // peer `peer`. `horizon` is the lowest reader cursor on the bus. False if
+    // every fitting block is busy.
+    bool Allocate(size_t len, uint64_t horizon, uint32_t peer, SlabHandle& out, char*& data);
+    // Makes a written block readable; call before its handle goes out.
+    void Publish(const SlabHandle& h);
+    // Records that the handle went out in the record ending at `retireAt`.
+    void Retire(const SlabHandle& h, uint64_t retireAt);
+    // Returns a block that was allocated but never published.
+    void Abandon(const SlabHandle& h);
+    // Takes bus peer `peer`'s reference to a published block; null if the
+    // handle is stale.
+    const char* Acquire(const SlabHandle& h, uint32_t peer);
+    void Release(const SlabHandle& h, uint32_t peer);
+    // Drops every reference `peer` held and frees blocks it was still
+    // writing or never retired. Only for peers known to be gone.
+    void ReclaimPeer(uint32_t peer);
+
+private:
+    SlabBlock* Block(const SlabHandle& h) const;
+    SlabBlock* Owned(const SlabHandle& h) const;
+    char* Data(uint32_t cls, uint32_t index) const;
+
+    char* base{nullptr};
+    SlabHeader* header{nullptr};
+    SlabBlock* blocks{nullptr};
+    std::atomic<uint32_t> hint[kSlabClasses]{};
+};
+
+} // namespace chat
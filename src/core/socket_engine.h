@@ -0,0 +1,185 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "core/ack.h"
+#include "core/chat_events.h"
+#include "core/message_store.h"
+
+namespace chat {
+
+class Reactor;
+class RoomShards;
+class SessionWindows;
+class StreamLog;
+struct ClientLink;
+struct FrameView;
+enum class FrameType : uint8_t;
+
+enum class Role { Server, Client };
+enum class Transport { Epoll, IoUring };
+
+// What a server connection's send queue does when a frame would take it past
+// SocketConfig::maxQueueBytes or maxQueueFrames.
+//   DropOldest     discard queued frames that have not started going out
+//   DropNewest     discard the incoming frame
+//   Disconnect     close the slow connection
+//   PauseProducer  stop reading from the sender until the queue drains to
+//                  half its caps; frames from other shards or from Send()
+//                  have no sender to pause and are dropped instead
+enum class OverflowPolicy { DropOldest, DropNewest, Disconnect, PauseProducer };
+
+struct SocketConfig {
+    Role role{Role::Server};
+    std::string host{"127.0.0.1"};
+    int port{54000};
+    // Server mode: event loops sharing the port, at most 64.
+    int reactors{1};
+    // Server mode only. IoUring falls back to Epoll if the kernel lacks
+    // multishot accept/recv or provided buffer rings.
+    Transport transport{Transport::Epoll};
+    // Outbound frames are held for up to this long so bursts leave in one
+    // sendmsg(). Zero still coalesces whatever one loop iteration produced.
+    int flushWindowUs{0};
+    bool tcpNoDelay{true};
+    bool tcpCork{false};
+    size_t maxQueueBytes{4 * 1024 * 1024};
+    size_t maxQueueFrames{8192};
+    OverflowPolicy overflow{OverflowPolicy::DropOldest};
+    // Server mode: with `store.dir` set every message is kept in a
+    // MessageStore and clients can ask for history (FrameType::HistoryRequest).
+    StoreConfig store;
+    // Server mode: how many recent messages (and bytes of them) are kept in
+    // memory for clients resuming their session.
+    size_t retransmitFrames{4096};
+    size_t retransmitBytes{4 * 1024 * 1024};
+    // Client mode: ask for the last `historyLast` stored messages on first
+    // connect. Later connections resume the session instead.
+    uint64_t historyLast{0};
+    // Client mode: reconnect after a lost connection, backing off from
+    // 100 ms to 5 s, until Stop(). Messages the relay has not acknowledged,
+    // and those sent meanwhile, go out on the next connection.
+    bool reconnect{true};
+    // Server mode: acknowledge client messages once `ackEvery` have arrived
+    // or `ackDelayUs` after the first unacknowledged one.
+    int ackDelayUs{2000};
+    unsigned ackEvery{32};
+};
+
+// Counters summed over every reactor; syscalls covers the event loops only.
+struct SocketStats {
+    uint64_t syscalls{0};
+    uint64_t messagesIn{0};
+    uint64_t bytesIn{0};
+    uint64_t bytesOut{0};
+    uint64_t connections{0};
+    // Outbound queue depth right now, summed over connections, and the
+    // deepest single queue seen.
+    uint64_t queuedBytes{0};
+    uint64_t queuedFrames{0};
+    uint64_t peakQueueBytes{0};
+    uint64_t droppedFrames{0};
+    uint64_t slowDisconnects{0};
+    uint64_t producerPauses{0};
+    uint64_t replayRequests{0};
+    uint64_t replayBytes{0};
+    // History requests ignored because the last one was still going out.
+    uint64_t replaysRefused{0};
+    uint64_t storedMessages{0};
+    uint64_t storeSyncs{0};
+    // Messages relayed unsequenced because the store failed to take them;
+    // a resume cannot replay these.
+    uint64_t storeFailures{0};
+    // Resumed sessions served from memory, from the store, or not at all
+    // because the missed range was gone from both.
+    uint64_t resumes{0};
+    uint64_t resumesFromStore{0};
+    uint64_t resumeMisses{0};
+    // Ack frames sent to clients, and resent client messages dropped because
+    // they had already arrived.
+    uint64_t acksSent{0};
+    uint64_t duplicates{0};
+};
+
+// Headless TCP chat engine. All text crossing the API is UTF-8; progress and
+// received messages are reported through the EventCallback from worker threads.
+// Each Send() travels as one frame (see frame.h), so message boundaries
+// survive TCP coalescing and splitting.
+// In server mode `reactors` event loops share the port through SO_REUSEPORT,
+// each serving its own slice of clients; every message is relayed to every
+// other client on all shards, and Send() broadcasts to all of them. With a
+// message store the relay also stamps each message with its store sequence
+// number, and a client catches up on what it missed by asking for history.
+// Clients can also join named rooms; a message sent to a room reaches only
+// its members, live, and is not part of the sequenced stream.
+class SocketEngine {
+public:
+    explicit SocketEngine(EventCallback onEvent);
+    ~SocketEngine();
+    SocketEngine(const SocketEngine&) = delete;
+    SocketEngine& operator=(const SocketEngine&) = delete;
+
+    bool Start(const SocketConfig& cfg);
+    void Stop();
+    bool Send(const std::string& text);
+    // Client mode: rooms stay joined across reconnects until left.
+    bool Join(const std::string& room);
+    bool Leave(const std::string& room);
+    // An empty room is the same as Send().
+    bool SendTo(const std::string& room, const std::string& text);
+
+    bool Running() const { return running; }
+    bool Connected() const;
+    SocketStats Stats() const;
+
+private:
+    bool StartServer();
+    void RunClient();
+    bool ConnectClient();
+    void Backoff(int ms);
+    void ReceiveLoop();
+    void HandleSession(const FrameView& frame);
+    bool FlushClient();
+    bool SetRoom(FrameType type, const std::string& room);
+    void SetConnected(bool value);
+
+    EventCallback onEvent;
+    SocketConfig config;
+    std::atomic<bool> running{false};
+    std::atomic<bool> connected{false};
+    std::atomic<int> connSock{-1};
+    std::thread workerThread;
+    std::vector<std::unique_ptr<Reactor>> reactors;
+    std::vector<std::thread> reactorThreads;
+    std::unique_ptr<ClientLink> link;
+    std::mutex sendMutex;
+    std::atomic<uint64_t> sendSeq{0};
+    // Client mode, guarded by sendMutex: rooms joined, in order.
+    std::vector<std::string> rooms;
+    std::unique_ptr<MessageStore> store;
+    std::unique_ptr<StreamLog> stream;
+    std::unique_ptr<SessionWindows> sessions;
+    std::unique_ptr<RoomShards> roomShards;
+    // Client mode, worker thread only: the sequence numbers received (with
+    // the client's own, which the relay reports in kAckOwn Acks) and the
+    // session they belong to, kept across connections and Start() calls.
+    // Frames arrive out of order from a relay with several reactors, so a
+    // Resume asks for everything after the window's cumulative point and the
+    // window drops what turns up twice. `resuming` is whether this connection
+    // sent a Resume; otherwise frames up to `historyThrough` (the newest when
+    // it was greeted) are requested history, older than the window.
+    AckWindow seen;
+    uint64_t sessionToken{0};
+    uint64_t streamId{0};
+    bool resuming{false};
+    uint64_t historyThrough{0};
+};
+
+} // namespace chat
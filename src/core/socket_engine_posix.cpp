@@ -0,0 +1,562 @@
+#include "core/socket_engine.h"
+#include "core/ack.h"
+#include "core/frame.h"
+#include "core/message_store.h"
+#include "core/reactor.h"
+#include "core/send_queue.h"
+#include "core/stream_log.h"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <utility>
+
+namespace chat {
+
+constexpr size_t kEagerFlushBytes = 64 * 1024;
+constexpr int kMinBackoffMs = 100;
+constexpr int kMaxBackoffMs = 5000;
+
+// Client-side outbound state; guarded by SocketEngine::sendMutex.
+struct ClientLink {
+    SendQueue queue;
+    // Every Text frame sent and not yet acknowledged by the relay, including
+    // those still in `queue`.
+    UnackedFrames unacked;
+    // Set once a connection's Resume and resent frames are queued; until
+    // then Send() only keeps new frames in `unacked`.
+    bool live{false};
+    int wakeFd{-1};
+    int64_t deadlineNs{0};
+    bool wantWrite{false};
+
+    ~ClientLink() {
+        if (wakeFd >= 0) close(wakeFd);
+    }
+
+    void Wake() const {
+        uint64_t one = 1;
+        ssize_t ignored = write(wakeFd, &one, sizeof(one));
+        (void)ignored;
+    }
+};
+
+static void CloseSocket(std::atomic<int>& s) {
+    int fd = s.exchange(-1);
+    if (fd >= 0) close(fd);
+}
+
+static void WakeSocket(const std::atomic<int>& s) {
+    int fd = s.load();
+    if (fd >= 0) shutdown(fd, SHUT_RDWR);
+}
+
+SocketEngine::SocketEngine(EventCallback onEvent) : onEvent(std::move(onEvent)) {}
+
+SocketEngine::~SocketEngine() {
+    Stop();
+}
+
+bool SocketEngine::Start(const SocketConfig& cfg) {
+    if (running) {
+        EmitLog(onEvent, "Already running.");
+        return false;
+    }
+    if (workerThread.joinable()) workerThread.join();
+    config = cfg;
+    running = true;
+    if (config.role == Role::Server) {
+        if (!StartServer()) {
+            reactors.clear();
+            running = false;
+            return false;
+        }
+    } else {
+        link = std::make_unique<ClientLink>();
+        link->wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (link->wakeFd < 0) {
+            EmitLog(onEvent, "Failed to create eventfd.");
+            link.reset();
+            running = false;
+            return false;
+        }
+        workerThread = std::thread(&SocketEngine::RunClient, this);
+    }
+    return true;
+}
+
+void SocketEngine::Stop() {
+    running = false;
+    for (auto& r : reactors) r->Stop();
+    WakeSocket(connSock);
+    {
+        std::lock_guard<std::mutex> lock(sendMutex);
+        if (link) link->Wake();
+    }
+    if (workerThread.joinable()) workerThread.join();
+    for (auto& t : reactorThreads) {
+        if (t.joinable()) t.join();
+    }
+    reactorThreads.clear();
+    reactors.clear();
+    stream.reset();
+    sessions.reset();
+    roomShards.reset();
+    store.reset();
+    {
+        std::lock_guard<std::mutex> lock(sendMutex);
+        CloseSocket(connSock);
+        link.reset();
+    }
+    SetConnected(false);
+}
+
+bool SocketEngine::Connected() const {
+    if (config.role == Role::Server) {
+        if (!running) return false;
+        for (const auto& r : reactors) {
+            if (r->ConnectionCount() > 0) return true;
+        }
+        return false;
+    }
+    return connected;
+}
+
+SocketStats SocketEngine::Stats() const {
+    SocketStats total;
+    for (const auto& r : reactors) {
+        const ShardStats& s = r->Stats();
+        total.syscalls += s.syscalls.load(std::memory_order_relaxed);
+        total.messagesIn += s.messagesIn.load(std::memory_order_relaxed);
+        total.bytesIn += s.bytesIn.load(std::memory_order_relaxed);
+        total.bytesOut += s.bytesOut.load(std::memory_order_relaxed);
+        total.connections += r->ConnectionCount();
+        total.queuedBytes += s.queuedBytes.load(std::memory_order_relaxed);
+        total.queuedFrames += s.queuedFrames.load(std::memory_order_relaxed);
+        uint64_t peak = s.peakQueueBytes.load(std::memory_order_relaxed);
+        if (peak > total.peakQueueBytes) total.peakQueueBytes = peak;
+        total.droppedFrames += s.droppedFrames.load(std::memory_order_relaxed);
+        total.slowDisconnects += s.slowDisconnects.load(std::memory_order_relaxed);
+        total.producerPauses += s.producerPauses.load(std::memory_order_relaxed);
+        total.replayRequests += s.replayRequests.load(std::memory_order_relaxed);
+        total.replayBytes += s.replayBytes.load(std::memory_order_relaxed);
+        total.replaysRefused += s.replaysRefused.load(std::memory_order_relaxed);
+        total.resumes += s.resumes.load(std::memory_order_relaxed);
+        total.resumesFromStore += s.resumesFromStore.load(std::memory_order_relaxed);
+        total.resumeMisses += s.resumeMisses.load(std::memory_order_relaxed);
+        total.storeFailures += s.storeFailures.load(std::memory_order_relaxed);
+        total.acksSent += s.acksSent.load(std::memory_order_relaxed);
+        total.duplicates += s.duplicates.load(std::memory_order_relaxed);
+    }
+    if (store) {
+        StoreStats st = store->Stats();
+        total.storedMessages = st.appended;
+        total.storeSyncs = st.syncs;
+    }
+    return total;
+}
+
+void SocketEngine::SetConnected(bool value) {
+    if (connected.exchange(value) != value) {
+        EmitConnected(onEvent, 0, value);
+    }
+}
+
+void SocketEngine::ReceiveLoop() {
+    RecvBuffer inbuf;
+    FrameDecoder decoder(inbuf);
+    const char* fromLabel = "Server";
+    std::vector<AckRange> ackRanges;
+    while (running) {
+        int fd = connSock.load();
+        if (fd < 0) break;
+
+        int64_t timeoutNs = -1;
+        bool wantOut;
+        {
+            std::lock_guard<std::mutex> lock(sendMutex);
+            wantOut = link->wantWrite;
+            if (!wantOut && link->deadlineNs) {
+                timeoutNs = link->deadlineNs - NowNs();
+                if (timeoutNs < 0) timeoutNs = 0;
+            }
+        }
+        pollfd fds[2] = {
+            {fd, static_cast<short>(POLLIN | (wantOut ? POLLOUT : 0)), 0},
+            {link->wakeFd, POLLIN, 0},
+        };
+        timespec ts{static_cast<time_t>(timeoutNs / 1000000000), static_cast<long>(timeoutNs % 1000000000)};
+        if (ppoll(fds, 2, timeoutNs < 0 ? nullptr : &ts, nullptr) < 0) {
+            if (errno == EINTR) continue;
+            EmitLog(onEvent, "poll failed.");
+            break;
+        }
+        if (!running) break;
+        if (fds[1].revents & POLLIN) {
+            uint64_t count;
+            ssize_t ignored = read(link->wakeFd, &count, sizeof(count));
+            (void)ignored;
+        }
+
+        if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+            size_t want = decoder.Missing() > 4096 ? decoder.Missing() : 4096;
+            char* dst = inbuf.Prepare(want);
+            ssize_t res = recv(fd, dst, inbuf.Writable(), 0);
+            if (res < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)) continue;
+            if (res <= 0) {
+                EmitLog(onEvent, "[!] Disconnected.");
+                SetConnected(false);
+                break;
+            }
+            inbuf.Commit(static_cast<size_t>(res));
+
+            FrameView frame;
+            DecodeResult result;
+            while ((result = decoder.Next(frame)) == DecodeResult::Frame) {
+                if (frame.header.type == FrameType::Session) {
+                    HandleSession(frame);
+                    continue;
+                }
+                if (frame.header.type == FrameType::Ack) {
+                    if (!ReadAck(frame, ackRanges)) continue;
+                    if (frame.header.flags & (kAckOwn | kAckLost)) {
+                        uint64_t lost = 0;
+                        for (const AckRange& r : ackRanges) {
+                            if (!r.first || r.first > r.second) continue;
+                            if (frame.header.flags & kAckLost) lost += r.second - r.first + 1;
+                            // Only the newest kSpan can still matter to the window.
+                            uint64_t count = std::min<uint64_t>(r.second - r.first, AckWindow::kSpan - 1) + 1;
+                            for (uint64_t i = 0; i < count; ++i) seen.Accept(r.second - count + 1 + i);
+                        }
+                        if (lost) {
+                            EmitLog(onEvent, "[!] " + std::to_string(lost) +
+                                                 " missed message(s) are too old for the relay to replay.");
+                        }
+                        continue;
+                    }
+                    std::lock_guard<std::mutex> lock(sendMutex);
+                    link->unacked.Ack(frame.header.seq, ackRanges);
+                    continue;
+                }
+                if (frame.header.type == FrameType::Publish) {
+                    std::string room;
+                    const char* text = nullptr;
+                    size_t len = 0;
+                    if (ReadPublish(frame, room, text, len)) {
+                        EmitMessage(onEvent, 0, "#" + room, std::string(text, len));
+                    }
+                    continue;
+                }
+                if (frame.header.type != FrameType::Text) continue;
+                bool replayed = (frame.header.flags & kFrameReplayed) != 0;
+                if (frame.header.flags & kFrameSequenced) {
+                    bool history = replayed && frame.header.seq <= historyThrough;
+                    if (!history && !seen.Accept(frame.header.seq)) continue;
+                }
+                EmitMessage(onEvent, 0, replayed ? "History" : fromLabel,
+                            std::string(frame.payload, frame.header.length));
+            }
+            if (result == DecodeResult::Error) {
+                EmitLog(onEvent, "[!] Protocol error; disconnecting.");
+                SetConnected(false);
+                break;
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(sendMutex);
+        bool writable = wantOut && (fds[0].revents & POLLOUT);
+        bool due = !link->wantWrite && link->deadlineNs && NowNs() >= link->deadlineNs;
+        if (writable || due) {
+            link->wantWrite = false;
+            FlushClient();
+        }
+    }
+}
+
+// Keeps the token for the next Resume. A different stream id means the relay
+// restarted without its history, so sequence numbers start over. A fresh
+// window starts at the newest message when greeted: anything older is
+// history, and a live frame that old was sent before this client joined.
+void SocketEngine::HandleSession(const FrameView& frame) {
+    uint64_t token = 0;
+    uint64_t id = 0;
+    if (!ReadSession(frame, token, id)) return;
+    if (streamId && id != streamId) {
+        EmitLog(onEvent, "[!] Relay restarted without history; messages since #" +
+                         std::to_string(seen.Cumulative()) + " are lost.");
+        seen = AckWindow();
+    }
+    if (!seen.Started()) {
+        seen.Reset(frame.header.seq);
+        if (!resuming) historyThrough = frame.header.seq;
+    }
+    if (frame.header.flags & kSessionResumed) {
+        uint64_t missed = frame.header.seq > seen.Cumulative() ? frame.header.seq - seen.Cumulative() : 0;
+        EmitLog(onEvent, "Session resumed; " + std::to_string(missed) + " messages to catch up.");
+        bool inRooms;
+        {
+            std::lock_guard<std::mutex> lock(sendMutex);
+            inRooms = !rooms.empty();
+        }
+        if (inRooms && (frame.header.flags & kSessionRoomsLive)) {
+            EmitLog(onEvent, "[!] Room messages sent while disconnected are not replayed.");
+        }
+    }
+    sessionToken = token;
+    streamId = id;
+}
+
+bool SocketEngine::FlushClient() {
+    link->deadlineNs = 0;
+    int fd = connSock.load();
+    if (fd < 0) return false;
+    bool cork = config.tcpCork && link->queue.Frames() > 1;
+    int on = 1, off = 0;
+    if (cork) setsockopt(fd, IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
+    FlushResult result = link->queue.Flush(fd);
+    if (cork) setsockopt(fd, IPPROTO_TCP, TCP_CORK, &off, sizeof(off));
+    if (result == FlushResult::Error) {
+        EmitLog(onEvent, "Send failed.");
+        return false;
+    }
+    if (result == FlushResult::Blocked && !link->wantWrite) {
+        link->wantWrite = true;
+        link->Wake();
+    }
+    return true;
+}
+
+bool SocketEngine::StartServer() {
+    if (!config.store.dir.empty()) {
+        store = std::make_unique<MessageStore>();
+        std::string error;
+        if (!store->Open(config.store, error)) {
+            EmitLog(onEvent, "Message store unavailable: " + error);
+            store.reset();
+            return false;
+        }
+        EmitLog(onEvent, "History in " + config.store.dir + " up to #" + std::to_string(store->Stats().lastSeq));
+    }
+    // RoomShards keeps one bit per shard.
+    int count = std::clamp(config.reactors, 1, static_cast<int>(RoomShards::kMaxShards));
+    std::vector<Reactor*> shards;
+    for (int i = 0; i < count; ++i) {
+        auto r = std::make_unique<Reactor>(config, onEvent, static_cast<unsigned>(i));
+        if (!r->Open()) return false;
+        shards.push_back(r.get());
+        reactors.push_back(std::move(r));
+    }
+    stream = std::make_unique<StreamLog>(config.retransmitFrames, config.retransmitBytes, store.get());
+    sessions = std::make_unique<SessionWindows>();
+    roomShards = std::make_unique<RoomShards>();
+    for (auto& r : reactors) {
+        r->SetPeers(shards);
+        r->SetStore(store.get());
+        r->SetStream(stream.get());
+        r->SetSessions(sessions.get());
+        r->SetRoomShards(roomShards.get());
+    }
+    const char* transport = reactors.front()->UsingUring() ? "io_uring" : "epoll";
+    EmitLog(onEvent, "Listening on port " + std::to_string(config.port) + " with " +
+                     std::to_string(count) + (count == 1 ? " reactor" : " reactors") +
+                     " (" + transport + ")...");
+    for (auto& r : reactors) {
+        reactorThreads.emplace_back([this, shard = r.get()] {
+            shard->Run();
+            running = false;
+        });
+    }
+    return true;
+}
+
+// Sleeps for `ms` unless Stop() wakes the link first.
+void SocketEngine::Backoff(int ms) {
+    int64_t until = NowNs() + int64_t(ms) * 1000000;
+    while (running) {
+        int64_t left = until - NowNs();
+        if (left <= 0) return;
+        pollfd pfd{link->wakeFd, POLLIN, 0};
+        if (poll(&pfd, 1, static_cast<int>((left + 999999) / 1000000)) > 0) {
+            uint64_t count;
+            ssize_t ignored = read(link->wakeFd, &count, sizeof(count));
+            (void)ignored;
+        }
+    }
+}
+
+bool SocketEngine::ConnectClient() {
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(static_cast<uint16_t>(config.port));
+    inet_pton(AF_INET, config.host.c_str(), &addr.sin_addr);
+    int sock = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, IPPROTO_TCP);
+    if (sock < 0) {
+        EmitLog(onEvent, "Failed to create socket.");
+        return false;
+    }
+    connSock = sock;
+    EmitLog(onEvent, "Connecting to " + config.host + ":" + std::to_string(config.port) + "...");
+    if (connect(sock, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+        EmitLog(onEvent, "Connect failed. Check IP/port.");
+        return false;
+    }
+    int noDelay = config.tcpNoDelay ? 1 : 0;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+    return true;
+}
+
+void SocketEngine::RunClient() {
+    in_addr probe{};
+    if (inet_pton(AF_INET, config.host.c_str(), &probe) != 1) {
+        EmitLog(onEvent, "Invalid host address: " + config.host);
+        running = false;
+        return;
+    }
+
+    int backoffMs = 0;
+    while (running) {
+        if (backoffMs) {
+            EmitLog(onEvent, "Reconnecting in " + std::to_string(backoffMs) + " ms...");
+            Backoff(backoffMs);
+            if (!running) break;
+        }
+        if (ConnectClient()) {
+            backoffMs = 0;
+            EmitLog(onEvent, "Connected!");
+            SetConnected(true);
+            // Resume the previous session, or start with recent history, rejoin
+            // rooms, then resend whatever the relay never acknowledged; it
+            // drops the copies it already has.
+            resuming = sessionToken != 0;
+            historyThrough = 0;
+            {
+                std::lock_guard<std::mutex> lock(sendMutex);
+                if (resuming) {
+                    link->queue.Push(EncodeSession(FrameType::Resume, 0, seen.Cumulative(), sessionToken, streamId));
+                } else if (config.historyLast) {
+                    link->queue.Push(EncodeFrame(FrameType::HistoryRequest, static_cast<uint16_t>(HistoryMode::Last),
+                                                 config.historyLast, std::string()));
+                }
+                for (const std::string& room : rooms) link->queue.Push(EncodeFrame(FrameType::Join, 0, 0, room));
+                if (link->unacked.Frames()) {
+                    EmitLog(onEvent, "Resending " + std::to_string(link->unacked.Frames()) +
+                                     " unacknowledged messages.");
+                }
+                for (const UnackedFrames::Entry& e : link->unacked.Entries()) link->queue.Push(e.frame);
+                link->live = true;
+                if (!link->queue.Empty()) FlushClient();
+            }
+            ReceiveLoop();
+            SetConnected(false);
+        }
+        {
+            std::lock_guard<std::mutex> lock(sendMutex);
+            CloseSocket(connSock);
+            // A frame cut off mid-write cannot go out on a new connection;
+            // unacknowledged ones are queued again after reconnecting.
+            link->queue = SendQueue();
+            link->live = false;
+            link->wantWrite = false;
+            link->deadlineNs = 0;
+        }
+        if (!config.reconnect) break;
+        backoffMs = backoffMs ? std::min(backoffMs * 2, kMaxBackoffMs) : kMinBackoffMs;
+    }
+    running = false;
+    SetConnected(false);
+}
+
+bool SocketEngine::Send(const std::string& text) {
+    return SendTo(std::string(), text);
+}
+
+bool SocketEngine::SendTo(const std::string& room, const std::string& text) {
+    size_t payload = text.size() + (room.empty() ? 0 : 1 + room.size());
+    if (text.empty() || room.size() > kMaxRoomName || payload > kMaxFramePayload) return false;
+    if (config.role == Role::Server) {
+        if (!Connected()) {
+            EmitLog(onEvent, "Not connected.");
+            return false;
+        }
+        SharedFrame frame = room.empty() ? stream->Publish(text.data(), text.size(), 0)
+                                         : ShareFrame(EncodePublish(0, room, text.data(), text.size()));
+        for (auto& r : reactors) r->Post(ShardMessage{frame, 0, room});
+        return true;
+    }
+
+    std::lock_guard<std::mutex> lock(sendMutex);
+    // While reconnecting, messages wait to go out with the resent ones.
+    if (!link || !running || (!link->live && !config.reconnect)) {
+        EmitLog(onEvent, "Not connected.");
+        return false;
+    }
+    // The caller is the only producer here, so a full queue pushes back on it
+    // whatever the server-side overflow policy is. Frames count against the
+    // caps until the relay acknowledges them.
+    if (link->unacked.Bytes() + payload + kFrameHeaderSize > config.maxQueueBytes ||
+        link->unacked.Frames() + 1 > config.maxQueueFrames) {
+        EmitLog(onEvent, "Send queue full.");
+        return false;
+    }
+    bool first = link->queue.Empty();
+    uint64_t seq = ++sendSeq;
+    SharedFrame frame = ShareFrame(room.empty() ? EncodeFrame(FrameType::Text, 0, seq, text)
+                                                : EncodePublish(seq, room, text.data(), text.size()));
+    link->unacked.Add(seq, frame);
+    if (!link->live) return true;
+    link->queue.Push(std::move(frame));
+    if (link->wantWrite) return true;
+    if (config.flushWindowUs <= 0 || link->queue.Bytes() >= kEagerFlushBytes) {
+        return FlushClient();
+    }
+    if (first) {
+        link->deadlineNs = NowNs() + int64_t(config.flushWindowUs) * 1000;
+        link->Wake();
+    }
+    return true;
+}
+
+bool SocketEngine::Join(const std::string& room) {
+    return SetRoom(FrameType::Join, room);
+}
+
+bool SocketEngine::Leave(const std::string& room) {
+    return SetRoom(FrameType::Leave, room);
+}
+
+bool SocketEngine::SetRoom(FrameType type, const std::string& room) {
+    if (room.empty() || room.size() > kMaxRoomName) return false;
+    if (config.role == Role::Server) {
+        EmitLog(onEvent, "Only clients join rooms.");
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(sendMutex);
+    if (!link || !running) {
+        EmitLog(onEvent, "Not connected.");
+        return false;
+    }
+    auto it = std::find(rooms.begin(), rooms.end(), room);
+    if ((type == FrameType::Join) == (it != rooms.end())) return true;
+    if (type == FrameType::Join) {
+        rooms.push_back(room);
+    } else {
+        rooms.erase(it);
+    }
+    // Otherwise the next connection joins the current set.
+    if (!link->live) return true;
+    link->queue.Push(EncodeFrame(type, 0, 0, room));
+    if (link->wantWrite) return true;
+    return FlushClient();
+}
+
+} // namespace chat
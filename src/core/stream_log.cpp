@@ -0,0 +1,86 @@
+#include "core/stream_log.h"
+#include "core/message_store.h"
+
+#include <algorithm>
+#include <iterator>
+#include <random>
+#include <utility>
+
+namespace chat {
+
+uint64_t RandomId() {
+    std::random_device rd;
+    uint64_t id = (static_cast<uint64_t>(rd()) << 32) | rd();
+    return id ? id : 1;
+}
+
+StreamLog::StreamLog(size_t maxFrames, size_t maxBytes, MessageStore* store)
+    : maxFrames(maxFrames), maxBytes(maxBytes), store(store) {
+    if (store) {
+        streamId = store->StreamId();
+        nextSeq = store->Stats().lastSeq + 1;
+    } else {
+        streamId = RandomId();
+    }
+}
+
+// The lock only hands out the sequence number and buffers the frame: the
+// store orders its own appends, and the frame is built outside. Publishers
+// can therefore finish out of order, but each frame is in the buffer before
+// it is relayed, so a resume that misses it in Since() gets it live.
+SharedFrame StreamLog::Publish(const char* payload, size_t len, uint64_t origin) {
+    SharedFrame frame;
+    uint64_t seq;
+    if (store) {
+        frame = store->Append(payload, len);
+        if (!frame) {
+            std::string plain;
+            AppendFrame(plain, FrameType::Text, 0, 0, payload, len);
+            return ShareFrame(std::move(plain));
+        }
+        seq = ReadFrameHeader(frame->data()).seq;
+    } else {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            seq = nextSeq++;
+        }
+        std::string encoded;
+        AppendFrame(encoded, FrameType::Text, kFrameSequenced, seq, payload, len);
+        frame = ShareFrame(std::move(encoded));
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    if (seq >= nextSeq) nextSeq = seq + 1;
+    auto at = entries.end();
+    while (at != entries.begin() && std::prev(at)->seq > seq) --at;
+    entries.insert(at, Entry{seq, origin, frame});
+    bytes += frame->size();
+    while (entries.size() > 1 && (entries.size() > maxFrames || bytes > maxBytes)) {
+        bytes -= entries.front().frame->size();
+        entries.pop_front();
+    }
+    return frame;
+}
+
+bool StreamLog::Since(uint64_t seq, uint64_t skipOrigin, std::string& out) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (seq + 1 >= nextSeq) return true;
+    if (entries.empty() || entries.front().seq > seq + 1) return false;
+    auto it = std::lower_bound(entries.begin(), entries.end(), seq + 1,
+        [](const Entry& e, uint64_t s) { return e.seq < s; });
+    for (; it != entries.end(); ++it) {
+        if (it->origin == skipOrigin) continue;
+        size_t at = out.size();
+        out += *it->frame;
+        FrameHeader header = ReadFrameHeader(&out[at]);
+        header.flags |= kFrameReplayed;
+        WriteFrameHeader(&out[at], header);
+    }
+    return true;
+}
+
+uint64_t StreamLog::LastSeq() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return nextSeq - 1;
+}
+
+} // namespace chat
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+
+#include "core/frame.h"
+
+namespace chat {
+
+class MessageStore;
+
+// A random non-zero 64-bit id, for session tokens and stream ids.
+uint64_t RandomId();
+
+// The relay's outbound stream. Every message published through it gets the
+// next sequence number (the MessageStore's, when there is one) and the
+// newest ones stay in a bounded in-memory retransmit buffer, so a client that
+// reconnects is sent only what it missed. Thread-safe; all reactors publish
+// through one StreamLog, which keeps the buffer in sequence order.
+class StreamLog {
+public:
+    StreamLog(size_t maxFrames, size_t maxBytes, MessageStore* store);
+
+    // Stamps and buffers a Text message from the session `origin` (0 for the
+    // relay itself) and returns the frame to relay. Unsequenced, and never
+    // replayed, if the store failed to take it.
+    SharedFrame Publish(const char* payload, size_t len, uint64_t origin);
+    // Appends to `out`, flagged kFrameReplayed, every buffered frame after
+    // `seq` that did not come from `skipOrigin`. False if the buffer no
+    // longer reaches back to `seq + 1`.
+    bool Since(uint64_t seq, uint64_t skipOrigin, std::string& out) const;
+
+    // Identifies this sequence space: sequence numbers from another stream
+    // (a relay restarted without a store) mean nothing here.
+    uint64_t StreamId() const { return streamId; }
+    uint64_t LastSeq() const;
+
+private:
+    struct Entry {
+        uint64_t seq;
+        uint64_t origin;
+        SharedFrame frame;
+    };
+
+    size_t maxFrames;
+    size_t maxBytes;
+    MessageStore* store;
+    uint64_t streamId{0};
+    mutable std::mutex mutex;
+    std::deque<Entry> entries;
+    size_t bytes{0};
+    uint64_t nextSeq{1};
+};
+
+} // namespace chat
@@ -0,0 +1,249 @@
+#include "core/uring.h"
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <vector>
+
+namespace chat {
+
+static int SysSetup(unsigned entries, io_uring_params* p) {
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, p));
+}
+
+static int SysEnter(int fd, unsigned submit, unsigned waitNr, unsigned flags, void* arg, size_t argSize) {
+    return static_cast<int>(syscall(__NR_io_uring_enter, fd, submit, waitNr, flags, arg, argSize));
+}
+
+static int SysRegister(int fd, unsigned op, void* arg, unsigned nr) {
+    return static_cast<int>(syscall(__NR_io_uring_register, fd, op, arg, nr));
+}
+
+bool Uring::SupportsOp(unsigned op) {
+    std::vector<char> storage(sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op), 0);
+    auto* probe = reinterpret_cast<io_uring_probe*>(storage.data());
+    ++syscalls;
+    if (SysRegister(ringFd, IORING_REGISTER_PROBE, probe, 256) < 0) return false;
+    return op <= probe->last_op && (probe->ops[op].flags & IO_URING_OP_SUPPORTED);
+}
+
+Uring::~Uring() {
+    if (bufBase) munmap(bufBase, static_cast<size_t>(bufCount) * bufSize);
+    if (bufRing) munmap(bufRing, bufRingSize);
+    if (sqes) munmap(sqes, sqesSize);
+    if (cqRing && cqRing != sqRing) munmap(cqRing, cqRingSize);
+    if (sqRing) munmap(sqRing, sqRingSize);
+    if (ringFd >= 0) close(ringFd);
+}
+
+bool Uring::Init(unsigned entries) {
+    io_uring_params p{};
+    p.flags = IORING_SETUP_R_DISABLED | IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_COOP_TASKRUN;
+    ringFd = SysSetup(entries, &p);
+    if (ringFd < 0 && errno == EINVAL) {
+        p = io_uring_params{};
+        p.flags = IORING_SETUP_R_DISABLED;
+        ringFd = SysSetup(entries, &p);
+    }
+    if (ringFd < 0) return false;
+    // Timed waits rely on EXT_ARG (5.11); multishot ops need far newer
+    // kernels anyway, so anything older is rejected here.
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_EXT_ARG)) return false;
+    // Multishot recv cannot be probed for directly; it shipped in the same
+    // release (6.0) as IORING_OP_SEND_ZC, which can.
+    if (!SupportsOp(IORING_OP_SEND_ZC)) return false;
+
+    sqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    if (cqRingSize > sqRingSize) sqRingSize = cqRingSize;
+    cqRingSize = sqRingSize;
+    sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+    if (sqRing == MAP_FAILED) {
+        sqRing = nullptr;
+        return false;
+    }
+    cqRing = sqRing;
+    sqesSize = p.sq_entries * sizeof(io_uring_sqe);
+    void* s = mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+    if (s == MAP_FAILED) return false;
+    sqes = static_cast<io_uring_sqe*>(s);
+
+    char* sq = static_cast<char*>(sqRing);
+    sqHead = reinterpret_cast<unsigned*>(sq + p.sq_off.head);
+    sqTail = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+    sqMask = *reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+    sqEntries = p.sq_entries;
+    sqArray = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+    sqLocalTail = sqSubmitted = *sqTail;
+
+    char* cq = static_cast<char*>(cqRing);
+    cqHead = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+    cqTail = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+    cqMask = *reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+    cqes = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+    return true;
+}
+
+bool Uring::Enable() {
+    ++syscalls;
+    return SysRegister(ringFd, IORING_REGISTER_ENABLE_RINGS, nullptr, 0) == 0;
+}
+
+bool Uring::InitBuffers(unsigned count, unsigned size, uint16_t group) {
+    if (count == 0 || (count & (count - 1)) != 0 || count > 32768) return false;
+    void* b = mmap(nullptr, static_cast<size_t>(count) * size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                   -1, 0);
+    if (b == MAP_FAILED) return false;
+    bufBase = static_cast<char*>(b);
+    bufCount = count;
+    bufSize = size;
+    bufMask = count - 1;
+    bufGroup = group;
+
+    bufRingSize = count * sizeof(io_uring_buf);
+    void* r = mmap(nullptr, bufRingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (r != MAP_FAILED) {
+        bufRing = static_cast<io_uring_buf_ring*>(r);
+        io_uring_buf_reg reg{};
+        reg.ring_addr = reinterpret_cast<uint64_t>(bufRing);
+        reg.ring_entries = count;
+        reg.bgid = group;
+        ++syscalls;
+        if (SysRegister(ringFd, IORING_REGISTER_PBUF_RING, &reg, 1) == 0) {
+            for (unsigned i = 0; i < count; ++i) RecycleBuffer(static_cast<uint16_t>(i));
+            PublishBuffers();
+            if (ProbeBufferRing()) return true;
+            io_uring_buf_reg unreg{};
+            unreg.bgid = group;
+            ++syscalls;
+            SysRegister(ringFd, IORING_UNREGISTER_PBUF_RING, &unreg, 1);
+        }
+        munmap(bufRing, bufRingSize);
+        bufRing = nullptr;
+    }
+
+    // Some kernels accept the ring registration but never hand its buffers
+    // out; classic provided buffers work everywhere multishot recv does.
+    legacyBuffers = true;
+    returned.reserve(count);
+    for (unsigned i = 0; i < count; ++i) RecycleBuffer(static_cast<uint16_t>(i));
+    PublishBuffers();
+    return Submit(0, 0) >= 0;
+}
+
+// Reads one byte through the buffer group and checks a buffer was selected.
+bool Uring::ProbeBufferRing() {
+    int fds[2];
+    if (pipe(fds) < 0) return false;
+    char byte = 0;
+    bool ok = write(fds[1], &byte, 1) == 1;
+    io_uring_sqe* sqe = ok ? GetSqe() : nullptr;
+    if (sqe) {
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = fds[0];
+        sqe->off = static_cast<uint64_t>(-1);
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = bufGroup;
+        ok = Submit(1, 1000000000) >= 0;
+    }
+    bool selected = false;
+    ForEachCqe([&](const io_uring_cqe& cqe) {
+        if (cqe.res != 1 || !(cqe.flags & IORING_CQE_F_BUFFER)) return;
+        selected = true;
+        RecycleBuffer(static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT));
+    });
+    PublishBuffers();
+    close(fds[0]);
+    close(fds[1]);
+    return ok && selected;
+}
+
+void Uring::RecycleBuffer(uint16_t bid) {
+    if (legacyBuffers) {
+        returned.push_back(bid);
+        return;
+    }
+    io_uring_buf& buf = bufRing->bufs[bufTail & bufMask];
+    buf.addr = reinterpret_cast<uint64_t>(Buffer(bid));
+    buf.len = bufSize;
+    buf.bid = bid;
+    ++bufTail;
+}
+
+void Uring::PublishBuffers() {
+    if (!legacyBuffers) {
+        __atomic_store_n(&bufRing->tail, bufTail, __ATOMIC_RELEASE);
+        return;
+    }
+    // Hand buffers back in runs of consecutive ids, one SQE per run.
+    std::sort(returned.begin(), returned.end());
+    size_t i = 0;
+    while (i < returned.size()) {
+        size_t j = i + 1;
+        while (j < returned.size() && returned[j] == returned[j - 1] + 1) ++j;
+        io_uring_sqe* sqe = GetSqe();
+        if (!sqe) {
+            Submit(0, 0);
+            sqe = GetSqe();
+            if (!sqe) break;
+        }
+        sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+        sqe->fd = static_cast<int>(j - i);
+        sqe->addr = reinterpret_cast<uint64_t>(Buffer(returned[i]));
+        sqe->len = bufSize;
+        sqe->off = returned[i];
+        sqe->buf_group = bufGroup;
+        sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+        i = j;
+    }
+    returned.erase(returned.begin(), returned.begin() + static_cast<std::ptrdiff_t>(i));
+}
+
+io_uring_sqe* Uring::GetSqe() {
+    unsigned head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+    if (sqLocalTail - head >= sqEntries) return nullptr;
+    unsigned idx = sqLocalTail & sqMask;
+    io_uring_sqe* sqe = &sqes[idx];
+    std::memset(sqe, 0, sizeof(*sqe));
+    sqArray[idx] = idx;
+    ++sqLocalTail;
+    return sqe;
+}
+
+int Uring::Submit(unsigned waitNr, int64_t timeoutNs) {
+    __atomic_store_n(sqTail, sqLocalTail, __ATOMIC_RELEASE);
+    unsigned toSubmit = sqLocalTail - sqSubmitted;
+    unsigned flags = waitNr ? IORING_ENTER_GETEVENTS : 0;
+    if (toSubmit == 0 && waitNr == 0) return 0;
+
+    __kernel_timespec ts{};
+    io_uring_getevents_arg arg{};
+    void* argPtr = nullptr;
+    size_t argSize = 0;
+    if (waitNr && timeoutNs >= 0) {
+        ts.tv_sec = timeoutNs / 1000000000;
+        ts.tv_nsec = timeoutNs % 1000000000;
+        arg.ts = reinterpret_cast<uint64_t>(&ts);
+        flags |= IORING_ENTER_EXT_ARG;
+        argPtr = &arg;
+        argSize = sizeof(arg);
+    }
+    ++syscalls;
+    int n = SysEnter(ringFd, toSubmit, waitNr, flags, argPtr, argSize);
+    if (n >= 0) {
+        sqSubmitted += static_cast<unsigned>(n);
+        return n;
+    }
+    if (errno == ETIME || errno == EINTR) {
+        // The wait timed out or was interrupted; the submission still happened.
+        sqSubmitted = sqLocalTail;
+        return 0;
+    }
+    return -errno;
+}
+
+} // namespace chat
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <linux/io_uring.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace chat {
+
+// Minimal io_uring wrapper over the raw syscalls (no liburing dependency):
+// SQ/CQ ring mapping, batched submission with an optional wait timeout, and
+// one group of provided buffers for multishot receives. The group is a
+// registered buffer ring where that works and falls back to classic
+// IORING_OP_PROVIDE_BUFFERS otherwise; completions of those carry user_data 0.
+class Uring {
+public:
+    Uring() = default;
+    ~Uring();
+    Uring(const Uring&) = delete;
+    Uring& operator=(const Uring&) = delete;
+
+    bool Init(unsigned entries);
+    // The ring starts disabled so it can be set up on one thread and driven
+    // from another; Enable() binds it to the calling (sole submitting) thread.
+    bool Enable();
+    // Call after Enable() and before anything else is queued: it submits and
+    // reaps a probe read of its own.
+    bool InitBuffers(unsigned count, unsigned size, uint16_t group);
+
+    // Returns nullptr when the submission queue is full; call Submit(0, 0)
+    // to hand the queued entries to the kernel and try again.
+    io_uring_sqe* GetSqe();
+    unsigned SqSpace() const { return sqEntries - (sqLocalTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE)); }
+    int Submit(unsigned waitNr, int64_t timeoutNs);
+
+    // Hands up to `max` ready completions to fn and returns how many it saw.
+    template <typename Fn>
+    unsigned ForEachCqe(Fn&& fn, unsigned max = ~0u) {
+        unsigned head = *cqHead;
+        unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+        unsigned seen = 0;
+        for (; head != tail && seen < max; ++head, ++seen) {
+            fn(cqes[head & cqMask]);
+        }
+        __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+        return seen;
+    }
+
+    char* Buffer(uint16_t bid) const { return bufBase + static_cast<size_t>(bid) * bufSize; }
+    void RecycleBuffer(uint16_t bid);
+    void PublishBuffers();
+    uint16_t BufferGroup() const { return bufGroup; }
+
+    uint64_t Syscalls() const { return syscalls; }
+
+private:
+    int ringFd{-1};
+    unsigned* sqHead{nullptr};
+    unsigned* sqTail{nullptr};
+    unsigned* sqArray{nullptr};
+    unsigned sqMask{0};
+    unsigned sqEntries{0};
+    unsigned sqLocalTail{0};
+    unsigned sqSubmitted{0};
+    io_uring_sqe* sqes{nullptr};
+    unsigned* cqHead{nullptr};
+    unsigned* cqTail{nullptr};
+    unsigned cqMask{0};
+    io_uring_cqe* cqes{nullptr};
+    void* sqRing{nullptr};
+    size_t sqRingSize{0};
+    void* cqRing{nullptr};
+    size_t cqRingSize{0};
+    size_t sqesSize{0};
+
+    bool SupportsOp(unsigned op);
+    bool ProbeBufferRing();
+
+    io_uring_buf_ring* bufRing{nullptr};
+    size_t bufRingSize{0};
+    char* bufBase{nullptr};
+    unsigned bufCount{0};
+    unsigned bufSize{0};
+    unsigned bufMask{0};
+    uint16_t bufTail{0};
+    uint16_t bufGroup{0};
+    bool legacyBuffers{false};
+    std::vector<uint16_t> returned;
+
+    uint64_t syscalls{0};
+};
+
+} // namespace chat
@@ -0,0 +1,606 @@
+#include "core/utf.h"
+
+#include <atomic>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CHAT_UTF_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define CHAT_TARGET_AVX2
+#else
+#define CHAT_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define CHAT_UTF_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace chat {
+
+// The vector kernels below only ever handle ASCII: each converts the leading
+// run of ASCII units of its input a whole vector at a time and returns how
+// long that run was. Everything else goes through the scalar code points in
+// the loops further down, which re-enter a kernel at the next ASCII unit.
+// Kernels may store a full vector past the end of the run, which is always
+// inside the caller's worst-case output buffer (see utf.h). The AVX2 ones
+// hand their tail to the SSE2 ones, clearing the upper halves of the vector
+// registers first to avoid the AVX-to-SSE transition penalty.
+struct UtfKernels {
+    SimdLevel level;
+    size_t (*asciiPrefix)(const unsigned char* in, size_t len);
+    size_t (*asciiToUtf16)(const unsigned char* in, size_t len, char16_t* out);
+    size_t (*asciiToUtf32)(const unsigned char* in, size_t len, char32_t* out);
+    size_t (*utf16AsciiToUtf8)(const char16_t* in, size_t len, char* out);
+    size_t (*utf32AsciiToUtf8)(const char32_t* in, size_t len, char* out);
+};
+
+constexpr char32_t kReplacement = 0xFFFD;
+
+// ---- scalar ------------------------------------------------------------------
+
+static size_t AsciiPrefixScalar(const unsigned char* in, size_t len) {
+    size_t i = 0;
+    while (i < len && in[i] < 0x80) ++i;
+    return i;
+}
+
+static size_t AsciiToUtf16Scalar(const unsigned char* in, size_t len, char16_t* out) {
+    size_t i = 0;
+    for (; i < len && in[i] < 0x80; ++i) out[i] = in[i];
+    return i;
+}
+
+static size_t AsciiToUtf32Scalar(const unsigned char* in, size_t len, char32_t* out) {
+    size_t i = 0;
+    for (; i < len && in[i] < 0x80; ++i) out[i] = in[i];
+    return i;
+}
+
+static size_t Utf16AsciiToUtf8Scalar(const char16_t* in, size_t len, char* out) {
+    size_t i = 0;
+    for (; i < len && in[i] < 0x80; ++i) out[i] = static_cast<char>(in[i]);
+    return i;
+}
+
+static size_t Utf32AsciiToUtf8Scalar(const char32_t* in, size_t len, char* out) {
+    size_t i = 0;
+    for (; i < len && in[i] < 0x80; ++i) out[i] = static_cast<char>(in[i]);
+    return i;
+}
+
+static const UtfKernels kScalarKernels{SimdLevel::Scalar, AsciiPrefixScalar, AsciiToUtf16Scalar, AsciiToUtf32Scalar,
+                                       Utf16AsciiToUtf8Scalar, Utf32AsciiToUtf8Scalar};
+
+// ---- SSE2 / AVX2 -------------------------------------------------------------
+
+#ifdef CHAT_UTF_X86
+
+static unsigned LowestBit(unsigned mask) {
+#if defined(_MSC_VER) && !defined(__clang__)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return static_cast<unsigned>(index);
+#else
+    return static_cast<unsigned>(__builtin_ctz(mask));
+#endif
+}
+
+static size_t AsciiPrefixSse2(const unsigned char* in, size_t len) {
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+        unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(v));
+        if (mask) return i + LowestBit(mask);
+    }
+    return i + AsciiPrefixScalar(in + i, len - i);
+}
+
+static size_t AsciiToUtf16Sse2(const unsigned char* in, size_t len, char16_t* out) {
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_unpacklo_epi8(v, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i + 8), _mm_unpackhi_epi8(v, zero));
+        unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(v));
+        if (mask) return i + LowestBit(mask);
+    }
+    return i + AsciiToUtf16Scalar(in + i, len - i, out + i);
+}
+
+static size_t AsciiToUtf32Sse2(const unsigned char* in, size_t len, char32_t* out) {
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+        __m128i lo = _mm_unpacklo_epi8(v, zero);
+        __m128i hi = _mm_unpackhi_epi8(v, zero);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_unpacklo_epi16(lo, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i + 4), _mm_unpackhi_epi16(lo, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i + 8), _mm_unpacklo_epi16(hi, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i + 12), _mm_unpackhi_epi16(hi, zero));
+        unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(v));
+        if (mask) return i + LowestBit(mask);
+    }
+    return i + AsciiToUtf32Scalar(in + i, len - i, out + i);
+}
+
+static size_t Utf16AsciiToUtf8Sse2(const char16_t* in, size_t len, char* out) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i high = _mm_set1_epi16(static_cast<short>(0xFF80));
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(out + i), _mm_packus_epi16(v, v));
+        unsigned ascii = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(v, high), zero)));
+        if (ascii != 0xFFFF) return i + LowestBit(~ascii & 0xFFFF) / 2;
+    }
+    return i + Utf16AsciiToUtf8Scalar(in + i, len - i, out + i);
+}
+
+static size_t Utf32AsciiToUtf8Sse2(const char32_t* in, size_t len, char* out) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i high = _mm_set1_epi32(static_cast<int>(0xFFFFFF80));
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i + 4));
+        __m128i words = _mm_packs_epi32(a, b);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(out + i), _mm_packus_epi16(words, words));
+        unsigned ascii = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(a, high), zero))) |
+                         static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(b, high), zero))) << 16;
+        if (ascii != 0xFFFFFFFFu) return i + LowestBit(~ascii) / 4;
+    }
+    return i + Utf32AsciiToUtf8Scalar(in + i, len - i, out + i);
+}
+
+static const UtfKernels kSse2Kernels{SimdLevel::Sse2, AsciiPrefixSse2, AsciiToUtf16Sse2, AsciiToUtf32Sse2,
+                                     Utf16AsciiToUtf8Sse2, Utf32AsciiToUtf8Sse2};
+
+CHAT_TARGET_AVX2 static size_t AsciiPrefixAvx2(const unsigned char* in, size_t len) {
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        unsigned mask =
+            static_cast<unsigned>(_mm256_movemask_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i))));
+        if (mask) return i + LowestBit(mask);
+    }
+    _mm256_zeroupper();
+    return i + AsciiPrefixSse2(in + i, len - i);
+}
+
+CHAT_TARGET_AVX2 static size_t AsciiToUtf16Avx2(const unsigned char* in, size_t len, char16_t* out) {
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_cvtepu8_epi16(_mm256_castsi256_si128(v)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i + 16),
+                            _mm256_cvtepu8_epi16(_mm256_extracti128_si256(v, 1)));
+        unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(v));
+        if (mask) return i + LowestBit(mask);
+    }
+    _mm256_zeroupper();
+    return i + AsciiToUtf16Sse2(in + i, len - i, out + i);
+}
+
+CHAT_TARGET_AVX2 static size_t AsciiToUtf32Avx2(const unsigned char* in, size_t len, char32_t* out) {
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+        for (size_t k = 0; k < 32; k += 8) {
+            __m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(in + i + k));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i + k), _mm256_cvtepu8_epi32(bytes));
+        }
+        unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(v));
+        if (mask) return i + LowestBit(mask);
+    }
+    _mm256_zeroupper();
+    return i + AsciiToUtf32Sse2(in + i, len - i, out + i);
+}
+
+CHAT_TARGET_AVX2 static size_t Utf16AsciiToUtf8Avx2(const char16_t* in, size_t len, char* out) {
+    const __m256i high = _mm256_set1_epi16(static_cast<short>(0xFF80));
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+        __m128i packed = _mm_packus_epi16(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), packed);
+        unsigned ascii = static_cast<unsigned>(
+            _mm256_movemask_epi8(_mm256_cmpeq_epi16(_mm256_and_si256(v, high), _mm256_setzero_si256())));
+        if (ascii != 0xFFFFFFFFu) return i + LowestBit(~ascii) / 2;
+    }
+    _mm256_zeroupper();
+    return i + Utf16AsciiToUtf8Sse2(in + i, len - i, out + i);
+}
+
+CHAT_TARGET_AVX2 static size_t Utf32AsciiToUtf8Avx2(const char32_t* in, size_t len, char* out) {
+    const __m256i high = _mm256_set1_epi32(static_cast<int>(0xFFFFFF80));
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i + 8));
+        // Both packs work per 128-bit lane; the permute puts the bytes back
+        // in order.
+        __m256i words = _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), 0xD8);
+        __m128i packed = _mm_packus_epi16(_mm256_castsi256_si128(words), _mm256_extracti128_si256(words, 1));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), packed);
+        __m256i zero = _mm256_setzero_si256();
+        __m256i aAscii = _mm256_cmpeq_epi32(_mm256_and_si256(a, high), zero);
+        __m256i bAscii = _mm256_cmpeq_epi32(_mm256_and_si256(b, high), zero);
+        uint64_t ascii = static_cast<uint32_t>(_mm256_movemask_epi8(aAscii)) |
+                         uint64_t(static_cast<uint32_t>(_mm256_movemask_epi8(bAscii))) << 32;
+        if (~ascii) {
+            uint64_t bad = ~ascii;
+            unsigned bit = static_cast<uint32_t>(bad) ? LowestBit(static_cast<uint32_t>(bad))
+                                                      : 32 + LowestBit(static_cast<uint32_t>(bad >> 32));
+            return i + bit / 4;
+        }
+    }
+    _mm256_zeroupper();
+    return i + Utf32AsciiToUtf8Sse2(in + i, len - i, out + i);
+}
+
+static const UtfKernels kAvx2Kernels{SimdLevel::Avx2, AsciiPrefixAvx2, AsciiToUtf16Avx2, AsciiToUtf32Avx2,
+                                     Utf16AsciiToUtf8Avx2, Utf32AsciiToUtf8Avx2};
+
+static bool CpuHasAvx2() {
+#if defined(_MSC_VER) && !defined(__clang__)
+    int regs[4];
+    __cpuid(regs, 0);
+    if (regs[0] < 7) return false;
+    __cpuid(regs, 1);
+    // The OS must save the YMM registers, or AVX2 code faults.
+    bool osSavesYmm = (regs[2] & (1 << 27)) && (_xgetbv(0) & 6) == 6;
+    __cpuidex(regs, 7, 0);
+    return osSavesYmm && (regs[1] & (1 << 5));
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif // CHAT_UTF_X86
+
+// ---- NEON --------------------------------------------------------------------
+
+#ifdef CHAT_UTF_NEON
+
+static size_t AsciiPrefixNeon(const unsigned char* in, size_t len) {
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        if (vmaxvq_u8(vld1q_u8(in + i)) >= 0x80) break;
+    }
+    return i + AsciiPrefixScalar(in + i, len - i);
+}
+
+static size_t AsciiToUtf16Neon(const unsigned char* in, size_t len, char16_t* out) {
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        uint8x16_t v = vld1q_u8(in + i);
+        uint16_t* dst = reinterpret_cast<uint16_t*>(out + i);
+        vst1q_u16(dst, vmovl_u8(vget_low_u8(v)));
+        vst1q_u16(dst + 8, vmovl_u8(vget_high_u8(v)));
+        if (vmaxvq_u8(v) >= 0x80) return i + AsciiPrefixScalar(in + i, 16);
+    }
+    return i + AsciiToUtf16Scalar(in + i, len - i, out + i);
+}
+
+static size_t AsciiToUtf32Neon(const unsigned char* in, size_t len, char32_t* out) {
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        uint8x16_t v = vld1q_u8(in + i);
+        uint16x8_t lo = vmovl_u8(vget_low_u8(v));
+        uint16x8_t hi = vmovl_u8(vget_high_u8(v));
+        uint32_t* dst = reinterpret_cast<uint32_t*>(out + i);
+        vst1q_u32(dst, vmovl_u16(vget_low_u16(lo)));
+        vst1q_u32(dst + 4, vmovl_u16(vget_high_u16(lo)));
+        vst1q_u32(dst + 8, vmovl_u16(vget_low_u16(hi)));
+        vst1q_u32(dst + 12, vmovl_u16(vget_high_u16(hi)));
+        if (vmaxvq_u8(v) >= 0x80) return i + AsciiPrefixScalar(in + i, 16);
+    }
+    return i + AsciiToUtf32Scalar(in + i, len - i, out + i);
+}
+
+static size_t Utf16AsciiToUtf8Neon(const char16_t* in, size_t len, char* out) {
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint16x8_t v = vld1q_u16(reinterpret_cast<const uint16_t*>(in + i));
+        vst1_u8(reinterpret_cast<uint8_t*>(out + i), vqmovn_u16(v));
+        if (vmaxvq_u16(v) >= 0x80) return i + Utf16AsciiToUtf8Scalar(in + i, 8, out + i);
+    }
+    return i + Utf16AsciiToUtf8Scalar(in + i, len - i, out + i);
+}
+
+static size_t Utf32AsciiToUtf8Neon(const char32_t* in, size_t len, char* out) {
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint32x4_t a = vld1q_u32(reinterpret_cast<const uint32_t*>(in + i));
+        uint32x4_t b = vld1q_u32(reinterpret_cast<const uint32_t*>(in + i + 4));
+        uint16x8_t words = vcombine_u16(vqmovn_u32(a), vqmovn_u32(b));
+        vst1_u8(reinterpret_cast<uint8_t*>(out + i), vqmovn_u16(words));
+        if (vmaxvq_u32(vmaxq_u32(a, b)) >= 0x80) return i + Utf32AsciiToUtf8Scalar(in + i, 8, out + i);
+    }
+    return i + Utf32AsciiToUtf8Scalar(in + i, len - i, out + i);
+}
+
+static const UtfKernels kNeonKernels{SimdLevel::Neon, AsciiPrefixNeon, AsciiToUtf16Neon, AsciiToUtf32Neon,
+                                     Utf16AsciiToUtf8Neon, Utf32AsciiToUtf8Neon};
+
+#endif // CHAT_UTF_NEON
+
+// ---- dispatch ----------------------------------------------------------------
+
+static const UtfKernels* KernelsFor(SimdLevel level) {
+    switch (level) {
+#ifdef CHAT_UTF_X86
+    case SimdLevel::Avx2:
+        if (DetectedSimdLevel() == SimdLevel::Avx2) return &kAvx2Kernels;
+        return &kSse2Kernels;
+    case SimdLevel::Sse2:
+        return &kSse2Kernels;
+#endif
+#ifdef CHAT_UTF_NEON
+    case SimdLevel::Neon:
+        return &kNeonKernels;
+#endif
+    default:
+        return &kScalarKernels;
+    }
+}
+
+static std::atomic<const UtfKernels*> activeKernels{nullptr};
+
+static const UtfKernels& Active() {
+    const UtfKernels* k = activeKernels.load(std::memory_order_acquire);
+    if (!k) {
+        k = KernelsFor(DetectedSimdLevel());
+        activeKernels.store(k, std::memory_order_release);
+    }
+    return *k;
+}
+
+SimdLevel DetectedSimdLevel() {
+#if defined(CHAT_UTF_X86)
+    static const SimdLevel level = CpuHasAvx2() ? SimdLevel::Avx2 : SimdLevel::Sse2;
+    return level;
+#elif defined(CHAT_UTF_NEON)
+    return SimdLevel::Neon;
+#else
+    return SimdLevel::Scalar;
+#endif
+}
+
+SimdLevel ActiveSimdLevel() {
+    return Active().level;
+}
+
+SimdLevel SetSimdLevel(SimdLevel level) {
+    const UtfKernels* k = KernelsFor(level);
+    activeKernels.store(k, std::memory_order_release);
+    return k->level;
+}
+
+const char* SimdLevelName(SimdLevel level) {
+    switch (level) {
+    case SimdLevel::Sse2: return "sse2";
+    case SimdLevel::Avx2: return "avx2";
+    case SimdLevel::Neon: return "neon";
+    default: return "scalar";
+    }
+}
+
+// ---- code points -------------------------------------------------------------
+
+// Length of the well-formed sequence at `s` with its code point in `cp`, or 0
+// (Unicode 15, table 3-7).
+static size_t DecodeUtf8(const unsigned char* s, size_t avail, char32_t& cp) {
+    unsigned char b0 = s[0];
+    if (b0 < 0x80) {
+        cp = b0;
+        return 1;
+    }
+    auto cont = [s](size_t i) { return (s[i] & 0xC0) == 0x80; };
+    if (b0 < 0xC2) return 0;
+    if (b0 < 0xE0) {
+        if (avail < 2 || !cont(1)) return 0;
+        cp = (char32_t(b0 & 0x1F) << 6) | (s[1] & 0x3F);
+        return 2;
+    }
+    if (b0 < 0xF0) {
+        if (avail < 3 || !cont(1) || !cont(2)) return 0;
+        if ((b0 == 0xE0 && s[1] < 0xA0) || (b0 == 0xED && s[1] >= 0xA0)) return 0;
+        cp = (char32_t(b0 & 0x0F) << 12) | (char32_t(s[1] & 0x3F) << 6) | (s[2] & 0x3F);
+        return 3;
+    }
+    if (b0 < 0xF5) {
+        if (avail < 4 || !cont(1) || !cont(2) || !cont(3)) return 0;
+        if ((b0 == 0xF0 && s[1] < 0x90) || (b0 == 0xF4 && s[1] >= 0x90)) return 0;
+        cp = (char32_t(b0 & 0x07) << 18) | (char32_t(s[1] & 0x3F) << 12) | (char32_t(s[2] & 0x3F) << 6) | (s[3] & 0x3F);
+        return 4;
+    }
+    return 0;
+}
+
+static size_t DecodeUtf16(const char16_t* s, size_t avail, char32_t& cp) {
+    char16_t u = s[0];
+    if (u < 0xD800 || u > 0xDFFF) {
+        cp = u;
+        return 1;
+    }
+    if (u > 0xDBFF || avail < 2 || s[1] < 0xDC00 || s[1] > 0xDFFF) return 0;
+    cp = 0x10000 + ((char32_t(u) - 0xD800) << 10) + (char32_t(s[1]) - 0xDC00);
+    return 2;
+}
+
+static size_t EncodeUtf8(char32_t cp, char* out) {
+    if (cp < 0x80) {
+        out[0] = static_cast<char>(cp);
+        return 1;
+    }
+    if (cp < 0x800) {
+        out[0] = static_cast<char>(0xC0 | (cp >> 6));
+        out[1] = static_cast<char>(0x80 | (cp & 0x3F));
+        return 2;
+    }
+    if (cp < 0x10000) {
+        out[0] = static_cast<char>(0xE0 | (cp >> 12));
+        out[1] = static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+        out[2] = static_cast<char>(0x80 | (cp & 0x3F));
+        return 3;
+    }
+    out[0] = static_cast<char>(0xF0 | (cp >> 18));
+    out[1] = static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+    out[2] = static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+    out[3] = static_cast<char>(0x80 | (cp & 0x3F));
+    return 4;
+}
+
+static size_t EncodeUtf16(char32_t cp, char16_t* out) {
+    if (cp < 0x10000) {
+        out[0] = static_cast<char16_t>(cp);
+        return 1;
+    }
+    cp -= 0x10000;
+    out[0] = static_cast<char16_t>(0xD800 + (cp >> 10));
+    out[1] = static_cast<char16_t>(0xDC00 + (cp & 0x3FF));
+    return 2;
+}
+
+// ---- conversions -------------------------------------------------------------
+
+// A lone ASCII unit between non-ASCII ones, typically a space or punctuation
+// in non-Latin text, is not worth a trip into a vector kernel.
+template <typename Unit>
+static bool ShortAscii(const Unit* in, size_t i, size_t len) {
+    return i + 1 < len && in[i + 1] >= 0x80;
+}
+
+template <bool kLossy>
+static TranscodeResult Utf8ToUtf16Impl(const char* in, size_t len, char16_t* out) {
+    const UtfKernels& k = Active();
+    const auto* s = reinterpret_cast<const unsigned char*>(in);
+    size_t i = 0;
+    size_t o = 0;
+    while (i < len) {
+        if (s[i] < 0x80) {
+            size_t n = ShortAscii(s, i, len) ? AsciiToUtf16Scalar(s + i, 1, out + o)
+                                             : k.asciiToUtf16(s + i, len - i, out + o);
+            i += n;
+            o += n;
+            continue;
+        }
+        char32_t cp;
+        size_t n = DecodeUtf8(s + i, len - i, cp);
+        if (!n) {
+            if (!kLossy) return {false, i, o};
+            cp = kReplacement;
+            n = 1;
+        }
+        o += EncodeUtf16(cp, out + o);
+        i += n;
+    }
+    return {true, i, o};
+}
+
+template <bool kLossy>
+static TranscodeResult Utf16ToUtf8Impl(const char16_t* in, size_t len, char* out) {
+    const UtfKernels& k = Active();
+    size_t i = 0;
+    size_t o = 0;
+    while (i < len) {
+        if (in[i] < 0x80) {
+            size_t n = ShortAscii(in, i, len) ? Utf16AsciiToUtf8Scalar(in + i, 1, out + o)
+                                              : k.utf16AsciiToUtf8(in + i, len - i, out + o);
+            i += n;
+            o += n;
+            continue;
+        }
+        char32_t cp;
+        size_t n = DecodeUtf16(in + i, len - i, cp);
+        if (!n) {
+            if (!kLossy) return {false, i, o};
+            cp = kReplacement;
+            n = 1;
+        }
+        o += EncodeUtf8(cp, out + o);
+        i += n;
+    }
+    return {true, i, o};
+}
+
+bool ValidUtf8(const char* in, size_t len) {
+    const UtfKernels& k = Active();
+    const auto* s = reinterpret_cast<const unsigned char*>(in);
+    size_t i = 0;
+    while (i < len) {
+        if (s[i] < 0x80) {
+            i += ShortAscii(s, i, len) ? 1 : k.asciiPrefix(s + i, len - i);
+            continue;
+        }
+        char32_t cp;
+        size_t n = DecodeUtf8(s + i, len - i, cp);
+        if (!n) return false;
+        i += n;
+    }
+    return true;
+}
+
+TranscodeResult Utf8ToUtf16(const char* in, size_t len, char16_t* out) {
+    return Utf8ToUtf16Impl<false>(in, len, out);
+}
+
+TranscodeResult Utf16ToUtf8(const char16_t* in, size_t len, char* out) {
+    return Utf16ToUtf8Impl<false>(in, len, out);
+}
+
+size_t Utf8ToUtf16Lossy(const char* in, size_t len, char16_t* out) {
+    return Utf8ToUtf16Impl<true>(in, len, out).written;
+}
+
+size_t Utf16ToUtf8Lossy(const char16_t* in, size_t len, char* out) {
+    return Utf16ToUtf8Impl<true>(in, len, out).written;
+}
+
+TranscodeResult Utf8ToUtf32(const char* in, size_t len, char32_t* out) {
+    const UtfKernels& k = Active();
+    const auto* s = reinterpret_cast<const unsigned char*>(in);
+    size_t i = 0;
+    size_t o = 0;
+    while (i < len) {
+        if (s[i] < 0x80) {
+            size_t n = ShortAscii(s, i, len) ? AsciiToUtf32Scalar(s + i, 1, out + o)
+                                             : k.asciiToUtf32(s + i, len - i, out + o);
+            i += n;
+            o += n;
+            continue;
+        }
+        size_t n = DecodeUtf8(s + i, len - i, out[o]);
+        if (!n) return {false, i, o};
+        ++o;
+        i += n;
+    }
+    return {true, i, o};
+}
+
+TranscodeResult Utf32ToUtf8(const char32_t* in, size_t len, char* out) {
+    const UtfKernels& k = Active();
+    size_t i = 0;
+    size_t o = 0;
+    while (i < len) {
+        char32_t cp = in[i];
+        if (cp < 0x80) {
+            size_t n = ShortAscii(in, i, len) ? Utf32AsciiToUtf8Scalar(in + i, 1, out + o)
+                                              : k.utf32AsciiToUtf8(in + i, len - i, out + o);
+            i += n;
+            o += n;
+            continue;
+        }
+        if (cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF)) return {false, i, o};
+        o += EncodeUtf8(cp, out + o);
+        ++i;
+    }
+    return {true, i, o};
+}
+
+} // namespace chat
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace chat {
+
+// Instruction sets the transcoders can use; which one runs is picked once at
+// startup from what the CPU reports (see ActiveSimdLevel).
+enum class SimdLevel { Scalar, Sse2, Avx2, Neon };
+
+// `read` input units were consumed and `written` output units produced. On
+// invalid input `ok` is false and `read` is the offset of the offending
+// sequence; everything before it has been converted.
+struct TranscodeResult {
+    bool ok{true};
+    size_t read{0};
+    size_t written{0};
+};
+
+// Output buffers must hold the worst case for the input length: one UTF-16
+// or UTF-32 unit per UTF-8 byte, three UTF-8 bytes per UTF-16 unit and four
+// per UTF-32 unit. The kernels store whole vectors within that bound, so a
+// smaller buffer is not safe even for input known to be short.
+constexpr size_t MaxUtf16ForUtf8(size_t bytes) { return bytes; }
+constexpr size_t MaxUtf32ForUtf8(size_t bytes) { return bytes; }
+constexpr size_t MaxUtf8ForUtf16(size_t units) { return units * 3; }
+constexpr size_t MaxUtf8ForUtf32(size_t units) { return units * 4; }
+
+// Strict conversions: overlong forms, surrogates in UTF-8 or UTF-32, unpaired
+// surrogates in UTF-16, code points past U+10FFFF and truncated sequences all
+// stop the conversion.
+bool ValidUtf8(const char* in, size_t len);
+TranscodeResult Utf8ToUtf16(const char* in, size_t len, char16_t* out);
+TranscodeResult Utf16ToUtf8(const char16_t* in, size_t len, char* out);
+TranscodeResult Utf8ToUtf32(const char* in, size_t len, char32_t* out);
+TranscodeResult Utf32ToUtf8(const char32_t* in, size_t len, char* out);
+
+// Lenient conversions for display: each invalid unit becomes U+FFFD, as the
+// Windows conversion APIs do. Returns the number of units written.
+size_t Utf8ToUtf16Lossy(const char* in, size_t len, char16_t* out);
+size_t Utf16ToUtf8Lossy(const char16_t* in, size_t len, char* out);
+
+SimdLevel DetectedSimdLevel();
+SimdLevel ActiveSimdLevel();
+// Makes every later conversion use `level`, or the best the CPU has below
+// it; returns the level now in use. Meant for benchmarks comparing paths.
+SimdLevel SetSimdLevel(SimdLevel level);
+const char* SimdLevelName(SimdLevel level);
+
+} // namespace chat
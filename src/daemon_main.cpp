@@ -0,0 +1,339 @@
+#include <poll.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+
+#include "core/chat_events.h"
+#include "core/shm_bridge.h"
+#include "core/shm_engine.h"
+#include "core/socket_engine.h"
+
+enum class EngineKind { Socket, Shm, Bridge };
+
+// --mode/--host/--port are shared by the socket engine and the bridge.
+struct DaemonOptions {
+    EngineKind engine{EngineKind::Socket};
+    chat::SocketConfig socket;
+    chat::ShmConfig shm;
+    chat::BridgeConfig bridge;
+};
+
+static std::atomic<bool> g_stop{false};
+static std::mutex g_printMutex;
+static EngineKind g_engine{EngineKind::Socket};
+
+static void OnSignal(int) {
+    g_stop = true;
+}
+
+// A relay serving thousands of clients needs more descriptors than the usual
+// soft limit of 1024.
+static void RaiseFileLimit() {
+    rlimit lim{};
+    if (getrlimit(RLIMIT_NOFILE, &lim) == 0 && lim.rlim_cur < lim.rlim_max) {
+        lim.rlim_cur = lim.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &lim);
+    }
+}
+
+static void PrintUsage() {
+    std::fprintf(stderr,
+        "usage: chat_daemon --engine socket --mode server|client [--host H] [--port P] [--reactors N]\n"
+        "                   [--transport epoll|uring] [--flush-us US] [--nodelay 0|1] [--cork 0|1]\n"
+        "                   [--max-queue-bytes N] [--max-queue-frames N]\n"
+        "                   [--overflow drop-oldest|drop-newest|disconnect|pause]\n"
+        "                   [--store DIR] [--store-segment BYTES] [--store-sync-ms MS]\n"
+        "                   [--store-max-bytes N] [--history N] [--reconnect 0|1]\n"
+        "                   [--retransmit-frames N] [--retransmit-bytes N]\n"
+        "                   [--ack-delay-us US] [--ack-every N]\n"
+        "       chat_daemon --engine shm --channel NAME [--when-full block|fail]\n"
+        "                   [--max-message BYTES] [--wait busy|hybrid|block]\n"
+        "                   [--huge-pages DIR] [--prefault 0|1]\n"
+        "                   [--journal DIR] [--journal-segment BYTES] [--journal-max-bytes N]\n"
+        "                   [--journal-max-age SEC] [--journal-sync none|interval:MS|every:N]\n"
+        "                   [--replay 0|1]\n"
+        "       chat_daemon --engine bridge --mode server|client [--host H] [--port P]\n"
+        "                   --channel LOCAL[:REMOTE] [--channel ...] [shm options]\n"
+        "Lines read from stdin are sent; events are written to stdout.\n"
+        "A bridge relays each LOCAL shm channel to the peer bridge's channel of the\n"
+        "same REMOTE name (default: LOCAL) and reads nothing from stdin.\n");
+}
+
+static bool ParseArgs(int argc, char** argv, DaemonOptions& opts) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--engine" && hasValue) {
+            std::string v = argv[++i];
+            if (v == "socket") opts.engine = EngineKind::Socket;
+            else if (v == "shm") opts.engine = EngineKind::Shm;
+            else if (v == "bridge") opts.engine = EngineKind::Bridge;
+            else return false;
+        } else if (arg == "--mode" && hasValue) {
+            std::string v = argv[++i];
+            if (v == "server") opts.socket.role = chat::Role::Server;
+            else if (v == "client") opts.socket.role = chat::Role::Client;
+            else return false;
+            opts.bridge.role = opts.socket.role;
+        } else if (arg == "--host" && hasValue) {
+            opts.socket.host = opts.bridge.host = argv[++i];
+        } else if (arg == "--port" && hasValue) {
+            opts.socket.port = std::atoi(argv[++i]);
+            if (opts.socket.port <= 0) opts.socket.port = 54000;
+            opts.bridge.port = opts.socket.port;
+        } else if (arg == "--reactors" && hasValue) {
+            opts.socket.reactors = std::atoi(argv[++i]);
+            if (opts.socket.reactors <= 0) opts.socket.reactors = 1;
+        } else if (arg == "--transport" && hasValue) {
+            std::string v = argv[++i];
+            if (v == "epoll") opts.socket.transport = chat::Transport::Epoll;
+            else if (v == "uring" || v == "io_uring") opts.socket.transport = chat::Transport::IoUring;
+            else return false;
+        } else if (arg == "--flush-us" && hasValue) {
+            opts.socket.flushWindowUs = std::atoi(argv[++i]);
+        } else if (arg == "--nodelay" && hasValue) {
+            opts.socket.tcpNoDelay = std::atoi(argv[++i]) != 0;
+        } else if (arg == "--cork" && hasValue) {
+            opts.socket.tcpCork = std::atoi(argv[++i]) != 0;
+        } else if (arg == "--max-queue-bytes" && hasValue) {
+            opts.socket.maxQueueBytes = std::strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--max-queue-frames" && hasValue) {
+            opts.socket.maxQueueFrames = std::strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--overflow" && hasValue) {
+            std::string v = argv[++i];
+            if (v == "drop-oldest") opts.socket.overflow = chat::OverflowPolicy::DropOldest;
+            else if (v == "drop-newest") opts.socket.overflow = chat::OverflowPolicy::DropNewest;
+            else if (v == "disconnect") opts.socket.overflow = chat::OverflowPolicy::Disconnect;
+            else if (v == "pause") opts.socket.overflow = chat::OverflowPolicy::PauseProducer;
+            else return false;
+        } else if (arg == "--store" && hasValue) {
+            opts.socket.store.dir = argv[++i];
+        } else if (arg == "--store-segment" && hasValue) {
+            opts.socket.store.segmentBytes = std::strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--store-sync-ms" && hasValue) {
+            opts.socket.store.syncMs = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+        } else if (arg == "--store-max-bytes" && hasValue) {
+            opts.socket.store.maxBytes = std::strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--history" && hasValue) {
+            opts.socket.historyLast = std::strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--reconnect" && hasValue) {
+            opts.socket.reconnect = std::atoi(argv[++i]) != 0;
+        } else if (arg == "--retransmit-frames" && hasValue) {
+            opts.socket.retransmitFrames = std::strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--retransmit-bytes" && hasValue) {
+            opts.socket.retransmitBytes = std::strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--ack-delay-us" && hasValue) {
+            opts.socket.ackDelayUs = std::atoi(argv[++i]);
+        } else if (arg == "--ack-every" && hasValue) {
+            opts.socket.ackEvery = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+        } else if (arg == "--channel" && hasValue) {
+            std::string v = argv[++i];
+            size_t colon = v.find(':');
+            opts.shm.channel = v.substr(0, colon);
+            opts.bridge.channels.push_back({opts.shm.channel, colon == std::string::npos ? v : v.substr(colon + 1)});
+        } else if (arg == "--huge-pages" && hasValue) {
+            opts.shm.hugePageDir = argv[++i];
+        } else if (arg == "--prefault" && hasValue) {
+            opts.shm.prefault = std::atoi(argv[++i]) != 0;
+        } else if (arg == "--wait" && hasValue) {
+            std::string v = argv[++i];
+            if (v == "busy") opts.shm.wait = chat::WaitMode::BusyPoll;
+            else if (v == "hybrid") opts.shm.wait = chat::WaitMode::Hybrid;
+            else if (v == "block") opts.shm.wait = chat::WaitMode::Blocking;
+            else return false;
+        } else if (arg == "--when-full" && hasValue) {
+            std::string v = argv[++i];
+            if (v == "block") opts.shm.whenFull = chat::FullPolicy::Block;
+            else if (v == "fail") opts.shm.whenFull = chat::FullPolicy::Fail;
+            else return false;
+        } else if (arg == "--max-message" && hasValue) {
+            opts.shm.maxMessageBytes = std::strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--journal" && hasValue) {
+            opts.shm.journal.dir = argv[++i];
+        } else if (arg == "--journal-segment" && hasValue) {
+            opts.shm.journal.segmentBytes = std::strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--journal-max-bytes" && hasValue) {
+            opts.shm.journal.maxBytes = std::strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--journal-max-age" && hasValue) {
+            opts.shm.journal.maxAgeSec = std::strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--journal-sync" && hasValue) {
+            std::string v = argv[++i];
+            if (v == "none") {
+                opts.shm.journal.sync = chat::JournalSync::None;
+            } else if (v.compare(0, 9, "interval:") == 0) {
+                opts.shm.journal.sync = chat::JournalSync::Interval;
+                opts.shm.journal.syncIntervalMs = static_cast<uint32_t>(std::strtoul(v.c_str() + 9, nullptr, 10));
+            } else if (v.compare(0, 6, "every:") == 0) {
+                opts.shm.journal.sync = chat::JournalSync::EveryN;
+                opts.shm.journal.syncEveryN = static_cast<uint32_t>(std::strtoul(v.c_str() + 6, nullptr, 10));
+                if (opts.shm.journal.syncEveryN == 0) opts.shm.journal.syncEveryN = 1;
+            } else {
+                return false;
+            }
+        } else if (arg == "--replay" && hasValue) {
+            opts.shm.journal.replay = std::atoi(argv[++i]) != 0;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Server connection ids carry the owning reactor shard in their top 16 bits;
+// shm peers are numbered from 1.
+static std::string PeerLabel(uint64_t id) {
+    if (g_engine == EngineKind::Shm) return std::to_string(id);
+    return std::to_string(id >> 48) + "." + std::to_string(id & 0xFFFFFFFFFFFFull);
+}
+
+static void PrintEvent(const chat::ChatEvent& ev) {
+    std::lock_guard<std::mutex> lock(g_printMutex);
+    switch (ev.type) {
+    case chat::EventType::Log:
+        std::printf("%s\n", ev.text.c_str());
+        break;
+    case chat::EventType::Status:
+        std::printf("[status] %s\n", ev.text.c_str());
+        break;
+    case chat::EventType::Connected:
+        if (ev.peerId) std::printf("[status] Peer #%s joined\n", PeerLabel(ev.peerId).c_str());
+        else std::printf("[status] Live\n");
+        break;
+    case chat::EventType::Disconnected:
+        if (ev.peerId) std::printf("[status] Peer #%s left\n", PeerLabel(ev.peerId).c_str());
+        else std::printf("[status] Offline\n");
+        break;
+    case chat::EventType::Message:
+        std::printf("[RX][%s] %.*s\n", ev.from.c_str(), static_cast<int>(ev.Body().size()), ev.Body().data());
+        break;
+    }
+    std::fflush(stdout);
+}
+
+// Socket clients read "/join ROOM", "/leave ROOM" and "/to ROOM TEXT" from
+// stdin; every other line is sent as is.
+static void SendLine(chat::SocketEngine& engine, const std::string& line) {
+    if (line.rfind("/join ", 0) == 0) {
+        engine.Join(line.substr(6));
+    } else if (line.rfind("/leave ", 0) == 0) {
+        engine.Leave(line.substr(7));
+    } else if (line.rfind("/to ", 0) == 0) {
+        size_t space = line.find(' ', 4);
+        if (space != std::string::npos) engine.SendTo(line.substr(4, space - 4), line.substr(space + 1));
+    } else {
+        engine.Send(line);
+    }
+}
+
+template <typename Engine>
+static void SendLine(Engine& engine, const std::string& line) {
+    engine.Send(line);
+}
+
+template <typename Engine>
+static void RunLoop(Engine& engine) {
+    bool stdinOpen = true;
+    std::string pending;
+    char buf[4096];
+    while (!g_stop && engine.Running()) {
+        if (!stdinOpen) {
+            usleep(200 * 1000);
+            continue;
+        }
+        pollfd pfd{STDIN_FILENO, POLLIN, 0};
+        if (poll(&pfd, 1, 200) <= 0) continue;
+        ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
+        if (n <= 0) {
+            stdinOpen = false;
+            continue;
+        }
+        pending.append(buf, static_cast<size_t>(n));
+        size_t start = 0;
+        for (size_t nl; (nl = pending.find('\n', start)) != std::string::npos; start = nl + 1) {
+            std::string line = pending.substr(start, nl - start);
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            if (!line.empty()) SendLine(engine, line);
+        }
+        pending.erase(0, start);
+    }
+}
+
+int main(int argc, char** argv) {
+    DaemonOptions opts;
+    if (!ParseArgs(argc, argv, opts)) {
+        PrintUsage();
+        return 2;
+    }
+
+    g_engine = opts.engine;
+
+    struct sigaction sa{};
+    sa.sa_handler = OnSignal;
+    sigaction(SIGINT, &sa, nullptr);
+    sigaction(SIGTERM, &sa, nullptr);
+    signal(SIGPIPE, SIG_IGN);
+    RaiseFileLimit();
+
+    if (opts.engine == EngineKind::Socket) {
+        chat::SocketEngine engine(PrintEvent);
+        if (!engine.Start(opts.socket)) return 1;
+        RunLoop(engine);
+        if (opts.socket.role == chat::Role::Server) {
+            chat::SocketStats st = engine.Stats();
+            std::fprintf(stderr, "syscalls=%llu messages_in=%llu bytes_in=%llu bytes_out=%llu\n"
+                                 "queued_bytes=%llu peak_queue_bytes=%llu dropped=%llu "
+                                 "slow_disconnects=%llu producer_pauses=%llu\n"
+                                 "stored=%llu store_syncs=%llu store_failures=%llu replays=%llu replay_bytes=%llu "
+                                 "replays_refused=%llu\n"
+                                 "resumes=%llu resumes_from_store=%llu resume_misses=%llu "
+                                 "acks=%llu duplicates=%llu\n",
+                         static_cast<unsigned long long>(st.syscalls),
+                         static_cast<unsigned long long>(st.messagesIn),
+                         static_cast<unsigned long long>(st.bytesIn),
+                         static_cast<unsigned long long>(st.bytesOut),
+                         static_cast<unsigned long long>(st.queuedBytes),
+                         static_cast<unsigned long long>(st.peakQueueBytes),
+                         static_cast<unsigned long long>(st.droppedFrames),
+                         static_cast<unsigned long long>(st.slowDisconnects),
+                         static_cast<unsigned long long>(st.producerPauses),
+                         static_cast<unsigned long long>(st.storedMessages),
+                         static_cast<unsigned long long>(st.storeSyncs),
+                         static_cast<unsigned long long>(st.storeFailures),
+                         static_cast<unsigned long long>(st.replayRequests),
+                         static_cast<unsigned long long>(st.replayBytes),
+                         static_cast<unsigned long long>(st.replaysRefused),
+                         static_cast<unsigned long long>(st.resumes),
+                         static_cast<unsigned long long>(st.resumesFromStore),
+                         static_cast<unsigned long long>(st.resumeMisses),
+                         static_cast<unsigned long long>(st.acksSent),
+                         static_cast<unsigned long long>(st.duplicates));
+        }
+        engine.Stop();
+    } else if (opts.engine == EngineKind::Shm) {
+        chat::ShmEngine engine(PrintEvent);
+        if (!engine.Start(opts.shm)) return 1;
+        RunLoop(engine);
+        engine.Stop();
+    } else {
+        chat::ShmBridge bridge(PrintEvent);
+        opts.bridge.shm = opts.shm;
+        if (!bridge.Start(opts.bridge)) return 1;
+        while (!g_stop && bridge.Running()) usleep(200 * 1000);
+        bridge.Stop();
+        chat::BridgeStats st = bridge.Stats();
+        std::fprintf(stderr, "records_out=%llu bytes_out=%llu syscalls=%llu records_in=%llu dropped=%llu\n",
+                     static_cast<unsigned long long>(st.recordsOut),
+                     static_cast<unsigned long long>(st.bytesOut),
+                     static_cast<unsigned long long>(st.syscalls),
+                     static_cast<unsigned long long>(st.recordsIn),
+                     static_cast<unsigned long long>(st.dropped));
+    }
+    return 0;
+}
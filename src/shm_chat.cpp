@@ -8,6 +8,7 @@
 #include <shellapi.h>
 
 #include "ui_helpers.h"
+#include "core/shm_ring.h"
 
 #pragma comment(lib, "comctl32.lib")
 #pragma comment(lib, "msimg32.lib")
@@ -17,19 +18,24 @@ static constexpr UINT WM_APP_STATUS = WM_APP + 2;
 
 enum class Peer { A, B };
 
-constexpr size_t kMaxMessages = 64;
-constexpr size_t kMaxText = 240;
+// A side whose heartbeat is this old is treated as gone even if its process
+// still exists.
+static constexpr ULONGLONG kPeerTimeoutMs = 5000;
 
-struct ChatMessage {
-    DWORD tick;
-    wchar_t text[kMaxText];
+// Who holds each side of the channel. `generation` is bumped by every process
+// that takes the side, so the other one can tell a restart from a stall.
+struct PeerLiveness {
+    LONG pid;
+    LONG generation;
+    LONGLONG heartbeatMs;
 };
 
+// One SPSC ring per direction carrying UTF-8 text (core/shm_ring.h), plus the
+// liveness row of each side. A new mapping is zero-filled by the system.
 struct SharedRegion {
-    LONG headAtoB;
-    LONG headBtoA;
-    ChatMessage aToB[kMaxMessages];
-    ChatMessage bToA[kMaxMessages];
+    PeerLiveness sides[2];
+    chat::ShmRing aToB;
+    chat::ShmRing bToA;
 };
 
 struct AppState {
@@ -44,15 +50,36 @@ struct AppState {
     HANDLE semOut{nullptr};
     std::thread recvThread;
     Peer peer{Peer::A};
-    long localTail{0};
+    bool peerAlive{false};
+    LONG peerGeneration{0};
+    chat::RingReader reader;
+    chat::RingWriter writer;
     std::mutex sendMutex;
+    // Log lines from every thread, shown by the UI thread (FlushLog).
+    chat::LogPipeline<wchar_t> logs;
+    chat::LogModel<wchar_t> logModel;
+    chat::LogUpdate<wchar_t> logUpdate;
 };
 
 static LPWSTR g_shmCmdLine = nullptr;
 
-static void PostLog(HWND hwnd, const std::wstring& text) {
-    auto payload = new std::wstring(text);
-    PostMessageW(hwnd, WM_APP_LOG, 0, reinterpret_cast<LPARAM>(payload));
+static size_t Utf8Prefix(const std::string& text, size_t maxBytes) {
+    if (text.size() <= maxBytes) return text.size();
+    size_t n = maxBytes;
+    while (n > 0 && (static_cast<unsigned char>(text[n]) & 0xC0) == 0x80) --n;
+    return n;
+}
+
+static void PostLog(AppState* app, const wchar_t* text) {
+    if (app->logs.Push(text, wcslen(text))) PostMessageW(app->hwnd, WM_APP_LOG, 0, 0);
+}
+
+static void PostLog(AppState* app, const std::wstring& text) {
+    if (app->logs.Push(text)) PostMessageW(app->hwnd, WM_APP_LOG, 0, 0);
+}
+
+static void PostReceived(AppState* app, const wchar_t* from, const char* utf8, size_t len) {
+    if (PushUtf8Line(app->logs, from, utf8, len)) PostMessageW(app->hwnd, WM_APP_LOG, 0, 0);
 }
 
 static void PostStatus(HWND hwnd, const std::wstring& text) {
@@ -70,10 +97,83 @@ static Peer CurrentPeer(AppState* app) {
     return (SendMessageW(app->peerARadio, BM_GETCHECK, 0, 0) == BST_CHECKED) ? Peer::A : Peer::B;
 }
 
+static int SideIndex(Peer peer) {
+    return peer == Peer::A ? 0 : 1;
+}
+
+static const wchar_t* SideName(Peer peer) {
+    return peer == Peer::A ? L"A" : L"B";
+}
+
+static bool ProcessAlive(LONG pid) {
+    HANDLE process = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, static_cast<DWORD>(pid));
+    if (!process) return GetLastError() != ERROR_INVALID_PARAMETER;
+    DWORD code = 0;
+    bool alive = GetExitCodeProcess(process, &code) && code == STILL_ACTIVE;
+    CloseHandle(process);
+    return alive;
+}
+
+static bool SideAlive(const PeerLiveness& side) {
+    LONG pid = side.pid;
+    if (pid == 0 || !ProcessAlive(pid)) return false;
+    LONGLONG beat = side.heartbeatMs;
+    ULONGLONG now = GetTickCount64();
+    return static_cast<ULONGLONG>(beat) >= now || now - static_cast<ULONGLONG>(beat) < kPeerTimeoutMs;
+}
+
+// Takes this process's side of the channel. A side still held by a live
+// process is refused; one left behind by a process that died is taken over,
+// and since the rings keep their positions the new owner carries on exactly
+// where the old one stopped.
+static bool ClaimSide(AppState* app) {
+    PeerLiveness& mine = app->region->sides[SideIndex(app->peer)];
+    LONG self = static_cast<LONG>(GetCurrentProcessId());
+    LONG owner = mine.pid;
+    if (owner != 0 && owner != self && SideAlive(mine)) {
+        PostLog(app, FormatWide(L"Peer %s is already in use by process %ld.\r\n", SideName(app->peer), owner));
+        return false;
+    }
+    if (InterlockedCompareExchange(&mine.pid, self, owner) != owner) {
+        PostLog(app, FormatWide(L"Peer %s was taken by another process.\r\n", SideName(app->peer)));
+        return false;
+    }
+    InterlockedExchange64(&mine.heartbeatMs, static_cast<LONGLONG>(GetTickCount64()));
+    InterlockedIncrement(&mine.generation);
+    if (owner != 0 && owner != self) {
+        PostLog(app, FormatWide(L"[!] Took over Peer %s from process %ld, which stopped responding.\r\n",
+                                      SideName(app->peer), owner));
+    }
+    return true;
+}
+
+// Reports the other side arriving, restarting or going away.
+static void CheckPeer(AppState* app) {
+    Peer other = app->peer == Peer::A ? Peer::B : Peer::A;
+    const PeerLiveness& side = app->region->sides[SideIndex(other)];
+    LONG generation = side.generation;
+    bool alive = SideAlive(side);
+    if (alive && app->peerAlive && generation != app->peerGeneration) {
+        PostLog(app, FormatWide(L"[i] Peer %s restarted.\r\n", SideName(other)));
+    } else if (alive && !app->peerAlive) {
+        PostLog(app, FormatWide(L"[i] Peer %s connected.\r\n", SideName(other)));
+    } else if (!alive && app->peerAlive) {
+        PostLog(app, FormatWide(L"[!] Peer %s stopped responding; messages wait in the ring for it.\r\n",
+                                SideName(other)));
+    }
+    app->peerAlive = alive;
+    app->peerGeneration = generation;
+}
+
 static void CloseHandles(AppState* app) {
     if (app->semIn) { CloseHandle(app->semIn); app->semIn = nullptr; }
     if (app->semOut) { CloseHandle(app->semOut); app->semOut = nullptr; }
-    if (app->region) { UnmapViewOfFile(app->region); app->region = nullptr; }
+    if (app->region) {
+        LONG self = static_cast<LONG>(GetCurrentProcessId());
+        InterlockedCompareExchange(&app->region->sides[SideIndex(app->peer)].pid, 0, self);
+        UnmapViewOfFile(app->region);
+        app->region = nullptr;
+    }
     if (app->mapHandle) { CloseHandle(app->mapHandle); app->mapHandle = nullptr; }
 }
 
@@ -91,24 +191,27 @@ static void StopChat(AppState* app) {
 }
 
 static void ReceiveLoop(AppState* app) {
+    PeerLiveness& mine = app->region->sides[SideIndex(app->peer)];
     while (app->running) {
-        DWORD wait = WaitForSingleObject(app->semIn, 200);
+        WaitForSingleObject(app->semIn, 200);
         if (!app->running) break;
-        if (wait == WAIT_OBJECT_0) {
-            long idx = app->localTail++;
-            size_t slot = static_cast<size_t>(idx % kMaxMessages);
-            const ChatMessage* msg = (app->peer == Peer::A)
-                ? &app->region->bToA[slot]
-                : &app->region->aToB[slot];
-            std::wstring sender = (app->peer == Peer::A) ? L"[RX][Peer B] " : L"[RX][Peer A] ";
-            PostLog(app->hwnd, sender + std::wstring(msg->text) + L"\r\n");
+        InterlockedExchange64(&mine.heartbeatMs, static_cast<LONGLONG>(GetTickCount64()));
+        CheckPeer(app);
+        const wchar_t* sender = (app->peer == Peer::A) ? L"[RX][Peer B] " : L"[RX][Peer A] ";
+        std::string text;
+        while (app->reader.TryPop(text)) {
+            PostReceived(app, sender, text.data(), text.size());
+        }
+        uint64_t lost = app->reader.TakeLost();
+        if (lost) {
+            PostLog(app, FormatWide(L"[!] Peer dropped %llu message(s): ring full.\r\n", (unsigned long long)lost));
         }
     }
 }
 
 static void StartChat(AppState* app) {
     if (app->running) {
-        PostLog(app->hwnd, L"Already running.\r\n");
+        PostLog(app, L"Already running.\r\n");
         return;
     }
     app->peer = CurrentPeer(app);
@@ -119,19 +222,19 @@ static void StartChat(AppState* app) {
     std::wstring semBtoA = base + L"_BtoA";
 
     app->mapHandle = CreateFileMappingW(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, sizeof(SharedRegion), mapName.c_str());
-    bool existed = (GetLastError() == ERROR_ALREADY_EXISTS);
     if (!app->mapHandle) {
-        PostLog(app->hwnd, L"Failed to create shared memory.");
+        PostLog(app, L"Failed to create shared memory.");
         return;
     }
     app->region = (SharedRegion*)MapViewOfFile(app->mapHandle, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(SharedRegion));
     if (!app->region) {
-        PostLog(app->hwnd, L"MapViewOfFile failed.");
+        PostLog(app, L"MapViewOfFile failed.");
         CloseHandles(app);
         return;
     }
-    if (!existed) {
-        ZeroMemory(app->region, sizeof(SharedRegion));
+    if (!ClaimSide(app)) {
+        CloseHandles(app);
+        return;
     }
 
     std::wstring inName = (app->peer == Peer::A) ? semBtoA : semAtoB;
@@ -139,49 +242,49 @@ static void StartChat(AppState* app) {
     app->semIn = CreateSemaphoreW(nullptr, 0, 1024, inName.c_str());
     app->semOut = CreateSemaphoreW(nullptr, 0, 1024, outName.c_str());
     if (!app->semIn || !app->semOut) {
-        PostLog(app->hwnd, L"Failed to create semaphores.");
+        PostLog(app, L"Failed to create semaphores.");
         CloseHandles(app);
         return;
     }
 
-    app->localTail = 0;
+    app->reader.Attach(app->peer == Peer::A ? &app->region->bToA : &app->region->aToB);
+    app->writer.Attach(app->peer == Peer::A ? &app->region->aToB : &app->region->bToA);
+    app->peerAlive = false;
+    app->peerGeneration = 0;
     app->running = true;
     EnableWindow(app->peerARadio, FALSE);
     EnableWindow(app->peerBRadio, FALSE);
     EnableWindow(app->startBtn, FALSE);
     EnableWindow(app->stopBtn, TRUE);
     PostStatus(app->hwnd, L"Connected to channel \"" + channel + L"\" as Peer " + (app->peer == Peer::A ? L"A" : L"B"));
-    PostLog(app->hwnd, L"Shared memory ready.\r\n");
+    PostLog(app, L"Shared memory ready.\r\n");
     EnableWindow(app->sendBtn, TRUE);
     app->recvThread = std::thread(ReceiveLoop, app);
 }
 
 static void SendChat(AppState* app) {
     if (!app->running || !app->region) {
-        PostLog(app->hwnd, L"Not connected.\r\n");
+        PostLog(app, L"Not connected.\r\n");
         return;
     }
     std::wstring text = GetWindowTextWstr(app->inputBox);
     if (text.empty()) return;
-    if (text.size() >= kMaxText) text.resize(kMaxText - 1);
-
-    LONG newHead;
-    ChatMessage* slot;
-    if (app->peer == Peer::A) {
-        newHead = InterlockedIncrement(&app->region->headAtoB);
-        size_t idx = static_cast<size_t>((newHead - 1) % kMaxMessages);
-        slot = &app->region->aToB[idx];
-    } else {
-        newHead = InterlockedIncrement(&app->region->headBtoA);
-        size_t idx = static_cast<size_t>((newHead - 1) % kMaxMessages);
-        slot = &app->region->bToA[idx];
+    std::string utf8 = WideToUtf8(text);
+    size_t len = Utf8Prefix(utf8, chat::kMaxRecord);
+
+    {
+        // The UI thread never blocks on a slow peer: a full ring drops the
+        // message and the peer is told how many it missed.
+        std::lock_guard<std::mutex> lock(app->sendMutex);
+        if (app->writer.TryPush(utf8.data(), len, GetTickCount()) == chat::PushResult::Full) {
+            app->writer.NoteLost();
+            PostLog(app, L"[!] Peer is not keeping up; message dropped.\r\n");
+            return;
+        }
     }
-
-    slot->tick = GetTickCount();
-    wcsncpy_s(slot->text, text.c_str(), kMaxText - 1);
     ReleaseSemaphore(app->semOut, 1, nullptr);
     std::wstring me = (app->peer == Peer::A) ? L"[TX][Peer A] " : L"[TX][Peer B] ";
-    PostLog(app->hwnd, me + text + L"\r\n");
+    PostLog(app, me + text + L"\r\n");
     SetWindowTextW(app->inputBox, L"");
 }
 
@@ -257,6 +360,7 @@ static void CreateUi(AppState* app) {
     SetControlFont(app->startBtn, app->fontMedium);
     SetControlFont(app->stopBtn, app->fontMedium);
     SetControlFont(app->logBox, app->fontMono);
+    SendMessageW(app->logBox, EM_SETLIMITTEXT, (WPARAM)app->logModel.Capacity(), 0);
     SetControlFont(app->inputBox, app->fontSmall);
     SetControlFont(app->sendBtn, app->fontMedium);
 }
@@ -336,10 +440,12 @@ static LRESULT CALLBACK WndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lPara
         return 0;
     }
     case WM_APP_LOG: {
-        auto text = reinterpret_cast<std::wstring*>(lParam);
-        if (text) {
-            AppendText(app->logBox, *text);
-            delete text;
+        SetTimer(hwnd, kLogTimerId, kLogFrameMs, nullptr);
+        return 0;
+    }
+    case WM_TIMER: {
+        if (wParam == kLogTimerId) {
+            if (!FlushLog(app->logBox, app->logs, app->logModel, app->logUpdate)) KillTimer(hwnd, kLogTimerId);
         }
         return 0;
     }
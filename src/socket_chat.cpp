@@ -37,29 +37,24 @@ struct AppState {
     std::thread recvThread;
     Role role{Role::Server};
     std::mutex sendMutex;
+    // Log lines from every thread, shown by the UI thread (FlushLog).
+    chat::LogPipeline<wchar_t> logs;
+    chat::LogModel<wchar_t> logModel;
+    chat::LogUpdate<wchar_t> logUpdate;
 };
 
 static LPWSTR g_socketCmdLine = nullptr;
 
-static std::wstring Utf8ToWide(const std::string& s) {
-    if (s.empty()) return L"";
-    int len = MultiByteToWideChar(CP_UTF8, 0, s.c_str(), (int)s.size(), nullptr, 0);
-    std::wstring w(len, L'\0');
-    MultiByteToWideChar(CP_UTF8, 0, s.c_str(), (int)s.size(), w.data(), len);
-    return w;
+static void PostLog(AppState* app, const wchar_t* text) {
+    if (app->logs.Push(text, wcslen(text))) PostMessageW(app->hwnd, WM_APP_LOG, 0, 0);
 }
 
-static std::string WideToUtf8(const std::wstring& w) {
-    if (w.empty()) return std::string();
-    int len = WideCharToMultiByte(CP_UTF8, 0, w.c_str(), (int)w.size(), nullptr, 0, nullptr, nullptr);
-    std::string s(len, '\0');
-    WideCharToMultiByte(CP_UTF8, 0, w.c_str(), (int)w.size(), s.data(), len, nullptr, nullptr);
-    return s;
+static void PostLog(AppState* app, const std::wstring& text) {
+    if (app->logs.Push(text)) PostMessageW(app->hwnd, WM_APP_LOG, 0, 0);
 }
 
-static void PostLog(HWND hwnd, const std::wstring& text) {
-    auto payload = new std::wstring(text);
-    PostMessageW(hwnd, WM_APP_LOG, 0, reinterpret_cast<LPARAM>(payload));
+static void PostReceived(AppState* app, const wchar_t* from, const char* utf8, size_t len) {
+    if (PushUtf8Line(app->logs, from, utf8, len)) PostMessageW(app->hwnd, WM_APP_LOG, 0, 0);
 }
 
 static void PostConnected(HWND hwnd, bool connected) {
@@ -89,28 +84,27 @@ static void ReceiveLoop(AppState* app) {
     while (app->running && app->connSock != INVALID_SOCKET) {
         int res = recv(app->connSock, buffer, sizeof(buffer) - 1, 0);
         if (res <= 0) {
-            PostLog(app->hwnd, L"[!] Disconnected.\r\n");
+            PostLog(app, L"[!] Disconnected.\r\n");
             app->connected = false;
             PostConnected(app->hwnd, false);
             break;
         }
         buffer[res] = '\0';
-        std::string msg(buffer, res);
-        std::wstring fromLabel = (app->role == Role::Server) ? L"[RX][Client] " : L"[RX][Server] ";
-        PostLog(app->hwnd, fromLabel + Utf8ToWide(msg) + L"\r\n");
+        const wchar_t* fromLabel = (app->role == Role::Server) ? L"[RX][Client] " : L"[RX][Server] ";
+        PostReceived(app, fromLabel, buffer, static_cast<size_t>(res));
     }
 }
 
 static void RunServer(AppState* app, int port) {
     WSADATA wsa;
     if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0) {
-        PostLog(app->hwnd, L"WSAStartup failed.");
+        PostLog(app, L"WSAStartup failed.");
         return;
     }
 
     SOCKET listenSock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
     if (listenSock == INVALID_SOCKET) {
-        PostLog(app->hwnd, L"Failed to create socket.");
+        PostLog(app, L"Failed to create socket.");
         WSACleanup();
         return;
     }
@@ -122,21 +116,21 @@ static void RunServer(AppState* app, int port) {
     hint.sin_addr.S_un.S_addr = INADDR_ANY;
 
     if (bind(listenSock, reinterpret_cast<sockaddr*>(&hint), sizeof(hint)) == SOCKET_ERROR) {
-        PostLog(app->hwnd, L"Bind failed. Is the port in use?");
+        PostLog(app, L"Bind failed. Is the port in use?");
         CloseSocket(app->listenSock);
         WSACleanup();
         return;
     }
 
     listen(listenSock, SOMAXCONN);
-    PostLog(app->hwnd, L"Listening on port " + std::to_wstring(port) + L"...\r\n");
-    PostLog(app->hwnd, L"Waiting for a client to connect...\r\n");
+    PostLog(app, L"Listening on port " + std::to_wstring(port) + L"...\r\n");
+    PostLog(app, L"Waiting for a client to connect...\r\n");
 
     sockaddr_in client;
     int clientSize = sizeof(client);
     SOCKET clientSocket = accept(listenSock, reinterpret_cast<sockaddr*>(&client), &clientSize);
     if (clientSocket == INVALID_SOCKET) {
-        if (app->running) PostLog(app->hwnd, L"Accept failed.");
+        if (app->running) PostLog(app, L"Accept failed.");
         CloseSocket(app->listenSock);
         WSACleanup();
         return;
@@ -150,7 +144,7 @@ static void RunServer(AppState* app, int port) {
                  svc, NI_MAXSERV,
                  NI_NUMERICHOST | NI_NUMERICSERV);
 
-    PostLog(app->hwnd, FormatWide(L"Connected: %s:%s\r\n", host, svc));
+    PostLog(app, FormatWide(L"Connected: %s:%s\r\n", host, svc));
     app->connSock = clientSocket;
     app->connected = true;
     PostConnected(app->hwnd, true);
@@ -167,12 +161,12 @@ static void RunServer(AppState* app, int port) {
 static void RunClient(AppState* app, const std::wstring& host, int port) {
     WSADATA wsa;
     if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0) {
-        PostLog(app->hwnd, L"WSAStartup failed.");
+        PostLog(app, L"WSAStartup failed.");
         return;
     }
     SOCKET sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
     if (sock == INVALID_SOCKET) {
-        PostLog(app->hwnd, L"Failed to create socket.");
+        PostLog(app, L"Failed to create socket.");
         WSACleanup();
         return;
     }
@@ -185,16 +179,16 @@ static void RunClient(AppState* app, const std::wstring& host, int port) {
     std::string hostUtf8 = WideToUtf8(host);
     inet_pton(AF_INET, hostUtf8.c_str(), &hint.sin_addr);
 
-    PostLog(app->hwnd, L"Connecting to " + host + L":" + std::to_wstring(port) + L"...\r\n");
+    PostLog(app, L"Connecting to " + host + L":" + std::to_wstring(port) + L"...\r\n");
     if (connect(sock, reinterpret_cast<sockaddr*>(&hint), sizeof(hint)) == SOCKET_ERROR) {
-        PostLog(app->hwnd, L"Connect failed. Check IP/port.");
+        PostLog(app, L"Connect failed. Check IP/port.");
         CloseSocket(app->connSock);
         app->running = false;
         WSACleanup();
         return;
     }
 
-    PostLog(app->hwnd, L"Connected!\r\n");
+    PostLog(app, L"Connected!\r\n");
     app->connected = true;
     PostConnected(app->hwnd, true);
     app->recvThread = std::thread(ReceiveLoop, app);
@@ -207,7 +201,7 @@ static void RunClient(AppState* app, const std::wstring& host, int port) {
 
 static void SendMessageOut(AppState* app) {
     if (!app->connected || app->connSock == INVALID_SOCKET) {
-        PostLog(app->hwnd, L"Not connected.\r\n");
+        PostLog(app, L"Not connected.\r\n");
         return;
     }
     std::wstring text = GetWindowTextWstr(app->inputBox);
@@ -216,7 +210,7 @@ static void SendMessageOut(AppState* app) {
     std::lock_guard<std::mutex> lock(app->sendMutex);
     send(app->connSock, payload.c_str(), static_cast<int>(payload.size()), 0);
     std::wstring label = (app->role == Role::Server) ? L"[TX][Server] " : L"[TX][Client] ";
-    PostLog(app->hwnd, label + text + L"\r\n");
+    PostLog(app, label + text + L"\r\n");
     SetWindowTextW(app->inputBox, L"");
 }
 
@@ -303,6 +297,7 @@ static void CreateUi(AppState* app) {
     SetControlFont(app->startBtn, app->fontMedium);
     SetControlFont(app->stopBtn, app->fontMedium);
     SetControlFont(app->logBox, app->fontMono);
+    SendMessageW(app->logBox, EM_SETLIMITTEXT, (WPARAM)app->logModel.Capacity(), 0);
     SetControlFont(app->inputBox, app->fontSmall);
     SetControlFont(app->sendBtn, app->fontMedium);
 }
@@ -334,7 +329,7 @@ static int GetPortFromUi(AppState* app) {
 
 static void StartConnection(AppState* app) {
     if (app->running) {
-        PostLog(app->hwnd, L"Already running.\r\n");
+        PostLog(app, L"Already running.\r\n");
         return;
     }
     app->running = true;
@@ -411,10 +406,12 @@ static LRESULT CALLBACK WndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lPara
         return 0;
     }
     case WM_APP_LOG: {
-        auto text = reinterpret_cast<std::wstring*>(lParam);
-        if (text) {
-            AppendText(app->logBox, *text);
-            delete text;
+        SetTimer(hwnd, kLogTimerId, kLogFrameMs, nullptr);
+        return 0;
+    }
+    case WM_TIMER: {
+        if (wParam == kLogTimerId) {
+            if (!FlushLog(app->logBox, app->logs, app->logModel, app->logUpdate)) KillTimer(hwnd, kLogTimerId);
         }
         return 0;
     }
@@ -2,11 +2,15 @@
 
 #include <windows.h>
 #include <commctrl.h>
+#include <algorithm>
 #include <string>
 #include <sstream>
 #include <strsafe.h>
 #include <cstdarg>
 
+#include "core/log_model.h"
+#include "core/utf.h"
+
 struct UiTheme {
     COLORREF base = RGB(12, 18, 38);        
     COLORREF card = RGB(22, 30, 52);         
@@ -34,12 +38,60 @@ inline std::wstring GetWindowTextWstr(HWND hwnd) {
     return text;
 }
 
+static_assert(sizeof(wchar_t) == sizeof(char16_t), "the Win32 UI assumes UTF-16 wchar_t");
+
+// Invalid sequences turn into U+FFFD, matching MultiByteToWideChar.
+inline std::wstring Utf8ToWide(const std::string& s) {
+    std::wstring w(chat::MaxUtf16ForUtf8(s.size()), L'\0');
+    w.resize(chat::Utf8ToUtf16Lossy(s.data(), s.size(), reinterpret_cast<char16_t*>(&w[0])));
+    return w;
+}
+
+// Queues "<prefix><utf8>\r\n" as one log line, transcoded straight into the
+// pipeline's batch. True if the caller should wake the UI thread.
+inline bool PushUtf8Line(chat::LogPipeline<wchar_t>& logs, const wchar_t* prefix, const char* utf8, size_t len) {
+    size_t pre = wcslen(prefix);
+    return logs.Emplace(pre + chat::MaxUtf16ForUtf8(len) + 2, [&](wchar_t* out) {
+        std::copy(prefix, prefix + pre, out);
+        size_t n = pre + chat::Utf8ToUtf16Lossy(utf8, len, reinterpret_cast<char16_t*>(out + pre));
+        out[n++] = L'\r';
+        out[n++] = L'\n';
+        return n;
+    });
+}
+
+inline std::string WideToUtf8(const std::wstring& w) {
+    std::string s(chat::MaxUtf8ForUtf16(w.size()), '\0');
+    s.resize(chat::Utf16ToUtf8Lossy(reinterpret_cast<const char16_t*>(w.data()), w.size(), &s[0]));
+    return s;
+}
+
 inline void AppendText(HWND edit, const std::wstring& text) {
     int end = GetWindowTextLengthW(edit);
     SendMessageW(edit, EM_SETSEL, (WPARAM)end, (LPARAM)end);
     SendMessageW(edit, EM_REPLACESEL, FALSE, (LPARAM)text.c_str());
 }
 
+// Log lines reach the edit control at most once per frame: the first line
+// queued after a flush posts a wake-up, which arms this timer.
+constexpr UINT_PTR kLogTimerId = 1;
+constexpr UINT kLogFrameMs = 16;
+
+// Brings `edit` up to date with `model` in at most two edits, whatever the
+// number of lines queued since the last flush. True if lines are still
+// queued and the caller should flush again next frame.
+inline bool FlushLog(HWND edit, chat::LogPipeline<wchar_t>& logs, chat::LogModel<wchar_t>& model,
+                     chat::LogUpdate<wchar_t>& update) {
+    logs.Drain(model);
+    model.TakeUpdate(update);
+    if (update.trim) {
+        SendMessageW(edit, EM_SETSEL, 0, (LPARAM)update.trim);
+        SendMessageW(edit, EM_REPLACESEL, FALSE, (LPARAM)L"");
+    }
+    if (!update.append.empty()) AppendText(edit, update.append);
+    return logs.Queued() != 0;
+}
+
 inline void PaintGradientHeader(HDC hdc, const RECT& area, const UiTheme& theme) {
     TRIVERTEX vert[2];
     vert[0].x = area.left;